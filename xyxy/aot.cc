@@ -0,0 +1,368 @@
+#include "xyxy/aot.h"
+
+#include <cmath>
+#include <map>
+#include <vector>
+
+#include "xyxy/logging.h"
+#include "xyxy/type.h"
+#include "xyxy/vm.h"
+
+namespace xyxy {
+
+static const char* OpcodeName(uint8 opcode) {
+#define XYXY_OPCODE_NAME(opcode, length) #opcode,
+  static const char* kNames[] = {XYXY_OPCODE_LIST(XYXY_OPCODE_NAME)};
+#undef XYXY_OPCODE_NAME
+  return opcode < OP_COUNT ? kNames[opcode] : "OP_UNKNOWN";
+}
+
+// Returns `str` as a C++ string literal.
+static std::string CppStringLiteral(const std::string& str) {
+  std::string literal = "\"";
+  for (unsigned char c : str) {
+    if (c == '"' || c == '\\') {
+      literal += '\\';
+      literal += c;
+    }
+    else if (c >= 0x20 && c < 0x7f) {
+      literal += c;
+    }
+    else {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\%03o", c);
+      literal += buf;
+    }
+  }
+  return literal + "\"";
+}
+
+// Emits the C++ source of one chunk.
+class CppEmitter {
+ public:
+  CppEmitter(const Chunk& chunk, const AotOptions& options)
+      : chunk_(chunk), options_(options) {}
+
+  Status Emit(std::string* source);
+
+ private:
+  // Computes the stack depth before every reachable inst, and marks the
+  // targets of jumps.
+  Status ComputeDepths();
+
+  // Emits the constants read by OP_CONSTANT.
+  Status EmitConstants();
+  Status EmitInst(int pc);
+
+  // Returns the variable holding the stack slot `slot`.
+  static std::string Slot(int slot) { return "s" + std::to_string(slot); }
+
+  // Returns the variable holding the global of the constant `index`.
+  std::string Global(int index);
+
+  // Returns the statement leaving the function with `error` at `pc`.
+  static std::string Throw(int pc, const std::string& error) {
+    return "{ rt->SetError(" + std::to_string(pc) + ", " + error +
+           "); return false; }";
+  }
+
+  const Chunk& chunk_;
+  const AotOptions& options_;
+  std::vector<int> depth_;
+  std::vector<bool> is_target_;
+  int max_depth_ = 0;
+  std::vector<bool> is_used_;
+  std::string constants_;
+  std::string globals_;
+  std::map<std::string, int> global_index_;
+  std::string body_;
+};
+
+Status CppEmitter::ComputeDepths() {
+  const int size = chunk_.size();
+  depth_.assign(size + 1, -1);
+  is_target_.assign(size + 1, false);
+  std::vector<int> worklist;
+  auto visit = [&](int pc, int depth) {
+    if (pc < 0 || pc > size) {
+      return Status(INVALID_ARGUMENT, "Jump out of the chunk.");
+    }
+    if (depth_[pc] == -1) {
+      depth_[pc] = depth;
+      worklist.push_back(pc);
+    }
+    else if (depth_[pc] != depth) {
+      return Status(INVALID_ARGUMENT, "Inconsistent stack depth at " +
+                                          std::to_string(pc) + ".");
+    }
+    return Status();
+  };
+  Status status = visit(0, 0);
+  while (status.ok() && !worklist.empty()) {
+    int pc = worklist.back();
+    worklist.pop_back();
+    if (pc == size) {
+      continue;
+    }
+    uint8 opcode = BaseOpcode(chunk_.GetByte(pc));
+    if (opcode >= OP_COUNT || pc + InstLength(opcode) > size) {
+      return Status(INVALID_ARGUMENT, "Unknown opcode.");
+    }
+    int depth = depth_[pc] + StackEffect(chunk_, pc);
+    if (depth < 0) {
+      return Status(INVALID_ARGUMENT, "Stack underflow.");
+    }
+    max_depth_ = std::max(max_depth_, std::max(depth, depth_[pc]));
+    if (opcode == OP_JUMP_IF_FALSE || opcode == OP_JUMP ||
+        opcode == OP_LOOP) {
+      int target = JumpTarget(chunk_, pc);
+      status.Update(visit(target, depth));
+      if (target >= 0 && target <= size) {
+        is_target_[target] = true;
+      }
+      if (opcode != OP_JUMP_IF_FALSE) {
+        continue;
+      }
+    }
+    status.Update(visit(pc + InstLength(opcode), depth));
+  }
+  return status;
+}
+
+Status CppEmitter::EmitConstants() {
+  for (int i = 0; i < chunk_.NumConstants(); i++) {
+    if (!is_used_[i]) {
+      continue;
+    }
+    Value val = chunk_.GetConstant(i);
+    std::string init;
+    if (val.IsFloat()) {
+      if (!std::isfinite(val.AsFloat())) {
+        return Status(UNIMPLEMENTED, "Constant out of range.");
+      }
+      // Hexadecimal floats are exact.
+      char buf[64];
+      snprintf(buf, sizeof(buf), "%a", val.AsFloat());
+      init = std::string("xyxy::Value(") + buf + ")";
+    }
+    else if (val.IsBool()) {
+      init = val.AsBool() ? "xyxy::Value(true)" : "xyxy::Value(false)";
+    }
+    else if (val.IsNil()) {
+      init = "xyxy::Value()";
+    }
+    else if (val.IsString()) {
+      std::string str = val.AsString();
+      init = "rt->NewString(std::string(" + CppStringLiteral(str) + ", " +
+             std::to_string(str.size()) + "))";
+    }
+    else {
+      return Status(UNIMPLEMENTED, "Unsupported constant.");
+    }
+    constants_ += "  const xyxy::Value k" + std::to_string(i) + " = " +
+                  init + ";\n";
+  }
+  return Status();
+}
+
+std::string CppEmitter::Global(int index) {
+  std::string name = chunk_.GetConstant(index).ToString();
+  auto it = global_index_.find(name);
+  if (it == global_index_.end()) {
+    int global = global_index_.size();
+    it = global_index_.emplace(name, global).first;
+    globals_ += "  xyxy::AotGlobal* g" + std::to_string(global) +
+                " = rt->GlobalSlot(" + CppStringLiteral(name) + ");\n";
+  }
+  return "g" + std::to_string(it->second);
+}
+
+Status CppEmitter::EmitInst(int pc) {
+  const uint8 opcode = BaseOpcode(chunk_.GetByte(pc));
+  const int depth = depth_[pc];
+  // The operands on the top of the stack, and the slot pushed into.
+  const std::string top = depth > 0 ? Slot(depth - 1) : "";
+  const std::string lhs = depth > 1 ? Slot(depth - 2) : "";
+  const std::string push = Slot(depth);
+  const int operand = pc + 1 < chunk_.size() ? chunk_.GetByte(pc + 1) : 0;
+  std::string code;
+  switch (opcode) {
+    case OP_RETURN:
+    case OP_POP: {
+      break;
+    }
+    case OP_CONSTANT: {
+      if (operand >= chunk_.NumConstants()) {
+        return Status(INVALID_ARGUMENT, "Constant out of the chunk.");
+      }
+      is_used_[operand] = true;
+      code = push + " = k" + std::to_string(operand) + ";";
+      break;
+    }
+    case OP_NIL: {
+      code = push + " = xyxy::Value();";
+      break;
+    }
+    case OP_TRUE:
+    case OP_FALSE: {
+      code = push + " = xyxy::Value(" +
+             (opcode == OP_TRUE ? "true" : "false") + ");";
+      break;
+    }
+    case OP_NEGATE: {
+      code = "if (const char* e = xyxy::AotNegate(&" + top + ")) " +
+             Throw(pc, "e");
+      break;
+    }
+    case OP_ADD: {
+      code = "if (const char* e = xyxy::AotAdd(&" + lhs + ", " + top +
+             ")) " + Throw(pc, "e");
+      break;
+    }
+    case OP_CONCAT: {
+      // Adds the operands one by one, as the `OP_ADD`s it replaces.
+      const int first = depth - operand;
+      for (int i = first + 1; i < depth; i++) {
+        code += std::string(i > first + 1 ? "\n  " : "") +
+                "if (const char* e = xyxy::AotAdd(&" + Slot(first) + ", " +
+                Slot(i) + ")) " + Throw(pc, "e");
+      }
+      break;
+    }
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_EQUAL:
+    case OP_GREATER:
+    case OP_LESS: {
+      const char* op = opcode == OP_SUB       ? "-"
+                       : opcode == OP_MUL     ? "*"
+                       : opcode == OP_DIV     ? "/"
+                       : opcode == OP_EQUAL   ? "=="
+                       : opcode == OP_GREATER ? ">"
+                                              : "<";
+      code = "if (const char* e = xyxy::AotCheckNumbers(&" + lhs + ", " +
+             top + ")) " + Throw(pc, "e") + "\n  " + lhs + " = xyxy::Value(" +
+             lhs + ".AsFloat() " + op + " " + top + ".AsFloat());";
+      break;
+    }
+    case OP_NOT: {
+      code = top + " = xyxy::Value(" + top + ".IsFalsey());";
+      break;
+    }
+    case OP_PRINT: {
+      code = "rt->Print(" + top + ");";
+      break;
+    }
+    case OP_DEFINE_GLOBAL: {
+      std::string global = Global(operand);
+      code = global + "->value = " + top + ";\n  " + global +
+             "->defined = true;";
+      break;
+    }
+    case OP_GET_GLOBAL:
+    case OP_SET_GLOBAL: {
+      std::string global = Global(operand);
+      code = "if (!" + global + "->defined) " +
+             Throw(pc, "\"Undefined variable.\"") + "\n  ";
+      if (opcode == OP_GET_GLOBAL) {
+        code += push + " = " + global + "->value;";
+      }
+      else {
+        code += global + "->value = " + top + ";";
+      }
+      break;
+    }
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL: {
+      if (operand >= depth) {
+        return Status(INVALID_ARGUMENT, "Local out of the stack.");
+      }
+      code = opcode == OP_GET_LOCAL ? push + " = " + Slot(operand) + ";"
+                                    : Slot(operand) + " = " + top + ";";
+      break;
+    }
+    case OP_JUMP_IF_FALSE: {
+      code = "if (" + top + ".IsFalsey()) goto L" +
+             std::to_string(JumpTarget(chunk_, pc)) + ";";
+      break;
+    }
+    case OP_JUMP:
+    case OP_LOOP: {
+      code = "goto L" + std::to_string(JumpTarget(chunk_, pc)) + ";";
+      break;
+    }
+    default: {
+      return Status(UNIMPLEMENTED, std::string("Unsupported opcode ") +
+                                       OpcodeName(opcode) + ".");
+    }
+  }
+  body_ += "  // " + std::to_string(pc) + " " + OpcodeName(opcode) + "\n";
+  if (!code.empty()) {
+    body_ += "  " + code + "\n";
+  }
+  return Status();
+}
+
+Status CppEmitter::Emit(std::string* source) {
+  Status status = ComputeDepths();
+  is_used_.assign(chunk_.NumConstants(), false);
+  const int size = chunk_.size();
+  // Superinsts and quickened insts are transpiled as the insts emitted by
+  // the compiler, whose bytes are left in the chunk.
+  for (int pc = 0; status.ok() && pc < size;
+       pc += InstLength(BaseOpcode(chunk_.GetByte(pc)))) {
+    if (is_target_[pc]) {
+      body_ += "L" + std::to_string(pc) + ":\n";
+    }
+    if (depth_[pc] != -1) {
+      status = EmitInst(pc);
+    }
+  }
+  if (status.ok()) {
+    status = EmitConstants();
+  }
+  if (!status.ok()) {
+    return status;
+  }
+  if (is_target_[size]) {
+    body_ += "L" + std::to_string(size) + ":\n";
+  }
+
+  std::string& out = *source;
+  out = "// Transpiled from " + std::to_string(size) +
+        " bytes of xyxy bytecode, see xyxy/aot.h.\n";
+  out += "#include <cstdio>\n\n#include \"xyxy/aot_runtime.h\"\n\n";
+  out += "bool " + options_.function_name + "(xyxy::AotRuntime* rt) {\n";
+  out += constants_ + globals_;
+  if (max_depth_ > 0) {
+    out += "  xyxy::Value";
+    for (int i = 0; i < max_depth_; i++) {
+      out += (i ? ", " : " ") + Slot(i);
+    }
+    out += ";\n";
+  }
+  out += "\n" + body_;
+  out += "  rt->Finish(" + std::to_string(size) + ");\n  return true;\n}\n";
+  if (options_.emit_main) {
+    out += "\nint main() {\n"
+           "  xyxy::AotRuntime rt;\n"
+           "  if (!" + options_.function_name + "(&rt)) {\n"
+           "    fprintf(stderr, \"Runtime error: %s\\n\", rt.error().c_str());\n"
+           "    return 1;\n"
+           "  }\n"
+           "  return 0;\n"
+           "}\n";
+  }
+  LOGcc << "Transpiled " << size << " bytes of bytecode into "
+        << out.size() << " bytes of C++";
+  return Status();
+}
+
+Status TranspileToCpp(const Chunk& chunk, const AotOptions& options,
+                      std::string* source) {
+  CppEmitter emitter(chunk, options);
+  return emitter.Emit(source);
+}
+
+}  // namespace xyxy
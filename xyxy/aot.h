@@ -0,0 +1,31 @@
+#ifndef XYXY_AOT_H_
+#define XYXY_AOT_H_
+
+#include <string>
+
+#include "xyxy/chunk.h"
+#include "xyxy/status.h"
+
+namespace xyxy {
+
+struct AotOptions {
+  // Name of the emitted function running the script, with the signature
+  // `bool Name(xyxy::AotRuntime* rt)`. It returns false on a runtime error,
+  // stored into `rt`.
+  std::string function_name = "RunXyxyScript";
+  // Also emits a `main` running the script, for a standalone program.
+  bool emit_main = true;
+};
+
+// Transpiles `chunk` ahead of time into a C++ translation unit stored into
+// `source`, to be linked against the runtime of aot_runtime.h. Every inst
+// becomes inline code: the stack slots are local variables, since the
+// depth of the stack is known at every inst, and jumps are gotos to labels
+// named after the pc of their target. Unlike the VM, reading an undefined
+// global is a runtime error rather than a crash.
+Status TranspileToCpp(const Chunk& chunk, const AotOptions& options,
+                      std::string* source);
+
+}  // namespace xyxy
+
+#endif  // XYXY_AOT_H_
@@ -0,0 +1,42 @@
+// Transpiles a script into a standalone C++ program, see aot.h:
+//
+//   xyxy_aot script.xy script.cc
+//   c++ -O3 -I<repo> script.cc xyxy/aot_runtime.cc -o script
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "xyxy/aot.h"
+#include "xyxy/compiler.h"
+
+int main(int argc, char** argv) {
+  if (argc != 2 && argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " <script> [<output.cc>]\n";
+    return 1;
+  }
+  std::ifstream in(argv[1]);
+  if (!in) {
+    std::cerr << "Can't read " << argv[1] << "\n";
+    return 1;
+  }
+  std::stringstream script;
+  script << in.rdbuf();
+
+  xyxy::Compiler compiler;
+  compiler.Compile(script.str());
+  std::string source;
+  xyxy::Status status = xyxy::TranspileToCpp(
+      *compiler.GetChunk(), xyxy::AotOptions(), &source);
+  if (!status.ok()) {
+    std::cerr << status.ToString() << "\n";
+    return 1;
+  }
+  if (argc == 2) {
+    std::cout << source;
+    return 0;
+  }
+  std::ofstream out(argv[2]);
+  out << source;
+  return out ? 0 : 1;
+}
@@ -0,0 +1,22 @@
+#include "xyxy/aot_runtime.h"
+
+#include <cstdio>
+
+namespace xyxy {
+
+bool AotRuntime::GetGlobal(const std::string& name, Value* val) const {
+  auto it = globals_.find(name);
+  if (it == globals_.end() || !it->second.defined) {
+    return false;
+  }
+  *val = it->second.value;
+  return true;
+}
+
+void AotRuntime::Print(Value val) {
+  final_print_ = val;
+  printed_ = true;
+  val.PrintLine(stdout);
+}
+
+}  // namespace xyxy
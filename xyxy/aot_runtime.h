@@ -0,0 +1,97 @@
+#ifndef XYXY_AOT_RUNTIME_H_
+#define XYXY_AOT_RUNTIME_H_
+
+#include <string>
+#include <unordered_map>
+
+#include "xyxy/object.h"
+#include "xyxy/type.h"
+
+namespace xyxy {
+
+// A global variable of a transpiled script.
+struct AotGlobal {
+  Value value;
+  bool defined = false;
+};
+
+// The runtime linked into the C++ code emitted by `TranspileToCpp`, see
+// aot.h. The stack of a script lives in local variables of its function,
+// the runtime keeps what outlives the function: the globals, the last
+// printed value and the runtime error. Only depends on type.h and
+// object.h, so that transpiled scripts don't pull the VM in.
+class AotRuntime {
+ public:
+  // Returns the global `name`, created undefined on first use. The address
+  // stays valid as long as the runtime.
+  AotGlobal* GlobalSlot(const std::string& name) { return &globals_[name]; }
+
+  // Returns false if the global `name` isn't defined.
+  bool GetGlobal(const std::string& name, Value* val) const;
+
+  Value NewString(const std::string& str) { return Value::String(str); }
+
+  void Print(Value val);
+
+  // Stops the script with a runtime error at `pc`.
+  void SetError(int pc, const char* error) {
+    pc_ = pc;
+    error_ = error;
+  }
+
+  // Marks the script as run to the end, at `pc`.
+  void Finish(int pc) { pc_ = pc; }
+
+  std::string FinalResult() const {
+    return printed_ ? Value(final_print_).ToString() : "";
+  }
+  const std::string& error() const { return error_; }
+  int PC() const { return pc_; }
+
+ private:
+  std::unordered_map<std::string, AotGlobal> globals_;
+  Value final_print_;
+  bool printed_ = false;
+  std::string error_;
+  int pc_ = 0;
+};
+
+// The ops a script can fail on, with the runtime errors of the VM. They
+// return nullptr or the error, the result is stored into `lhs`.
+
+inline const char* AotCheckNumbers(Value* lhs, Value rhs) {
+  if (!lhs->IsFloat()) {
+    return "Unsupported binary operation.";
+  }
+  if (!rhs.IsFloat()) {
+    return "Operand must be a number.";
+  }
+  return nullptr;
+}
+
+inline const char* AotAdd(Value* lhs, Value rhs) {
+  if (lhs->IsFloat() & rhs.IsFloat()) {
+    *lhs = Value(lhs->AsFloat() + rhs.AsFloat());
+    return nullptr;
+  }
+  if (rhs.IsString()) {
+    if (!lhs->IsString()) {
+      return "Operand must be a string.";
+    }
+    *lhs = Value::Concat(*lhs, rhs);
+    return nullptr;
+  }
+  return AotCheckNumbers(lhs, rhs);
+}
+
+inline const char* AotNegate(Value* val) {
+  if (!val->IsFloat()) {
+    return "Operand must be a number.";
+  }
+  *val = Value(-val->AsFloat());
+  return nullptr;
+}
+
+}  // namespace xyxy
+
+#endif  // XYXY_AOT_RUNTIME_H_
@@ -0,0 +1,164 @@
+#include "xyxy/aot.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include "gtest/gtest.h"
+#include "xyxy/compiler.h"
+#include "xyxy/vm.h"
+
+namespace xyxy {
+
+// Returns the path of a source file of the repository.
+static std::string SourcePath(const std::string& path) {
+  const char* srcdir = getenv("TEST_SRCDIR");
+  const char* workspace = getenv("TEST_WORKSPACE");
+  if (srcdir && workspace) {
+    return std::string(srcdir) + "/" + workspace + "/" + path;
+  }
+  return path;
+}
+
+static std::string TempPath(const std::string& name) {
+  const char* tmpdir = getenv("TEST_TMPDIR");
+  return std::string(tmpdir ? tmpdir : "/tmp") + "/" + name;
+}
+
+// Returns the scripts run by `XY_COMPILE_AND_RUN` in compiler_test.cc.
+static std::vector<std::string> ReadCorpus() {
+  std::ifstream in(SourcePath("xyxy/compiler_test.cc"));
+  std::stringstream text_stream;
+  text_stream << in.rdbuf();
+  const std::string text = text_stream.str();
+  const std::string kMacro = "XY_COMPILE_AND_RUN(";
+  std::vector<std::string> scripts;
+  size_t pos = 0;
+  while ((pos = text.find(kMacro, pos)) != std::string::npos) {
+    pos = text.find_first_not_of(" \n", pos + kMacro.size());
+    if (text.compare(pos, 3, "R\"(") == 0) {
+      size_t end = text.find(")\"", pos);
+      scripts.push_back(text.substr(pos + 3, end - pos - 3));
+    }
+    else if (text[pos] == '"') {
+      std::string script;
+      for (pos++; text[pos] != '"'; pos++) {
+        if (text[pos] == '\\') {
+          pos++;
+          script += text[pos] == 'n' ? '\n' : text[pos];
+        }
+        else {
+          script += text[pos];
+        }
+      }
+      scripts.push_back(script);
+    }
+    // Otherwise the definition of the macro.
+  }
+  return scripts;
+}
+
+TEST(Gotos, TestAot) {
+  Compiler compiler;
+  compiler.Compile(R"(
+    var a = 0;
+    for (var i = 0; i < 10; i = i + 1) {
+      a = a + i;
+    }
+    print a;
+  )");
+  std::string source;
+  Status status = TranspileToCpp(*compiler.GetChunk(), AotOptions(), &source);
+  EXPECT_TRUE(status.ok()) << status.ToString();
+  // Superinsts are transpiled as the insts they fuse.
+  EXPECT_EQ(source.find("OP_INC_"), std::string::npos);
+  EXPECT_NE(source.find("OP_LOOP\n  goto L"), std::string::npos);
+  EXPECT_NE(source.find("bool RunXyxyScript(xyxy::AotRuntime* rt)"),
+            std::string::npos);
+  EXPECT_NE(source.find("int main()"), std::string::npos);
+}
+
+TEST(InvalidChunk, TestAot) {
+  Chunk chunk;
+  chunk.Write(OP_POP);
+  std::string source;
+  Status status = TranspileToCpp(chunk, AotOptions(), &source);
+  EXPECT_FALSE(status.ok());
+  EXPECT_EQ(status.error_message(), "Stack underflow.");
+}
+
+TEST(Corpus, TestAot) {
+  const std::string cxx = getenv("CXX") ? getenv("CXX") : "c++";
+  if (system((cxx + " --version > /dev/null 2>&1").c_str()) != 0) {
+    std::cerr << "No C++ compiler to build the transpiled scripts\n";
+    return;
+  }
+  std::vector<std::string> scripts = ReadCorpus();
+  ASSERT_GT(scripts.size(), 30);
+
+  // Runs every script with the VM, and transpiles all of them into one
+  // program running them in turn.
+  std::vector<std::string> expected;
+  std::string program;
+  std::string driver = "int main() {\n";
+  for (size_t i = 0; i < scripts.size(); i++) {
+    Compiler compiler;
+    compiler.Compile(scripts[i]);
+    VM vm(compiler.GetChunk());
+    testing::internal::CaptureStdout();
+    Status status = vm.Run();
+    std::string output = testing::internal::GetCapturedStdout();
+    if (!status.ok()) {
+      output += "Runtime error: " + status.error_message() + "\n";
+    }
+    expected.push_back(output);
+
+    AotOptions options;
+    options.function_name = "Script" + std::to_string(i);
+    options.emit_main = false;
+    std::string source;
+    status = TranspileToCpp(*compiler.GetChunk(), options, &source);
+    ASSERT_TRUE(status.ok()) << status.ToString() << "\n" << scripts[i];
+    program += source;
+    driver += "  {\n    xyxy::AotRuntime rt;\n    printf(\"=== \\n\");\n"
+              "    if (!" + options.function_name + "(&rt)) {\n"
+              "      printf(\"Runtime error: %s\\n\", rt.error().c_str());\n"
+              "    }\n  }\n";
+  }
+  driver += "  return 0;\n}\n";
+
+  const std::string cc = TempPath("aot_corpus.cc");
+  const std::string binary = TempPath("aot_corpus");
+  std::ofstream(cc) << program << driver;
+  std::string command = cxx + " -std=c++17 -O1 -I" + SourcePath(".") + " " +
+                        cc + " " + SourcePath("xyxy/aot_runtime.cc") +
+                        " -o " + binary;
+  ASSERT_EQ(system(command.c_str()), 0) << command;
+
+  FILE* pipe = popen(binary.c_str(), "r");
+  ASSERT_NE(pipe, nullptr);
+  std::string output;
+  char buf[256];
+  while (fgets(buf, sizeof(buf), pipe)) {
+    output += buf;
+  }
+  EXPECT_EQ(pclose(pipe), 0);
+
+  std::vector<std::string> actual;
+  const std::string kSeparator = "=== \n";
+  for (size_t pos = output.find(kSeparator); pos != std::string::npos;) {
+    size_t next = output.find(kSeparator, pos + kSeparator.size());
+    actual.push_back(output.substr(pos + kSeparator.size(),
+                                   next == std::string::npos
+                                       ? std::string::npos
+                                       : next - pos - kSeparator.size()));
+    pos = next;
+  }
+  ASSERT_EQ(actual.size(), expected.size());
+  for (size_t i = 0; i < scripts.size(); i++) {
+    EXPECT_EQ(actual[i], expected[i]) << scripts[i];
+  }
+}
+
+}  // namespace xyxy
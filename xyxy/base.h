@@ -31,6 +31,8 @@ typedef unsigned long long uint64;
 #define XY_ATTRIBUTE_COLD __attribute__((cold))
 #define XY_PACKED __attribute__((packed))
 #define XY_MUST_USE_RESULT __attribute__((warn_unused_result))
+#define XY_PREDICT_FALSE(x) (__builtin_expect(!!(x), 0))
+#define XY_PREDICT_TRUE(x) (__builtin_expect(!!(x), 1))
 #define XY_PRINXY_ATTRIBUTE(string_index, first_to_check) \
   __attribute__((__format__(__printf__, string_index, first_to_check)))
 #define XY_SCANF_ATTRIBUTE(string_index, first_to_check) \
@@ -43,9 +45,23 @@ typedef unsigned long long uint64;
 #define XY_ATTRIBUTE_UNUSED
 #define XY_ATTRIBUTE_COLD
 #define XY_MUST_USE_RESULT
+#define XY_PREDICT_FALSE(x) (x)
+#define XY_PREDICT_TRUE(x) (x)
 #define XY_PACKED
 #define XY_PRINXY_ATTRIBUTE(string_index, first_to_check)
 #define XY_SCANF_ATTRIBUTE(string_index, first_to_check)
 #endif
 
+// Guaranteed tail call, only Clang supports it for now. Other compilers
+// may still turn the calls into jumps when optimizing, but nothing checks
+// it, see `XYXY_DISPATCH_TAILCALL`.
+#if defined(__has_attribute)
+#if __has_attribute(musttail)
+#define XY_MUSTTAIL __attribute__((musttail))
+#endif
+#endif
+#ifndef XY_MUSTTAIL
+#define XY_MUSTTAIL
+#endif
+
 #endif  // XYXY_BASE_H_
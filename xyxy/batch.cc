@@ -0,0 +1,390 @@
+#include "xyxy/batch.h"
+
+#include <algorithm>
+
+#include "xyxy/logging.h"
+#include "xyxy/verifier.h"
+#include "xyxy/vm.h"
+
+namespace xyxy {
+
+static const uint8 kNil = static_cast<uint8>(ValueType::VAL_NIL);
+static const uint8 kBool = static_cast<uint8>(ValueType::VAL_BOOL);
+static const uint8 kFloat = static_cast<uint8>(ValueType::VAL_FLOAT);
+
+BatchVM::BatchVM(Chunk* chunk, int num_records)
+    : chunk_(chunk), num_records_(num_records) {
+  CHECK(num_records_ > 0);
+}
+
+BatchVM::Column BatchVM::NewColumn(uint8 type, double value) const {
+  Column column;
+  column.types.assign(num_records_, type);
+  column.values.assign(num_records_, value);
+  return column;
+}
+
+Value BatchVM::Get(const Column& column, int record) const {
+  if (column.types[record] == kFloat) {
+    return Value(column.values[record]);
+  }
+  else if (column.types[record] == kBool) {
+    return Value(column.values[record] != 0);
+  }
+  return Value();
+}
+
+void BatchVM::SetGlobal(const std::string& name,
+                        const std::vector<double>& column) {
+  CHECK(static_cast<int>(column.size()) == num_records_);
+  auto it = global_index_.find(name);
+  if (it == global_index_.end()) {
+    it = global_index_.emplace(name, globals_.size()).first;
+    globals_.push_back(NewColumn(kUndefined, 0));
+  }
+  Column& global = globals_[it->second];
+  global.types.assign(num_records_, kFloat);
+  global.values = column;
+}
+
+Value BatchVM::GetGlobal(const std::string& name, int record) const {
+  auto it = global_index_.find(name);
+  if (it == global_index_.end()) {
+    return Value();
+  }
+  return Get(globals_[it->second], record);
+}
+
+std::string BatchVM::FinalResult(int record) const {
+  if (prints_.types.empty() || prints_.types[record] == kUndefined) {
+    return "";
+  }
+  return Get(prints_, record).ToString();
+}
+
+BatchVM::Column* BatchVM::Global(int index) {
+  int& global = constant_globals_[index];
+  if (global == -1) {
+    std::string name = chunk_->GetConstant(index).ToString();
+    auto it = global_index_.find(name);
+    if (it == global_index_.end()) {
+      it = global_index_.emplace(name, globals_.size()).first;
+      globals_.push_back(NewColumn(kUndefined, 0));
+    }
+    global = it->second;
+  }
+  return &globals_[global];
+}
+
+void BatchVM::Fail(int record, const std::string& msg) {
+  LOGcc << "Record " << record << " failed at " << pc_ << ": " << msg;
+  statuses_[record] = Status(RUNTIME_ERROR, msg);
+  mask_[record] = 0;
+  pcs_[record] = kDone;
+  failed_ = true;
+}
+
+// Helpers running over the records of `mask`, written without branches in
+// the loops so that they can be vectorized.
+
+static void Fill(const uint8* mask, int n, uint8 type, double value,
+                 uint8* types, double* values) {
+  for (int i = 0; i < n; i++) {
+    types[i] = mask[i] ? type : types[i];
+    values[i] = mask[i] ? value : values[i];
+  }
+}
+
+static void Copy(const uint8* mask, int n, const uint8* src_types,
+                 const double* src_values, uint8* types, double* values) {
+  for (int i = 0; i < n; i++) {
+    types[i] = mask[i] ? src_types[i] : types[i];
+    values[i] = mask[i] ? src_values[i] : values[i];
+  }
+}
+
+// Returns true if any record of `mask` has a type other than `type`.
+static bool AnyOtherType(const uint8* mask, int n, const uint8* types,
+                         uint8 type) {
+  uint8 other = 0;
+  for (int i = 0; i < n; i++) {
+    other |= mask[i] & (types[i] != type);
+  }
+  return other != 0;
+}
+
+// Returns true if any record of `mask` has the type `type`.
+static bool AnyOfType(const uint8* mask, int n, const uint8* types,
+                      uint8 type) {
+  uint8 found = 0;
+  for (int i = 0; i < n; i++) {
+    found |= mask[i] & (types[i] == type);
+  }
+  return found != 0;
+}
+
+template <class Op>
+static void BinaryOp(const uint8* mask, int n, uint8 result_type, Op op,
+                     uint8* lhs_types, double* lhs, const double* rhs) {
+  for (int i = 0; i < n; i++) {
+    lhs_types[i] = mask[i] ? result_type : lhs_types[i];
+    lhs[i] = mask[i] ? op(lhs[i], rhs[i]) : lhs[i];
+  }
+}
+
+// Returns 1 for nil and false, 0 otherwise, see `Value::IsFalsey`.
+static inline uint8 IsFalsey(uint8 type, double value) {
+  return (type == kNil) | ((type == kBool) & (value == 0));
+}
+
+void BatchVM::Advance(int pc) {
+  for (int i = 0; i < num_records_; i++) {
+    pcs_[i] = mask_[i] ? pc : pcs_[i];
+  }
+}
+
+bool BatchVM::Select() {
+  const int size = chunk_->size();
+  int lowest = kDone;
+  for (int i = 0; i < num_records_; i++) {
+    lowest = std::min(lowest, pcs_[i]);
+  }
+  if (lowest >= size) {
+    return false;
+  }
+  pc_ = lowest;
+  min_waiting_pc_ = kDone;
+  for (int i = 0; i < num_records_; i++) {
+    mask_[i] = pcs_[i] == lowest;
+    if (!mask_[i] && pcs_[i] < size) {
+      min_waiting_pc_ = std::min(min_waiting_pc_, pcs_[i]);
+    }
+  }
+  return true;
+}
+
+#define BATCH_BINARY_OP(result_type, expr)                                  \
+  do {                                                                      \
+    Column& lhs = stack_[depth - 2];                                        \
+    Column& rhs = stack_[depth - 1];                                        \
+    if (AnyOtherType(mask, n, lhs.types.data(), kFloat)) {                  \
+      for (int i = 0; i < n; i++) {                                         \
+        if (mask[i] && lhs.types[i] != kFloat) {                            \
+          Fail(i, "Unsupported binary operation.");                         \
+        }                                                                   \
+      }                                                                     \
+    }                                                                       \
+    if (AnyOtherType(mask, n, rhs.types.data(), kFloat)) {                  \
+      for (int i = 0; i < n; i++) {                                         \
+        if (mask[i] && rhs.types[i] != kFloat) {                            \
+          Fail(i, "Operand must be a number.");                             \
+        }                                                                   \
+      }                                                                     \
+    }                                                                       \
+    BinaryOp(                                                               \
+        mask, n, (result_type), [](double a, double b) { return (expr); }, \
+        lhs.types.data(), lhs.values.data(), rhs.values.data());            \
+  } while (false)
+
+int BatchVM::Execute() {
+  const uint8 opcode = BaseOpcode(chunk_->GetByte(pc_));
+  const int depth = depths_[pc_];
+  const int n = num_records_;
+  const uint8* mask = mask_.data();
+  const int operand = InstLength(opcode) > 1 ? chunk_->GetByte(pc_ + 1) : 0;
+  Column* top = depth > 0 ? &stack_[depth - 1] : nullptr;
+  Column* push = &stack_[depth];
+  switch (opcode) {
+    case OP_RETURN:
+    case OP_POP: {
+      break;
+    }
+    case OP_CONSTANT: {
+      Value val = chunk_->GetConstant(operand);
+      Fill(mask, n, static_cast<uint8>(val.Type()),
+           val.IsFloat() ? val.AsFloat() : val.IsBool() && val.AsBool(),
+           push->types.data(), push->values.data());
+      break;
+    }
+    case OP_NIL:
+    case OP_TRUE:
+    case OP_FALSE: {
+      Fill(mask, n, opcode == OP_NIL ? kNil : kBool, opcode == OP_TRUE,
+           push->types.data(), push->values.data());
+      break;
+    }
+    case OP_NEGATE: {
+      if (AnyOtherType(mask, n, top->types.data(), kFloat)) {
+        for (int i = 0; i < n; i++) {
+          if (mask[i] && top->types[i] != kFloat) {
+            Fail(i, "Operand must be a number.");
+          }
+        }
+      }
+      double* values = top->values.data();
+      for (int i = 0; i < n; i++) {
+        values[i] = mask[i] ? -values[i] : values[i];
+      }
+      break;
+    }
+    case OP_ADD: {
+      BATCH_BINARY_OP(kFloat, a + b);
+      break;
+    }
+    case OP_SUB: {
+      BATCH_BINARY_OP(kFloat, a - b);
+      break;
+    }
+    case OP_MUL: {
+      BATCH_BINARY_OP(kFloat, a * b);
+      break;
+    }
+    case OP_DIV: {
+      BATCH_BINARY_OP(kFloat, a / b);
+      break;
+    }
+    case OP_EQUAL: {
+      BATCH_BINARY_OP(kBool, a == b);
+      break;
+    }
+    case OP_GREATER: {
+      BATCH_BINARY_OP(kBool, a > b);
+      break;
+    }
+    case OP_LESS: {
+      BATCH_BINARY_OP(kBool, a < b);
+      break;
+    }
+    case OP_NOT: {
+      uint8* types = top->types.data();
+      double* values = top->values.data();
+      for (int i = 0; i < n; i++) {
+        values[i] = mask[i] ? IsFalsey(types[i], values[i]) : values[i];
+        types[i] = mask[i] ? kBool : types[i];
+      }
+      break;
+    }
+    case OP_PRINT: {
+      Copy(mask, n, top->types.data(), top->values.data(),
+           prints_.types.data(), prints_.values.data());
+      break;
+    }
+    case OP_DEFINE_GLOBAL:
+    case OP_GET_GLOBAL:
+    case OP_SET_GLOBAL: {
+      Column* global = Global(operand);
+      if (opcode != OP_DEFINE_GLOBAL &&
+          AnyOfType(mask, n, global->types.data(), kUndefined)) {
+        for (int i = 0; i < n; i++) {
+          if (mask[i] && global->types[i] == kUndefined) {
+            Fail(i, "Undefined variable.");
+          }
+        }
+      }
+      if (opcode == OP_GET_GLOBAL) {
+        Copy(mask, n, global->types.data(), global->values.data(),
+             push->types.data(), push->values.data());
+      }
+      else {
+        Copy(mask, n, top->types.data(), top->values.data(),
+             global->types.data(), global->values.data());
+      }
+      break;
+    }
+    case OP_GET_LOCAL: {
+      Column& local = stack_[operand];
+      Copy(mask, n, local.types.data(), local.values.data(),
+           push->types.data(), push->values.data());
+      break;
+    }
+    case OP_SET_LOCAL: {
+      Column& local = stack_[operand];
+      Copy(mask, n, top->types.data(), top->values.data(),
+           local.types.data(), local.values.data());
+      break;
+    }
+    case OP_JUMP_IF_FALSE: {
+      const uint8* types = top->types.data();
+      const double* values = top->values.data();
+      int active = 0;
+      int taken = 0;
+      for (int i = 0; i < n; i++) {
+        active += mask[i];
+        taken += mask[i] & IsFalsey(types[i], values[i]);
+      }
+      const int target = JumpTarget(*chunk_, pc_);
+      if (taken == 0 || taken == active) {
+        return taken ? target : pc_ + InstLength(opcode);
+      }
+      // The records diverge.
+      const int next = pc_ + InstLength(opcode);
+      for (int i = 0; i < n; i++) {
+        if (mask[i]) {
+          pcs_[i] = IsFalsey(types[i], values[i]) ? target : next;
+        }
+      }
+      return -1;
+    }
+    case OP_JUMP:
+    case OP_LOOP: {
+      return JumpTarget(*chunk_, pc_);
+    }
+    default: {
+      CHECK(false) << "Unsupported opcode in a batch: " << int(opcode);
+    }
+  }
+  return pc_ + InstLength(opcode);
+}
+
+#undef BATCH_BINARY_OP
+
+Status BatchVM::Run() {
+  Status status = VerifyChunk(*chunk_, &depths_);
+  if (!status.ok()) {
+    return status;
+  }
+  const int size = chunk_->size();
+  for (int pc = 0; pc < size;
+       pc += InstLength(BaseOpcode(chunk_->GetByte(pc)))) {
+    uint8 opcode = BaseOpcode(chunk_->GetByte(pc));
+    if (opcode == OP_CONSTANT &&
+        chunk_->GetConstant(chunk_->GetByte(pc + 1)).IsString()) {
+      return Status(UNIMPLEMENTED, "Strings aren't supported in batches.");
+    }
+    if (opcode == OP_SPAWN || opcode == OP_JOIN ||
+        opcode == OP_PARALLEL_FOR) {
+      return Status(UNIMPLEMENTED, "Tasks aren't supported in batches.");
+    }
+  }
+  const int max_depth = *std::max_element(depths_.begin(), depths_.end());
+  stack_.assign(max_depth + 1, NewColumn(kNil, 0));
+  constant_globals_.assign(chunk_->NumConstants(), -1);
+  prints_ = NewColumn(kUndefined, 0);
+  statuses_.assign(num_records_, Status());
+  pcs_.assign(num_records_, 0);
+  mask_.assign(num_records_, 1);
+  pc_ = 0;
+  min_waiting_pc_ = kDone;
+  if (size == 0) {
+    return Status();
+  }
+  while (true) {
+    failed_ = false;
+    int next = Execute();
+    // Keeps going with the same records until they diverge, meet the
+    // waiting ones, finish or some of them fail.
+    if (next != -1 && next < min_waiting_pc_ && next < size && !failed_) {
+      pc_ = next;
+      continue;
+    }
+    if (next != -1) {
+      Advance(next);
+    }
+    if (!Select()) {
+      break;
+    }
+  }
+  return Status();
+}
+
+}  // namespace xyxy
@@ -0,0 +1,107 @@
+#ifndef XYXY_BATCH_H_
+#define XYXY_BATCH_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "xyxy/chunk.h"
+#include "xyxy/status.h"
+#include "xyxy/type.h"
+
+namespace xyxy {
+
+// Runs one chunk over a batch of records at once, e.g. the same scoring
+// script over many inputs. Every stack slot and every global holds a column
+// with one value per record, and every inst runs over the whole column in a
+// loop the compiler can vectorize, so the dispatch is paid once per batch
+// instead of once per record.
+//
+// The records taking different branches are handled with a selection mask:
+// the records waiting at the lowest pc run next while the others wait, so
+// they join again where the branches meet, and a loop runs until its last
+// record leaves it. The stack depth at a pc being the same for every path,
+// see verifier.h, the records at the same pc share their stack slots.
+//
+// Only numbers, bools and nil are supported, not strings. The values printed
+// aren't written to stdout, the last one of every record is kept instead.
+class BatchVM {
+ public:
+  BatchVM(Chunk* chunk, int num_records);
+
+  int NumRecords() const { return num_records_; }
+
+  // Defines the global `name` of every record before running, `column` has
+  // one number per record.
+  void SetGlobal(const std::string& name, const std::vector<double>& column);
+
+  // Runs the chunk from its start for every record. Fails if the chunk
+  // isn't verified or isn't supported, a runtime error only stops its own
+  // record, see `RecordStatus`.
+  Status Run();
+
+  // Returns the runtime error of `record`, if any.
+  const Status& RecordStatus(int record) const { return statuses_[record]; }
+
+  // Returns the global `name` of `record`, nil if it isn't defined.
+  Value GetGlobal(const std::string& name, int record) const;
+
+  // Returns the last value printed by `record`.
+  std::string FinalResult(int record) const;
+
+ private:
+  // One value per record, `types` holds a `ValueType` or `kUndefined`, bools
+  // are stored as 0 or 1 into `values`.
+  struct Column {
+    std::vector<uint8> types;
+    std::vector<double> values;
+  };
+  static const uint8 kUndefined = 0xff;
+
+  Column NewColumn(uint8 type, double value) const;
+  Value Get(const Column& column, int record) const;
+
+  // Returns the column of the global named by the constant `index`.
+  Column* Global(int index);
+
+  // Stops the `record` with a runtime error.
+  void Fail(int record, const std::string& msg);
+
+  // Executes the inst at `pc_` for the records of `mask_`. Returns the
+  // next pc if they all go on to the same one, otherwise stores their next
+  // pc into `pcs_` and returns -1.
+  int Execute();
+
+  // Stores `pc` into `pcs_` for the records of `mask_`.
+  void Advance(int pc);
+
+  // Selects the records waiting at the lowest pc, returns false once every
+  // record finished.
+  bool Select();
+
+  Chunk* chunk_;  // Not owned.
+  const int num_records_;
+  std::vector<int> depths_;
+  std::vector<Column> stack_;
+  std::map<std::string, int> global_index_;
+  std::vector<Column> globals_;
+  // Index into `globals_` of the name of every constant, -1 if unknown yet.
+  std::vector<int> constant_globals_;
+  Column prints_;
+  std::vector<Status> statuses_;
+  // The pc of every record, `kDone` once it finished, only up to date for
+  // the records outside of `mask_`.
+  std::vector<int> pcs_;
+  static const int kDone = 0x7fffffff;
+  // The records executing the inst at `pc_`.
+  std::vector<uint8> mask_;
+  int pc_ = 0;
+  // The lowest pc of the records outside of `mask_`.
+  int min_waiting_pc_ = kDone;
+  // Set when a record of `mask_` failed during the inst.
+  bool failed_ = false;
+};
+
+}  // namespace xyxy
+
+#endif  // XYXY_BATCH_H_
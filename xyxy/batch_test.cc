@@ -0,0 +1,120 @@
+#include "xyxy/batch.h"
+
+#include "gtest/gtest.h"
+#include "xyxy/compiler.h"
+#include "xyxy/vm.h"
+
+namespace xyxy {
+
+// Runs `source` over the records with the inputs `x` and checks every
+// record against a VM running it alone.
+static void ExpectSameAsVM(const std::string& source,
+                           const std::vector<double>& x) {
+  Compiler compiler;
+  compiler.Compile(source);
+  BatchVM batch(compiler.GetChunk(), x.size());
+  batch.SetGlobal("x", x);
+  Status status = batch.Run();
+  ASSERT_TRUE(status.ok()) << status.ToString();
+  for (size_t i = 0; i < x.size(); i++) {
+    Compiler record_compiler;
+    record_compiler.Compile(source);
+    VM vm(record_compiler.GetChunk());
+    vm.GetGlobal().Insert("x", Value(x[i]));
+    testing::internal::CaptureStdout();
+    Status record_status = vm.Run();
+    testing::internal::GetCapturedStdout();
+    EXPECT_EQ(batch.RecordStatus(i).code(), record_status.code()) << x[i];
+    EXPECT_EQ(batch.RecordStatus(i).error_message(),
+              record_status.error_message());
+    if (record_status.ok()) {
+      EXPECT_EQ(batch.FinalResult(i), vm.FinalResult()) << x[i];
+    }
+  }
+}
+
+TEST(Uniform, TestBatch) {
+  ExpectSameAsVM(R"(
+    var a = x * 2 + 1;
+    print -a / 4 < 0;
+    print a;
+  )",
+                 {1, 2, 3, -4, 0.5});
+}
+
+TEST(Branches, TestBatch) {
+  ExpectSameAsVM(R"(
+    var a = 0;
+    if (x > 2) {
+      a = x;
+    }
+    elif (x == 2 or x == 0) {
+      a = nil;
+    }
+    else {
+      a = !x;
+    }
+    print a;
+  )",
+                 {0, 1, 2, 3, 4, 5, 6, 7});
+}
+
+TEST(Loops, TestBatch) {
+  // Every record runs its own number of iterations.
+  ExpectSameAsVM(R"(
+    var a = 0;
+    for (var i = 0; i < x; i = i + 1) {
+      var j = 0;
+      while (j < i) {
+        a = a + j;
+        j = j + 1;
+      }
+    }
+    print a;
+  )",
+                 {0, 7, 1, 20, 3, 3, 12});
+}
+
+TEST(Errors, TestBatch) {
+  // Some records fail, the others finish.
+  ExpectSameAsVM(R"(
+    var a = 0;
+    for (var i = 0; i < 10; i = i + 1) {
+      if (i == x) {
+        a = a + nil;
+      }
+      elif (i == x + 1) {
+        a = -true;
+      }
+      a = a + i;
+    }
+    print a;
+  )",
+                 {3, 20, -1, 9, 5});
+}
+
+TEST(Globals, TestBatch) {
+  Compiler compiler;
+  compiler.Compile(R"(
+    var y = x > 1;
+    z = 1;
+  )");
+  BatchVM batch(compiler.GetChunk(), 3);
+  batch.SetGlobal("x", {1, 2, 3});
+  EXPECT_TRUE(batch.Run().ok());
+  EXPECT_EQ(batch.GetGlobal("y", 0).ToString(), "0");
+  EXPECT_EQ(batch.GetGlobal("y", 2).ToString(), "1");
+  EXPECT_EQ(batch.GetGlobal("x", 1).AsFloat(), 2);
+  EXPECT_TRUE(batch.GetGlobal("z", 1).IsNil());
+  EXPECT_EQ(batch.RecordStatus(1).error_message(), "Undefined variable.");
+}
+
+TEST(Unsupported, TestBatch) {
+  Compiler compiler;
+  compiler.Compile("print \"a\";");
+  BatchVM batch(compiler.GetChunk(), 2);
+  Status status = batch.Run();
+  EXPECT_EQ(status.code(), UNIMPLEMENTED);
+}
+
+}  // namespace xyxy
@@ -31,6 +31,14 @@ void Chunk::WriteAt(int place, uint8 val) {
   code_[place] = val;
 }
 
+void Chunk::Erase(int place) {
+  CHECK(place < size());
+  code_.erase(code_.begin() + place);
+  if (place < (int)lines_.size()) {
+    lines_.erase(lines_.begin() + place);
+  }
+}
+
 uint8 Chunk::GetByte(int idx) const { return code_.at(idx); }
 
 int Chunk::AddConstant(Value val) {
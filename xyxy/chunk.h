@@ -24,13 +24,23 @@ class Chunk {
 
   void WriteAt(int place, uint8 val);
 
+  // Removes the byte at `place`, moving the code after it back by one, so
+  // no jump may cross it.
+  void Erase(int place);
+
   uint8 GetByte(int index) const;
   uint8 GetLine(int index) const;
 
   int size() const { return code_.size(); }
 
+  // Raw access to the bytecode, used by the execution loop to decode insts
+  // without going through `GetByte` for every operand.
+  const uint8* code() const { return code_.data(); }
+
   int AddConstant(Value val);
   Value GetConstant(int index) const;
+  int NumConstants() const { return constants_.size(); }
+  const Value* constants() const { return constants_.data(); }
 
  private:
   // Store bytecode.
@@ -3,6 +3,7 @@
 #include "xyxy/logging.h"
 #include "xyxy/object.h"
 #include "xyxy/scanner.h"
+#include "xyxy/superinst.h"
 #include "xyxy/vm.h"
 
 namespace xyxy {
@@ -63,6 +64,10 @@ const std::unordered_map<int, PrecedenceRule>& Compiler::kPrecedenceTable =
         {TOKEN_TRUE, CreateRule(&Compiler::ParseLiteral, nullptr, PREC_NONE)},
         {TOKEN_VAR, CreateRule(nullptr, nullptr, PREC_NONE)},
         {TOKEN_WHILE, CreateRule(nullptr, nullptr, PREC_NONE)},
+        {TOKEN_SPAWN, CreateRule(&Compiler::ParseSpawn, nullptr, PREC_NONE)},
+        {TOKEN_JOIN, CreateRule(&Compiler::ParseJoin, nullptr, PREC_NONE)},
+        {TOKEN_PARALLEL, CreateRule(nullptr, nullptr, PREC_NONE)},
+        {TOKEN_REDUCE, CreateRule(nullptr, nullptr, PREC_NONE)},
         {TOKEN_NEWLINE, CreateRule(nullptr, nullptr, PREC_NONE)},
         {TOKEN_WHITESPACE, CreateRule(nullptr, nullptr, PREC_NONE)},
         {TOKEN_ERROR, CreateRule(nullptr, nullptr, PREC_NONE)},
@@ -97,6 +102,7 @@ void Compiler::Compile(const string& source_code) {
   while (!Match(TOKEN_EOF)) {
     ParseDeclaration();
   }
+  FuseSuperInsts(GetChunk());
 }
 
 void Compiler::Advance() {
@@ -152,7 +158,11 @@ void Compiler::ParseString(bool can_assign) {
   string str = scanner_->GetSource(prev_.start, prev_.start + prev_.length);
   int n = str.size();
   CHECK(n >= 2);
-  EmitConstant(Value(new ObjString(str.substr(1, n - 2))));
+  str = str.substr(1, n - 2);
+  // The longer strings are shared by all the constants with their contents.
+  EmitConstant(Value::FitsShortString(str) ? Value::String(str)
+                                           : Value(Intern(str)));
+  string_literal_end_ = GetChunk()->size();
 }
 
 string Compiler::GetLexeme(Token tt) { return scanner_->GetLexeme(tt); }
@@ -177,6 +187,52 @@ void Compiler::LogicOr(bool can_assign) {
   PatchJump(end_jump);
 }
 
+// spawn         ->  "spawn" block ;
+//
+// Emits {OP_SPAWN offset offset num_locals}, followed by the body of the
+// task and {OP_NIL OP_TASK_END} in case it ends without `return`. The task
+// starts with a copy of the enclosing locals, so that their slots stay the
+// same, and may not use the globals, which all the tasks share.
+void Compiler::ParseSpawn(bool can_assign) {
+  LOGvvv << "Parsing spawn...";
+  Consume(TOKEN_LEFT_BRACE, "Expect '{' after 'spawn'.");
+
+  LOGccc << "Emiting OP_SPAWN with " << locals_.size() << " locals";
+  int body_jump = EmitJump(OP_SPAWN);
+  EmitByte(locals_.size());
+
+  BeginScope(SCOPE_TASK);
+  ParseBlock();
+  EndScope();
+  LOGccc << "Emiting OP_NIL OP_TASK_END";
+  EmitByte(OP_NIL, OP_TASK_END);
+
+  int jump_count = GetChunk()->size() - body_jump - 3;
+  if (jump_count > UINT16_MAX) {
+    CHECK(false) << "Too much code to jump over.";
+  }
+  GetChunk()->WriteAt(body_jump, (jump_count >> 8) & 0xff);
+  GetChunk()->WriteAt(body_jump + 1, jump_count & 0xff);
+}
+
+void Compiler::ParseJoin(bool can_assign) {
+  ParseUntilHigherOrder(PREC_UNARY);
+  LOGccc << "Emiting OP_JOIN";
+  EmitByte(OP_JOIN);
+}
+
+bool Compiler::InTask() { return TaskScope() != -1; }
+
+int Compiler::TaskScope() {
+  for (int i = scope_depth_; i >= 0; i--) {
+    if (scopes_[i].type == SCOPE_TASK ||
+        scopes_[i].type == SCOPE_PARALLEL_FOR) {
+      return i;
+    }
+  }
+  return -1;
+}
+
 void Compiler::ParseNumber(bool can_assign) {
   double val = strtod(GetLexeme(prev_).c_str(), nullptr);
   EmitConstant(Value(val));
@@ -207,13 +263,13 @@ void Compiler::ParseUnary(bool can_assign) {
 
 void Compiler::ParseBinary(bool can_assign) {
   TokenType op_type = prev_.type;
+  if (op_type == TOKEN_PLUS) {
+    ParseAdd();
+    return;
+  }
   PrecedenceRule rule = GetRule(op_type);
   ParseUntilHigherOrder(PrecOrder(rule.prec_order + 1));
   switch (op_type) {
-    case TOKEN_PLUS:
-      LOGccc << "Emiting OP_ADD";
-      EmitByte(OP_ADD);
-      break;
     case TOKEN_MINUS:
       LOGccc << "Emiting OP_SUB";
       EmitByte(OP_SUB);
@@ -256,6 +312,32 @@ void Compiler::ParseBinary(bool can_assign) {
   }
 }
 
+// A chain joining strings, i.e. with a string literal among its operands,
+// e.g. `a + ":" + b + ":" + c`, becomes a single `OP_CONCAT` allocating the
+// result once, rather than an `OP_ADD` per `+` allocating every partial
+// result. The other chains keep their `OP_ADD`s, for the JITs.
+void Compiler::ParseAdd() {
+  bool joins_strings = string_literal_end_ == GetChunk()->size();
+  std::vector<int> adds;
+  do {
+    ParseUntilHigherOrder(PrecOrder(PREC_TERM + 1));
+    joins_strings |= string_literal_end_ == GetChunk()->size();
+    adds.push_back(GetChunk()->size());
+    LOGccc << "Emiting OP_ADD";
+    EmitByte(OP_ADD);
+  } while (adds.size() < UINT8_MAX - 1 && Match(TOKEN_PLUS));
+  if (!joins_strings || adds.size() < 2) {
+    return;
+  }
+  // Drops the `OP_ADD`s, leaving all the operands on the stack. The jumps
+  // inside the operands don't cross them.
+  for (auto it = adds.rbegin(); it != adds.rend(); ++it) {
+    GetChunk()->Erase(*it);
+  }
+  LOGccc << "Emiting OP_CONCAT " << adds.size() + 1;
+  EmitByte(OP_CONCAT, adds.size() + 1);
+}
+
 void Compiler::ParseLiteral(bool can_assign) {
   switch (prev_.type) {
     case TOKEN_FALSE:
@@ -326,7 +408,7 @@ void Compiler::ParseDeclaration() {
 }
 
 uint8 Compiler::IdentifierConstant(const string& name) {
-  return MakeConstant(Value(new ObjString(name)));
+  return MakeConstant(Value(Intern(name)));
 }
 
 uint8 Compiler::HandleVariable(const string& msg) {
@@ -417,14 +499,38 @@ void Compiler::NamedVariable(bool can_assign) {
   uint8 set_op = 0;
   uint8 get_op = 0;
   std::string name = GetLexeme(prev_);
+  // Inside a parallel `for`, the accumulators are only updated and the
+  // locals declared outside of the body only read.
+  int task_scope = TaskScope();
+  const Scope* parallel_for = nullptr;
+  if (task_scope != -1 && scopes_[task_scope].type == SCOPE_PARALLEL_FOR) {
+    parallel_for = &scopes_[task_scope];
+  }
   if (ResolveLocal(name, &arg)) {
     // If the prev_ is a local variable.
     LOGvvv << "Find the local variable: " << name
            << " slot: " << std::to_string(arg);
     set_op = OP_SET_LOCAL;
     get_op = OP_GET_LOCAL;
+    if (parallel_for && arg >= parallel_for->first_accumulator &&
+        arg < parallel_for->first_accumulator +
+                  parallel_for->num_accumulators) {
+      CHECK(can_assign && Match(TOKEN_EQUAL))
+          << "Accumulator `" << name << "` may only be updated.";
+      ParseAccumulation(name, arg);
+      return;
+    }
+    if (parallel_for && arg < parallel_for->first_local && can_assign &&
+        CheckType(TOKEN_EQUAL)) {
+      CHECK(false) << "Cannot assign `" << name
+                   << "` inside parallel for, only its accumulators.";
+    }
   }
   else {
+    if (InTask()) {
+      CHECK(false) << "Cannot use global variable `" << name
+                   << "` inside spawn.";
+    }
     arg = IdentifierConstant(name);
     set_op = OP_SET_GLOBAL;
     get_op = OP_GET_GLOBAL;
@@ -450,6 +556,8 @@ void Compiler::NamedVariable(bool can_assign) {
 //               |   ifStmt
 //               |   whileStmt
 //               |   forStmt
+//               |   parallelForStmt
+//               |   returnStmt
 //               |   block ;
 // block         ->  "{" declaration* "}"
 void Compiler::ParseStmt() {
@@ -478,6 +586,12 @@ void Compiler::ParseStmt() {
   else if (Match(TOKEN_BREAK)) {
     ParseBreakStmt();
   }
+  else if (Match(TOKEN_RETURN)) {
+    ParseReturnStmt();
+  }
+  else if (Match(TOKEN_PARALLEL)) {
+    ParseParallelForStmt();
+  }
   else {
     ParseExpressStmt();
   }
@@ -492,7 +606,7 @@ void Compiler::ParseContinueStmt() {
 
   int for_scope = -1;
   int totol_stack_num = 0;
-  for (int i = scope_depth_; i >= 0; i--) {
+  for (int i = scope_depth_; i > TaskScope(); i--) {
     if (scopes_[i].type == SCOPE_FOR) {
       for_scope = i;
       break;
@@ -526,7 +640,7 @@ void Compiler::ParseBreakStmt() {
 
   int for_scope = -1;
   int totol_stack_num = 0;
-  for (int i = scope_depth_; i >= 0; i--) {
+  for (int i = scope_depth_; i > TaskScope(); i--) {
     LOGccc << "Scope " << i << " has " << scopes_[i].owned_stack_num
            << " values left on stack.";
     totol_stack_num += scopes_[i].owned_stack_num;
@@ -548,6 +662,177 @@ void Compiler::ParseBreakStmt() {
   scopes_[for_scope].breaks.push_back(break_jump);
 }
 
+// returnStmt    ->  "return" expression? ";" ;
+// Only ends the body of a `spawn`, the locals are left on the stack of the
+// task.
+void Compiler::ParseReturnStmt() {
+  LOGvvv << "Parsing return stmt...";
+  int task_scope = TaskScope();
+  CHECK(task_scope != -1 && scopes_[task_scope].type == SCOPE_TASK)
+      << "Return outside of spawn.";
+  if (Match(TOKEN_SEMICOLON)) {
+    EmitByte(OP_NIL);
+  }
+  else {
+    ParseExpression();
+    Consume(TOKEN_SEMICOLON, "Expect ';' after return value.");
+  }
+  LOGccc << "Emiting OP_TASK_END";
+  EmitByte(OP_TASK_END);
+}
+
+// parallelForStmt  ->  "parallel" "for" "(" "var" IDENTIFIER "=" expression
+//                      ";" IDENTIFIER "<" expression ";" IDENTIFIER "="
+//                      IDENTIFIER "+" NUMBER ")" reduce? statement ;
+// reduce           ->  "reduce" "(" IDENTIFIER ( "," IDENTIFIER )* ")" ;
+//
+// The iterations run in any order on many threads, split into tasks by
+// {OP_PARALLEL_FOR offset offset slot step num_accumulators}. The loop
+// variable is followed on the stack by the end of the range and by a local
+// for every accumulator, starting at 0 in every task. The body runs as a
+// sequential loop over the range of its task, then the accumulators of all
+// the tasks are added up into the variables named by `reduce`.
+void Compiler::ParseParallelForStmt() {
+  LOGvvv << "Parsing parallel for statement...";
+  Consume(TOKEN_FOR, "Expect 'for' after 'parallel'.");
+  BeginScope(SCOPE_BLOCK);
+
+  Consume(TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+  Consume(TOKEN_VAR, "Expect a loop variable in parallel for.");
+  HandleVariable("Expect variable name");
+  string var = GetLexeme(prev_);
+  Consume(TOKEN_EQUAL, "Expect '=' after the loop variable.");
+  ParseExpression();
+  Consume(TOKEN_SEMICOLON, "Expect ';' after the loop initializer.");
+  DefineVariable(0);
+  const uint8 slot = locals_.size() - 1;
+
+  Consume(TOKEN_IDENTIFIER, "Expect the loop variable in the condition.");
+  CHECK(GetLexeme(prev_) == var) << "Expect `" << var << " < ...`.";
+  Consume(TOKEN_LESS, "Expect '<' in the loop condition.");
+  ParseExpression();
+  Consume(TOKEN_SEMICOLON, "Expect ';' after the loop condition.");
+  AddLocal("(end)");
+
+  Consume(TOKEN_IDENTIFIER, "Expect the loop variable in the increment.");
+  CHECK(GetLexeme(prev_) == var) << "Expect `" << var << " = ...`.";
+  Consume(TOKEN_EQUAL, "Expect '=' in the increment.");
+  Consume(TOKEN_IDENTIFIER, "Expect the loop variable in the increment.");
+  CHECK(GetLexeme(prev_) == var) << "Expect `" << var << " + step`.";
+  Consume(TOKEN_PLUS, "Expect '+' in the increment.");
+  Consume(TOKEN_NUMBER, "Expect a number as the step.");
+  double step = strtod(GetLexeme(prev_).c_str(), nullptr);
+  CHECK(step > 0) << "The step of parallel for must be positive.";
+  const uint8 step_constant = MakeConstant(Value(step));
+  Consume(TOKEN_RIGHT_PAREN, "Expect ')' after the loop increment.");
+
+  // The variables the accumulators are added to, resolved before the
+  // accumulators hide them.
+  struct Target {
+    string name;
+    uint8 get_op;
+    uint8 set_op;
+    uint8 arg;
+  };
+  std::vector<Target> targets;
+  if (Match(TOKEN_REDUCE)) {
+    Consume(TOKEN_LEFT_PAREN, "Expect '(' after 'reduce'.");
+    do {
+      Consume(TOKEN_IDENTIFIER, "Expect an accumulator name.");
+      Target target{GetLexeme(prev_), OP_GET_LOCAL, OP_SET_LOCAL, 0};
+      CHECK(target.name != var) << "Cannot reduce the loop variable.";
+      for (const Target& other : targets) {
+        CHECK(other.name != target.name)
+            << "Accumulator `" << target.name << "` already defined.";
+      }
+      if (!ResolveLocal(target.name, &target.arg)) {
+        CHECK(!InTask()) << "Cannot use global variable `" << target.name
+                         << "` inside spawn.";
+        target.get_op = OP_GET_GLOBAL;
+        target.set_op = OP_SET_GLOBAL;
+        target.arg = IdentifierConstant(target.name);
+      }
+      targets.push_back(target);
+    } while (Match(TOKEN_COMMA));
+    Consume(TOKEN_RIGHT_PAREN, "Expect ')' after the accumulators.");
+  }
+  for (const Target& target : targets) {
+    EmitConstant(Value(0));
+    AddLocal(target.name);
+  }
+
+  LOGccc << "Emiting OP_PARALLEL_FOR";
+  int body_jump = EmitJump(OP_PARALLEL_FOR);
+  EmitByte(slot);
+  EmitByte(step_constant);
+  EmitByte(targets.size());
+
+  BeginScope(SCOPE_PARALLEL_FOR);
+  scopes_[scope_depth_].first_accumulator = slot + 2;
+  scopes_[scope_depth_].num_accumulators = targets.size();
+  scopes_[scope_depth_].first_local = locals_.size();
+  int loop_start = GetChunk()->size();
+  EmitByte(OP_GET_LOCAL, slot);
+  EmitByte(OP_GET_LOCAL, slot + 1);
+  EmitByte(OP_LESS);
+  int exit_jump = EmitJump(OP_JUMP_IF_FALSE);
+  EmitByte(OP_POP);
+  ParseStmt();
+  EmitByte(OP_GET_LOCAL, slot);
+  EmitByte(OP_CONSTANT, step_constant);
+  EmitByte(OP_ADD);
+  EmitByte(OP_SET_LOCAL, slot);
+  EmitByte(OP_POP);
+  EmitLoop(loop_start);
+  PatchJump(exit_jump);
+  EmitByte(OP_POP);
+  EndScope();
+  EmitByte(OP_NIL, OP_TASK_END);
+
+  int jump_count = GetChunk()->size() - body_jump - 5;
+  if (jump_count > UINT16_MAX) {
+    CHECK(false) << "Too much code to jump over.";
+  }
+  GetChunk()->WriteAt(body_jump, (jump_count >> 8) & 0xff);
+  GetChunk()->WriteAt(body_jump + 1, jump_count & 0xff);
+
+  for (size_t i = 0; i < targets.size(); i++) {
+    LOGccc << "Emiting the reduction of " << targets[i].name;
+    EmitByte(targets[i].get_op, targets[i].arg);
+    EmitByte(OP_GET_LOCAL, slot + 2 + i);
+    EmitByte(OP_ADD);
+    EmitByte(targets[i].set_op, targets[i].arg);
+    EmitByte(OP_POP);
+  }
+  EndScope();
+}
+
+void Compiler::ParseAccumulation(const string& name, uint8 slot) {
+  Consume(TOKEN_IDENTIFIER, "Expect `" + name + " = " + name + " + ...`.");
+  CHECK(GetLexeme(prev_) == name)
+      << "Expect `" << name << " = " << name << " + ...`.";
+  EmitByte(OP_GET_LOCAL, slot);
+  CHECK(CheckType(TOKEN_PLUS) || CheckType(TOKEN_MINUS))
+      << "Expect `" << name << " = " << name << " + ...`.";
+  while (Match(TOKEN_PLUS) || Match(TOKEN_MINUS)) {
+    TokenType op_type = prev_.type;
+    ParseUntilHigherOrder(PREC_FACTOR);
+    EmitByte(op_type == TOKEN_PLUS ? OP_ADD : OP_SUB);
+  }
+  LOGccc << "Emiting OP_SET_LOCAL for accumulator " << name;
+  EmitByte(OP_SET_LOCAL, slot);
+}
+
+void Compiler::AddLocal(const string& name) {
+  if (locals_.size() >= UINT8_MAX) {
+    CHECK(false) << "Too many local variables defined";
+  }
+  if (!scopes_[scope_depth_].met_break_stmt) {
+    scopes_[scope_depth_].owned_stack_num++;
+  }
+  locals_.push_back(LocalDef{prev_, scope_depth_, name});
+}
+
 void Compiler::ParseForStmt() {
   LOGvvv << "Parsing for statement...";
 
@@ -41,7 +41,11 @@ enum ScopeType {
   SCOPE_FOR,
   SCOPE_FUNC,
   SCOPE_CLASS,
-  SCOPE_MAIN
+  SCOPE_MAIN,
+  // The body of a `spawn`, see `Compiler::ParseSpawn`.
+  SCOPE_TASK,
+  // The body of a parallel `for`, see `Compiler::ParseParallelForStmt`.
+  SCOPE_PARALLEL_FOR
 };
 
 // TODO(): may consider write this as a class.
@@ -49,7 +53,9 @@ struct Scope {
   Scope() {}
   explicit Scope(ScopeType tp, int pc, int ln, int dp)
       : type(tp), start_pc(pc), start_ln(ln), depth(dp) {}
-  ScopeType type;
+  // Set for the default constructed outermost scope too, which
+  // `Compiler::TaskScope` reads.
+  ScopeType type = SCOPE_MAIN;
   int start_pc = 0;
   int end_pc = 0;
   int start_ln = 0;
@@ -59,6 +65,11 @@ struct Scope {
   int owned_stack_num = 0;
   bool met_break_stmt = false;
   std::vector<int> breaks;
+  // Only for SCOPE_PARALLEL_FOR, the slots of the accumulators and of the
+  // first local declared by the body.
+  int first_accumulator = 0;
+  int num_accumulators = 0;
+  int first_local = 0;
 };
 
 std::string DebugScope(Scope sp);
@@ -104,11 +115,15 @@ class Compiler {
   void ParseGrouping(bool can_assign);
   void ParseUnary(bool can_assign);
   void ParseBinary(bool can_assign);
+  // Parses the rest of a chain of `+`, after its first `+`.
+  void ParseAdd();
   void ParseLiteral(bool can_assign);
   void ParseString(bool can_assign);
   void ParseExpression();
   void LogicAnd(bool can_assign);
   void LogicOr(bool can_assign);
+  void ParseSpawn(bool can_assign);
+  void ParseJoin(bool can_assign);
 
   void ParseBlock();
   void BeginScope(ScopeType type);
@@ -122,6 +137,19 @@ class Compiler {
   void ParseWhileStmt();
   void ParseContinueStmt();
   void ParseBreakStmt();
+  void ParseReturnStmt();
+  void ParseParallelForStmt();
+  // Parses `name = name + ...` for the accumulator `name` of a parallel
+  // `for`, right after the `=`.
+  void ParseAccumulation(const string& name, uint8 slot);
+
+  // Returns true inside the body of a `spawn` or of a parallel `for`.
+  bool InTask();
+  // Returns the innermost scope of a `spawn` or of a parallel `for`, -1 if
+  // none.
+  int TaskScope();
+  // Adds a local for a value already on the stack.
+  void AddLocal(const string& name);
 
   // Continue parsing until read a token that has a higher precedence.
   void ParseUntilHigherOrder(PrecOrder prec_order);
@@ -156,6 +184,9 @@ class Compiler {
   std::unique_ptr<Chunk> chunk_;
   std::unique_ptr<Scanner> scanner_;
   int scope_depth_ = 0;
+  // Size of the chunk right after the last string literal, to tell the
+  // operands that are string literals.
+  int string_literal_end_ = -1;
   std::vector<Scope> scopes_;
   std::vector<LocalDef> locals_;
   // bool has_error_ = false;
@@ -5,6 +5,19 @@
 
 namespace xyxy {
 
+// Options of the VMs running the scripts, `compiler_jit_test` runs all of
+// them with the JIT.
+static VMOptions TestOptions() {
+  VMOptions options;
+#ifdef XYXY_TEST_JIT
+  options.jit = true;
+#endif
+#ifdef XYXY_TEST_TRACE_JIT
+  options.trace_jit = true;
+#endif
+  return options;
+}
+
 static Token CreateToken(TokenType type, int start, int len, int line) {
   return Token{type, start, len, line};
 }
@@ -65,27 +78,51 @@ TEST(Basic, TestCompiler) {
 
   EXPECT_EQ(chunk->GetByte(4), uint8(OP_CONSTANT));
 
-  VM vm(chunk);
+  VM vm(chunk, TestOptions());
   vm.Run();
-  EXPECT_EQ(vm.FinalResult(), "-9.000000");
+  EXPECT_EQ(vm.FinalResult(), "-9");
   EXPECT_TRUE(vm.GetStack().Empty());
 }
 
 // TOOD(): OP_GET_GLOBAL will leave a value onto the stack, figure out
 // how to deal with that.
-#define XY_COMPILE_AND_RUN(source, result) \
-  Compiler compiler;                       \
-  compiler.Compile(source);                \
-  VM vm(compiler.GetChunk());              \
-  vm.Run();                                \
-  EXPECT_EQ(vm.FinalResult(), result);     \
-  if (!vm.GetStack().Empty()) {            \
-    vm.DumpStack();                        \
-  }                                        \
+#define XY_COMPILE_AND_RUN(source, result)   \
+  Compiler compiler;                         \
+  compiler.Compile(source);                  \
+  VM vm(compiler.GetChunk(), TestOptions()); \
+  vm.Run();                                  \
+  EXPECT_EQ(vm.FinalResult(), result);       \
+  if (!vm.GetStack().Empty()) {              \
+    vm.DumpStack();                          \
+  }                                          \
   EXPECT_TRUE(vm.GetStack().Empty());
 
 TEST(SingleStmt, TestCompiler) {
-  XY_COMPILE_AND_RUN("print 1 + 2;", "3.000000")
+  XY_COMPILE_AND_RUN("print 1 + 2;", "3")
+}
+
+TEST(Concat, TestCompiler) {
+  XY_COMPILE_AND_RUN(R"(
+    var user = "user";
+    var id = "42";
+    var key = "session:" + user + ":" + id + ":" + "profile";
+    print key + user;
+  )",
+                     "session:user:42:profileuser")
+  // The chain with string literals is joined by one inst, the others are
+  // left to `OP_ADD`.
+  Chunk* chunk = compiler.GetChunk();
+  int concats = 0;
+  int adds = 0;
+  for (int pc = 0; pc < chunk->size(); pc += InstLength(chunk->GetByte(pc))) {
+    if (chunk->GetByte(pc) == OP_CONCAT) {
+      EXPECT_EQ(chunk->GetByte(pc + 1), 6);
+      concats++;
+    }
+    adds += BaseOpcode(chunk->GetByte(pc)) == OP_ADD;
+  }
+  EXPECT_EQ(concats, 1);
+  EXPECT_EQ(adds, 1);
 }
 
 TEST(CompileMultipleStmts, TestCompiler) {
@@ -93,9 +130,9 @@ TEST(CompileMultipleStmts, TestCompiler) {
   compiler.Compile("print 1 + 2;");
   compiler.Compile("print 1 + 3;");
   compiler.Compile("print 1 + 2 * 10 - (2 + 3) * 6;");
-  VM vm(compiler.GetChunk());
+  VM vm(compiler.GetChunk(), TestOptions());
   vm.Run();
-  EXPECT_EQ(vm.FinalResult(), "-9.000000");
+  EXPECT_EQ(vm.FinalResult(), "-9");
   EXPECT_TRUE(vm.GetStack().Empty());
 }
 
@@ -116,7 +153,7 @@ TEST(GlobalDef1, TestCompiler) {
     var d = a + b + c;
     print d;
   )",
-                     "6.000000")
+                     "6")
 }
 
 TEST(StringAdd, TestCompiler) {
@@ -155,7 +192,7 @@ TEST(LocalDef0, TestCompiler) {
       }
     }
   )",
-                     "6.000000")
+                     "6")
 }
 
 TEST(LocalDef1, TestCompiler) {
@@ -189,7 +226,7 @@ TEST(LocalDef2, TestCompiler) {
     }
     print g;
   )",
-                     "6.000000")
+                     "6")
 }
 
 TEST(IfElse0, TestCompiler) {
@@ -201,7 +238,7 @@ TEST(IfElse0, TestCompiler) {
     }
     print a;
   )",
-                     "1.000000")
+                     "1")
 }
 
 TEST(IfElse1, TestCompiler) {
@@ -213,7 +250,7 @@ TEST(IfElse1, TestCompiler) {
     }
     print a;
   )",
-                     "2.000000")
+                     "2")
 }
 
 TEST(IfElse2, TestCompiler) {
@@ -228,7 +265,7 @@ TEST(IfElse2, TestCompiler) {
     }
     print a;
   )",
-                     "3.000000")
+                     "3")
 }
 
 TEST(IfElse3, TestCompiler) {
@@ -243,7 +280,7 @@ TEST(IfElse3, TestCompiler) {
     }
     print a;
   )",
-                     "2.000000")
+                     "2")
 }
 
 TEST(IfElse4, TestCompiler) {
@@ -258,7 +295,7 @@ TEST(IfElse4, TestCompiler) {
     }
     print a;
   )",
-                     "2.000000")
+                     "2")
 }
 
 TEST(IfElse5, TestCompiler) {
@@ -270,7 +307,7 @@ TEST(IfElse5, TestCompiler) {
     }
     print a;
   )",
-                     "2.000000")
+                     "2")
 }
 
 TEST(IfElse6, TestCompiler) {
@@ -282,7 +319,7 @@ TEST(IfElse6, TestCompiler) {
     }
     print a;
   )",
-                     "2.000000")
+                     "2")
 }
 
 TEST(IfElse7, TestCompiler) {
@@ -303,7 +340,7 @@ TEST(IfElse7, TestCompiler) {
     }
     print a;
   )",
-                     "5.000000")
+                     "5")
 }
 
 TEST(LogicAnd, TestCompiler) {
@@ -318,7 +355,7 @@ TEST(LogicAnd, TestCompiler) {
     }
     print a;
   )",
-                     "3.000000")
+                     "3")
 }
 
 TEST(LogicAndThree, TestCompiler) {
@@ -331,7 +368,7 @@ TEST(LogicAndThree, TestCompiler) {
     }
     print a;
   )",
-                     "2.000000")
+                     "2")
 }
 
 TEST(LogicOr, TestCompiler) {
@@ -348,7 +385,7 @@ TEST(LogicOr, TestCompiler) {
     }
     print a;
   )",
-                     "8.000000")
+                     "8")
 }
 
 TEST(IfElse8, TestCompiler) {
@@ -372,7 +409,7 @@ TEST(IfElse8, TestCompiler) {
     }
     print a;
   )",
-                     "6.000000")
+                     "6")
 }
 
 TEST(WhileStmt, TestCompiler) {
@@ -384,7 +421,7 @@ TEST(WhileStmt, TestCompiler) {
     }
     print a;
   )",
-                     "10.000000");
+                     "10");
 }
 
 TEST(WhileFalseStmt, TestCompiler) {
@@ -396,7 +433,7 @@ TEST(WhileFalseStmt, TestCompiler) {
     }
     print a;
   )",
-                     "10.000000");
+                     "10");
 }
 
 TEST(ForStmt, TestCompiler) {
@@ -408,7 +445,7 @@ TEST(ForStmt, TestCompiler) {
     }
     print a;
   )",
-                     "10.000000");
+                     "10");
 }
 
 TEST(MultipleForStmt, TestCompiler) {
@@ -422,7 +459,7 @@ TEST(MultipleForStmt, TestCompiler) {
     }
     print a;
   )",
-                     "100.000000");
+                     "100");
 }
 
 TEST(MultipleForStmt1, TestCompiler) {
@@ -438,7 +475,7 @@ TEST(MultipleForStmt1, TestCompiler) {
     }
     print a;
   )",
-                     "1000.000000");
+                     "1000");
 }
 
 TEST(ForStmt1, TestCompiler) {
@@ -451,7 +488,7 @@ TEST(ForStmt1, TestCompiler) {
     }
     print a;
   )",
-                     "10.000000");
+                     "10");
 }
 
 TEST(ForStmt2, TestCompiler) {
@@ -465,7 +502,7 @@ TEST(ForStmt2, TestCompiler) {
     }
     print a;
   )",
-                     "10.000000");
+                     "10");
 }
 
 TEST(ForBreak0, TestCompiler) {
@@ -477,7 +514,7 @@ TEST(ForBreak0, TestCompiler) {
     }
     print a;
   )",
-                     "0.000000");
+                     "0");
 }
 
 TEST(ForBreak1, TestCompiler) {
@@ -499,7 +536,7 @@ TEST(ForBreak1, TestCompiler) {
     }
     print a;
   )",
-                     "1.000000");
+                     "1");
 }
 
 TEST(ForBreak2, TestCompiler) {
@@ -514,7 +551,7 @@ TEST(ForBreak2, TestCompiler) {
     }
     print a;
   )",
-                     "11.000000");
+                     "11");
 }
 
 TEST(ForBreak3, TestCompiler) {
@@ -536,7 +573,7 @@ TEST(ForBreak3, TestCompiler) {
     }
     print a;
   )",
-                     "3.000000");
+                     "3");
 }
 
 TEST(ForBreak4, TestCompiler) {
@@ -562,7 +599,7 @@ TEST(ForBreak4, TestCompiler) {
     }
     print a;
   )",
-                     "3.000000");
+                     "3");
 }
 
 TEST(ForBreak5, TestCompiler) {
@@ -591,7 +628,7 @@ TEST(ForBreak5, TestCompiler) {
     }
     print a;
   )",
-                     "11.000000");
+                     "11");
 }
 
 TEST(ForBreak6, TestCompiler) {
@@ -622,7 +659,7 @@ TEST(ForBreak6, TestCompiler) {
     }
     print a;
   )",
-                     "3.000000");
+                     "3");
 }
 
 TEST(ForContinue, TestCompiler) {
@@ -635,7 +672,7 @@ TEST(ForContinue, TestCompiler) {
     }
     print a;
   )",
-                     "0.000000");
+                     "0");
 }
 
 TEST(ForContinue1, TestCompiler) {
@@ -652,7 +689,7 @@ TEST(ForContinue1, TestCompiler) {
     }
     print a;
   )",
-                     "0.000000");
+                     "0");
 }
 
 TEST(ForContinue2, TestCompiler) {
@@ -673,7 +710,7 @@ TEST(ForContinue2, TestCompiler) {
     }
     print a;
   )",
-                     "5.000000");
+                     "5");
 }
 
 }  // namespace xyxy
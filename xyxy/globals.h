@@ -0,0 +1,150 @@
+#ifndef XYXY_GLOBALS_H_
+#define XYXY_GLOBALS_H_
+
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+
+#include "xyxy/hash_table.h"
+#include "xyxy/object.h"
+#include "xyxy/type.h"
+
+namespace xyxy {
+
+// The global variables of a VM. The globals of the clones of a VM are
+// copied on write, see `VM::Clone`: cloning freezes the globals defined so
+// far into a layer shared by the VM and its clones, then every VM writes
+// into a table of its own, created on its first write, and reads through
+// it into the frozen layers. Frozen layers are never written, so VMs on
+// other threads may read them.
+class Globals {
+ public:
+  // Defines or sets `name`, returns true if it wasn't defined. The names
+  // are interned strings, see `Intern`, looked up by address.
+  bool Insert(ObjString* name, const Value& val) {
+    if (!own_) {
+      own_ = std::make_unique<Table>();
+    }
+    return own_->Insert(name, val) && !FindFrozen(name, nullptr);
+  }
+
+  bool Find(ObjString* name, Value* val = nullptr) const {
+    return (own_ && own_->Find(name, val)) || FindFrozen(name, val);
+  }
+
+  // Returns the address of the value of `name` in the table of this VM,
+  // copied from a frozen layer if needed, or nullptr if not defined. The
+  // value must not be written through the address after the next `Share`,
+  // which freezes it.
+  Value* FindValue(ObjString* name) {
+    Value* val = own_ ? own_->FindValue(name) : nullptr;
+    if (val) {
+      return val;
+    }
+    Value frozen;
+    if (!FindFrozen(name, &frozen)) {
+      return nullptr;
+    }
+    Insert(name, frozen);
+    return own_->FindValue(name);
+  }
+
+  // Same as above, interning `name` first.
+  bool Insert(const std::string& name, const Value& val) {
+    return Insert(Intern(name), val);
+  }
+  bool Find(const std::string& name, Value* val = nullptr) const {
+    return Find(Intern(name), val);
+  }
+  Value* FindValue(const std::string& name) {
+    return FindValue(Intern(name));
+  }
+
+  // Calls `fn(name, value)` for every global, once per name.
+  template <class Fn>
+  void ForEach(Fn fn) const {
+    std::set<ObjString*> seen;
+    auto visit = [&seen, &fn](ObjString* name, const Value& val) {
+      if (seen.insert(name).second) {
+        fn(std::string(name->str()), val);
+      }
+    };
+    if (own_) {
+      own_->ForEach(visit);
+    }
+    for (const Layer* layer = frozen_.get(); layer;
+         layer = layer->parent.get()) {
+      layer->table->ForEach(visit);
+    }
+  }
+
+  // Freezes the globals of this VM, shared with `clone` from now on.
+  // Returns true if it had to freeze a new layer, i.e. this VM wrote
+  // globals since the last call, which moves them to another address. The
+  // layer takes the objects of `heap`, the heap of this VM, which its
+  // values may point to, so that they live as long as the layer rather
+  // than until the VM is reset.
+  bool Share(Globals* clone, Heap* heap) {
+    bool froze = own_ != nullptr;
+    if (froze) {
+      // The clones may read the layer on other threads.
+      own_->ForEach([](ObjString*, Value val) { val.FlattenString(); });
+      auto layer = std::make_shared<Layer>(std::move(own_), frozen_);
+      heap->MoveTo(&layer->heap);
+      frozen_ = std::move(layer);
+    }
+    clone->own_.reset();
+    clone->frozen_ = frozen_;
+    return froze;
+  }
+
+  // Drops the globals written by this VM, i.e. defined or set since the
+  // last `Share` or since created by it.
+  void Clear() { own_.reset(); }
+
+  // Number of frozen layers, i.e. of `Share` calls after a write.
+  int NumLayers() const {
+    int count = 0;
+    for (const Layer* layer = frozen_.get(); layer;
+         layer = layer->parent.get()) {
+      count++;
+    }
+    return count;
+  }
+
+ private:
+  // The hash of a name is computed when interned.
+  struct NameHasher {
+    uint32 Hash(const ObjString* name) const { return name->Hash(); }
+  };
+
+  typedef hash_table<ObjString*, Value, NameHasher> Table;
+
+  struct Layer {
+    Layer(std::unique_ptr<Table> t, std::shared_ptr<const Layer> p)
+        : table(std::move(t)), parent(std::move(p)) {}
+
+    std::unique_ptr<Table> table;
+    std::shared_ptr<const Layer> parent;
+    // The objects allocated before freezing the layer.
+    Heap heap;
+  };
+
+  bool FindFrozen(ObjString* name, Value* val) const {
+    for (const Layer* layer = frozen_.get(); layer;
+         layer = layer->parent.get()) {
+      if (layer->table->Find(name, val)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::unique_ptr<Table> own_;
+  std::shared_ptr<const Layer> frozen_;
+};
+
+}  // namespace xyxy
+
+#endif  // XYXY_GLOBALS_H_
@@ -3,6 +3,9 @@
 
 #include <cassert>
 #include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 #include "xyxy/list.h"
@@ -22,8 +25,8 @@ struct DefaultHasher {
 
 // https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function
 template <>
-struct DefaultHasher<std::string> {
-  uint32 Hash(const std::string& s) const {
+struct DefaultHasher<std::string_view> {
+  uint32 Hash(std::string_view s) const {
     uint32 hash = 2166136261u;
     for (int i = 0; i < s.size(); i++) {
       hash ^= s[i];
@@ -33,18 +36,21 @@ struct DefaultHasher<std::string> {
   }
 };
 
+template <>
+struct DefaultHasher<std::string> {
+  uint32 Hash(const std::string& s) const {
+    return DefaultHasher<std::string_view>().Hash(s);
+  }
+};
+
 template <class K, class V, class Hasher = DefaultHasher<K>>
 class hash_table {
  public:
   const int kMaxSlot = 1e3;
 
-  hash_table() {
-    table_.resize(kMaxSlot);
-    for (int i = 0; i < kMaxSlot; i++) {
-      table_[i] = std::make_unique<List<KeyType>>();
-      assert(table_[i].get());
-    }
-  }
+  // The list of a slot is only allocated on the first insertion into the
+  // slot, so that an empty table is cheap to create.
+  hash_table() { table_.resize(kMaxSlot); }
 
   using KeyType = std::pair<K, V>;
 
@@ -64,7 +70,7 @@ class hash_table {
   // const T& operator[](int n) const { return Get(n); }
 
   bool Insert(const K& key, const V& val) {
-    return Insert(make_pair(key, val));
+    return Insert(std::make_pair(key, val));
   }
 
   bool Insert(const K& key) { return Insert(std::make_pair(key, false)); }
@@ -76,6 +82,9 @@ class hash_table {
       return false;
     }
     int slot = hash_.Hash(key.first) % kMaxSlot;
+    if (!table_[slot]) {
+      table_[slot] = std::make_unique<List<KeyType>>();
+    }
     table_[slot]->AppendTail(key);
     return true;
   }
@@ -87,8 +96,38 @@ class hash_table {
   // }
   bool Find(const K& key, V* val = nullptr, bool set = false) const {
     int32 slot = hash_.Hash(key) % kMaxSlot;
-    assert(table_[slot]);
-    return Find(table_[slot].get(), key, val, set);
+    return table_[slot] && Find(table_[slot].get(), key, val, set);
+  }
+
+  // Returns the address of the value of `key`, or nullptr if not found.
+  // Values live in the nodes of the lists, so the address stays valid as
+  // long as the table does.
+  V* FindValue(const K& key) {
+    int32 slot = hash_.Hash(key) % kMaxSlot;
+    if (!table_[slot]) {
+      return nullptr;
+    }
+    auto root = table_[slot]->GetHead();
+    while (root) {
+      if (root->value.first == key) {
+        return &root->value.second;
+      }
+      root = root->next;
+    }
+    return nullptr;
+  }
+
+  // Calls `fn(key, value)` for every entry, in the order of the slots.
+  template <class Fn>
+  void ForEach(Fn fn) const {
+    for (const auto& list : table_) {
+      if (!list) {
+        continue;
+      }
+      for (auto node = list->GetHead(); node; node = node->next) {
+        fn(node->value.first, node->value.second);
+      }
+    }
   }
 
   bool Find(List<KeyType>* li, const K& key, V* val, bool set = false) const {
@@ -0,0 +1,369 @@
+#include "xyxy/jit.h"
+
+#include "xyxy/jit_assembler.h"
+#include "xyxy/logging.h"
+#include "xyxy/object.h"
+#include "xyxy/vm.h"
+
+namespace xyxy {
+
+JitCode::~JitCode() {
+#ifdef XYXY_JIT_X64
+  if (code_) {
+    FreeExecutable(code_, capacity_);
+  }
+#endif
+}
+
+bool JitCode::HasEntry(int pc) const {
+  return pc >= 0 && pc < (int)entries_.size() && entries_[pc] != -1;
+}
+
+int JitCode::Run(int pc, const char** error) {
+  CHECK(HasEntry(pc));
+  typedef int (*EntryFunc)(const char** error, const uint8* entry);
+  auto func = reinterpret_cast<EntryFunc>(code_);
+  return func(error, code_ + entries_[pc]);
+}
+
+bool JitCompiler::Supported() {
+#ifdef XYXY_JIT_X64
+  return ValueLayoutSupported();
+#else
+  return false;
+#endif
+}
+
+const char* JitCompiler::Print(VM* vm, const uint8* ip) {
+  vm->PrintTop();
+  return nullptr;
+}
+
+const char* JitCompiler::DefineGlobal(VM* vm, const uint8* ip) {
+  ObjString* var_name = vm->chunk_->GetConstant(ip[1]).AsObjString();
+  vm->global_.Insert(var_name, vm->stack_.Pop());
+  return nullptr;
+}
+
+const char* JitCompiler::GetGlobal(VM* vm, const uint8* ip) {
+  ObjString* var_name = vm->chunk_->GetConstant(ip[1]).AsObjString();
+  Value val;
+  if (!vm->global_.Find(var_name, &val)) {
+    // TODO(): Error handling
+    CHECK(false);
+  }
+  vm->stack_.Push(val);
+  return nullptr;
+}
+
+const char* JitCompiler::SetGlobal(VM* vm, const uint8* ip) {
+  ObjString* var_name = vm->chunk_->GetConstant(ip[1]).AsObjString();
+  if (!vm->global_.Find(var_name)) {
+    // TODO(): Error handling
+    CHECK(false);
+  }
+  vm->global_.Insert(var_name, vm->stack_.Top());
+  return nullptr;
+}
+
+const char* JitCompiler::BinaryOp(VM* vm, const uint8* ip) {
+  auto rhs = vm->stack_.Pop();
+  auto lhs = vm->stack_.Pop();
+  if (BaseOpcode(*ip) == OP_ADD && rhs.IsString()) {
+    if (!lhs.IsString()) {
+      return "Operand must be a string.";
+    }
+    vm->stack_.Push(Value::Concat(lhs, rhs));
+    return nullptr;
+  }
+  // The generated code only calls here when an operand isn't a number.
+  if (!lhs.IsFloat()) {
+    return "Unsupported binary operation.";
+  }
+  return "Operand must be a number.";
+}
+
+const char* JitCompiler::Negate(VM* vm, const uint8* ip) {
+  return "Operand must be a number.";
+}
+
+const char* JitCompiler::Concat(VM* vm, const uint8* ip) {
+  return vm->AddTop(ip[1]);
+}
+
+#ifdef XYXY_JIT_X64
+
+typedef const char* (*HelperFunc)(VM* vm, const uint8* ip);
+
+// Emits the templates of the insts of one chunk.
+class JitCompiler::TemplateEmitter {
+ public:
+  TemplateEmitter(VM* vm, Chunk* chunk) : vm_(vm), chunk_(chunk) {}
+
+  // Returns false if the chunk has something the JIT doesn't support, the
+  // native code of the inst at pc starts at `entries[pc]`.
+  bool EmitChunk(std::vector<int32>* entries);
+
+  const std::vector<uint8>& code() const { return asm_.code(); }
+
+ private:
+  void EmitPrologue();
+  bool EmitInst(int pc);
+
+  // Calls `helper` for the inst at `pc`, and leaves the native code if it
+  // returns a runtime error.
+  void EmitCall(HelperFunc helper, int pc);
+  // Jumps to the inst at `target` if the condition of `opcode` holds.
+  void EmitJumpTo(std::initializer_list<uint8> opcode, int target);
+  // Jumps to `slow` unless both operands on the top of the stack are
+  // numbers.
+  void EmitCheckNumbers(std::vector<int>* slow);
+
+  VM* vm_;
+  Chunk* chunk_;
+  Assembler asm_;
+  // Jumps to bind to the native code of an inst, pairs of the position to
+  // patch and the pc of the target.
+  std::vector<std::pair<int, int>> jumps_;
+  // Jumps to bind to the exit of the native code.
+  std::vector<int> exits_;
+};
+
+void JitCompiler::TemplateEmitter::EmitPrologue() {
+  asm_.Prologue(vm_->stack_.MutableTop(), vm_->stack_.Data(),
+                chunk_->constants());
+  // jmp rsi
+  asm_.Emit({0xff, 0xe6});
+}
+
+void JitCompiler::TemplateEmitter::EmitCall(HelperFunc helper, int pc) {
+  asm_.Call(reinterpret_cast<const void*>(helper),
+            reinterpret_cast<uint64>(vm_),
+            reinterpret_cast<uint64>(chunk_->code() + pc));
+  // test rax, rax; jz +13
+  asm_.Emit({0x48, 0x85, 0xc0, 0x74, 0x0d});
+  // mov [r15], rax; mov eax, pc; jmp exit
+  asm_.Emit({0x49, 0x89, 0x07, 0xb8});
+  asm_.Emit32(pc);
+  exits_.push_back(asm_.EmitJump({0xe9}));
+}
+
+void JitCompiler::TemplateEmitter::EmitJumpTo(
+    std::initializer_list<uint8> opcode, int target) {
+  jumps_.emplace_back(asm_.EmitJump(opcode), target);
+}
+
+void JitCompiler::TemplateEmitter::EmitCheckNumbers(std::vector<int>* slow) {
+  // cmp dword [r12 - 32], VAL_FLOAT; jne slow
+  asm_.Emit({0x41, 0x83, 0x7c, 0x24, 0xe0, (uint8)ValueType::VAL_FLOAT});
+  slow->push_back(asm_.EmitJump({0x0f, 0x85}));
+  // cmp dword [r12 - 16], VAL_FLOAT; jne slow
+  asm_.Emit({0x41, 0x83, 0x7c, 0x24, 0xf0, (uint8)ValueType::VAL_FLOAT});
+  slow->push_back(asm_.EmitJump({0x0f, 0x85}));
+}
+
+bool JitCompiler::TemplateEmitter::EmitInst(int pc) {
+  const uint8* ip = chunk_->code() + pc;
+  uint8 opcode = BaseOpcode(*ip);
+  switch (opcode) {
+    case OP_RETURN: {
+      break;
+    }
+    case OP_CONSTANT: {
+      asm_.PushValue(kConstantOperand, ip[1] * kValueSize);
+      break;
+    }
+    case OP_NIL: {
+      asm_.PushLiteral(ValueType::VAL_NIL, 0);
+      break;
+    }
+    case OP_TRUE: {
+      asm_.PushLiteral(ValueType::VAL_BOOL, 1);
+      break;
+    }
+    case OP_FALSE: {
+      asm_.PushLiteral(ValueType::VAL_BOOL, 0);
+      break;
+    }
+    case OP_POP: {
+      asm_.Pop();
+      break;
+    }
+    case OP_GET_LOCAL: {
+      asm_.PushValue(kLocalOperand, ip[1] * kValueSize);
+      break;
+    }
+    case OP_SET_LOCAL: {
+      asm_.StoreLocal(ip[1] * kValueSize);
+      break;
+    }
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_EQUAL:
+    case OP_GREATER:
+    case OP_LESS: {
+      std::vector<int> slow;
+      EmitCheckNumbers(&slow);
+      if (opcode == OP_EQUAL || opcode == OP_GREATER || opcode == OP_LESS) {
+        asm_.CompareNumbers(opcode == OP_EQUAL, opcode == OP_LESS);
+      }
+      else {
+        asm_.NumberOp(opcode == OP_ADD   ? 0x58   // addsd
+                      : opcode == OP_SUB ? 0x5c   // subsd
+                      : opcode == OP_MUL ? 0x59   // mulsd
+                                         : 0x5e); // divsd
+      }
+      int done = asm_.EmitJump({0xe9});
+      for (int at : slow) {
+        asm_.Bind(at, asm_.size());
+      }
+      EmitCall(&JitCompiler::BinaryOp, pc);
+      asm_.Bind(done, asm_.size());
+      break;
+    }
+    case OP_NEGATE: {
+      std::vector<int> slow;
+      // cmp dword [r12 - 16], VAL_FLOAT; jne slow
+      asm_.Emit({0x41, 0x83, 0x7c, 0x24, 0xf0, (uint8)ValueType::VAL_FLOAT});
+      slow.push_back(asm_.EmitJump({0x0f, 0x85}));
+      asm_.NegateNumber();
+      int done = asm_.EmitJump({0xe9});
+      asm_.Bind(slow[0], asm_.size());
+      EmitCall(&JitCompiler::Negate, pc);
+      asm_.Bind(done, asm_.size());
+      break;
+    }
+    case OP_NOT: {
+      // The top is falsey if it is nil, or a boolean with a zero payload.
+      // mov eax, [r12 - 16]; cmp eax, VAL_NIL; sete cl
+      asm_.Emit({0x41, 0x8b, 0x44, 0x24, 0xf0, 0x83, 0xf8,
+                 (uint8)ValueType::VAL_NIL, 0x0f, 0x94, 0xc1});
+      // test eax, eax (VAL_BOOL); sete dl
+      asm_.Emit({0x85, 0xc0, 0x0f, 0x94, 0xc2});
+      // cmp byte [r12 - 8], 0; sete al; and al, dl; or al, cl
+      asm_.Emit({0x41, 0x80, 0x7c, 0x24, 0xf8, 0x00, 0x0f, 0x94, 0xc0, 0x20,
+                 0xd0, 0x08, 0xc8});
+      // mov dword [r12 - 16], VAL_BOOL
+      asm_.Emit({0x41, 0xc7, 0x44, 0x24, 0xf0});
+      asm_.Emit32((int32)ValueType::VAL_BOOL);
+      // movzx eax, al; mov [r12 - 8], rax
+      asm_.Emit({0x0f, 0xb6, 0xc0, 0x49, 0x89, 0x44, 0x24, 0xf8});
+      break;
+    }
+    case OP_PRINT: {
+      EmitCall(&JitCompiler::Print, pc);
+      break;
+    }
+    case OP_CONCAT: {
+      EmitCall(&JitCompiler::Concat, pc);
+      break;
+    }
+    case OP_DEFINE_GLOBAL: {
+      EmitCall(&JitCompiler::DefineGlobal, pc);
+      break;
+    }
+    case OP_GET_GLOBAL: {
+      EmitCall(&JitCompiler::GetGlobal, pc);
+      break;
+    }
+    case OP_SET_GLOBAL: {
+      EmitCall(&JitCompiler::SetGlobal, pc);
+      break;
+    }
+    case OP_JUMP_IF_FALSE: {
+      int target = pc + ((ip[1] << 8) | ip[2]) + InstLength(OP_JUMP_IF_FALSE);
+      // mov eax, [r12 - 16]; cmp eax, VAL_NIL; je target
+      asm_.Emit({0x41, 0x8b, 0x44, 0x24, 0xf0, 0x83, 0xf8,
+                 (uint8)ValueType::VAL_NIL});
+      EmitJumpTo({0x0f, 0x84}, target);
+      // test eax, eax (VAL_BOOL); jne +12
+      asm_.Emit({0x85, 0xc0, 0x75, 0x0c});
+      // cmp byte [r12 - 8], 0; je target
+      asm_.Emit({0x41, 0x80, 0x7c, 0x24, 0xf8, 0x00});
+      EmitJumpTo({0x0f, 0x84}, target);
+      break;
+    }
+    case OP_JUMP: {
+      EmitJumpTo({0xe9}, pc + ((ip[1] << 8) | ip[2]) + InstLength(OP_JUMP));
+      break;
+    }
+    case OP_LOOP: {
+      EmitJumpTo({0xe9}, pc - ((ip[1] << 8) | ip[2]));
+      break;
+    }
+    default: {
+      LOGcc << "JIT doesn't support opcode " << (int)opcode;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool JitCompiler::TemplateEmitter::EmitChunk(std::vector<int32>* entries) {
+  const int size = chunk_->size();
+  entries->assign(size + 1, -1);
+  EmitPrologue();
+  // Superinsts and quickened insts are compiled as the insts emitted by the
+  // compiler, whose bytes are left in the chunk.
+  int pc = 0;
+  while (pc < size) {
+    uint8 opcode = BaseOpcode(chunk_->GetByte(pc));
+    if (opcode >= OP_COUNT || pc + InstLength(opcode) > size) {
+      return false;
+    }
+    (*entries)[pc] = asm_.size();
+    if (!EmitInst(pc)) {
+      return false;
+    }
+    pc += InstLength(opcode);
+  }
+  (*entries)[size] = asm_.size();
+  // mov eax, size
+  asm_.Emit({0xb8});
+  asm_.Emit32(size);
+  int exit = asm_.size();
+  asm_.Epilogue();
+  for (int at : exits_) {
+    asm_.Bind(at, exit);
+  }
+  for (auto& jump : jumps_) {
+    if (jump.second < 0 || jump.second > size ||
+        (*entries)[jump.second] == -1) {
+      LOGcc << "JIT found an invalid jump target " << jump.second;
+      return false;
+    }
+    asm_.Bind(jump.first, (*entries)[jump.second]);
+  }
+  return true;
+}
+
+std::unique_ptr<JitCode> JitCompiler::Compile(VM* vm) {
+  if (!Supported()) {
+    return nullptr;
+  }
+  std::unique_ptr<JitCode> jit_code(new JitCode());
+  TemplateEmitter emitter(vm, vm->chunk_);
+  if (!emitter.EmitChunk(&jit_code->entries_)) {
+    return nullptr;
+  }
+  const std::vector<uint8>& code = emitter.code();
+  jit_code->code_ = AllocateExecutable(code);
+  if (!jit_code->code_) {
+    return nullptr;
+  }
+  jit_code->capacity_ = code.size();
+  jit_code->chunk_size_ = vm->chunk_->size();
+  LOGcc << "JIT compiled " << jit_code->chunk_size_ << " bytes of bytecode into "
+        << code.size() << " bytes of native code";
+  return jit_code;
+}
+
+#else  // XYXY_JIT_X64
+
+std::unique_ptr<JitCode> JitCompiler::Compile(VM* vm) { return nullptr; }
+
+#endif
+
+}  // namespace xyxy
@@ -0,0 +1,74 @@
+#ifndef XYXY_JIT_H_
+#define XYXY_JIT_H_
+
+#include <memory>
+#include <vector>
+
+#include "xyxy/base.h"
+
+namespace xyxy {
+
+class VM;
+
+// Native code of the chunk of a VM, generated by `JitCompiler`. The code is
+// only valid for the VM it is compiled for, and as long as the chunk does
+// not grow.
+class JitCode {
+ public:
+  virtual ~JitCode();
+
+  // Size of the chunk this code was compiled from.
+  int ChunkSize() const { return chunk_size_; }
+
+  // Returns true if the execution can start from the inst at `pc`.
+  bool HasEntry(int pc) const;
+
+  // Runs from the inst at `pc`, returns the pc where the execution stops,
+  // i.e. `ChunkSize()` unless a runtime error is stored into `error`.
+  int Run(int pc, const char** error);
+
+ private:
+  friend class JitCompiler;
+  JitCode() = default;
+
+  // Executable memory from mmap.
+  uint8* code_ = nullptr;
+  size_t capacity_ = 0;
+  // Offset of the native code of every inst in `code_`, -1 if the pc is not
+  // the start of an inst.
+  std::vector<int32> entries_;
+  int chunk_size_ = 0;
+};
+
+// A baseline JIT compiler for x86-64, every inst is translated into a fixed
+// template of native code. The VM stack stays in memory, numbers are
+// handled inline and everything else calls back into C++. See
+// jit_assembler.h for the registers, r15 holds where to store the runtime
+// error.
+class JitCompiler {
+ public:
+  // Returns true if the JIT can run on this platform.
+  static bool Supported();
+
+  // Compiles the chunk of `vm`, returns nullptr if the chunk has something
+  // the JIT doesn't support, the VM interprets the chunk then.
+  static std::unique_ptr<JitCode> Compile(VM* vm);
+
+ private:
+  class TemplateEmitter;
+
+  // Runtime helpers called by the generated code, one per inst that isn't
+  // handled inline. They return nullptr or a runtime error.
+  static const char* Print(VM* vm, const uint8* ip);
+  static const char* DefineGlobal(VM* vm, const uint8* ip);
+  static const char* GetGlobal(VM* vm, const uint8* ip);
+  static const char* SetGlobal(VM* vm, const uint8* ip);
+  // Binary ops with operands that aren't both numbers.
+  static const char* BinaryOp(VM* vm, const uint8* ip);
+  static const char* Negate(VM* vm, const uint8* ip);
+  static const char* Concat(VM* vm, const uint8* ip);
+};
+
+}  // namespace xyxy
+
+#endif  // XYXY_JIT_H_
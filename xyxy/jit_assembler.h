@@ -0,0 +1,246 @@
+#ifndef XYXY_JIT_ASSEMBLER_H_
+#define XYXY_JIT_ASSEMBLER_H_
+
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+#include "xyxy/base.h"
+#include "xyxy/type.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define XYXY_JIT_X64
+#include <sys/mman.h>
+#endif
+
+namespace xyxy {
+
+// The generated code reads and writes values in memory directly: the type
+// is an int at offset 0 and the payload starts at offset 8, see
+// `ValueLayoutSupported`.
+static const int kValueSize = 16;
+static const int kPayloadOffset = 8;
+
+// ModRM bytes of the memory operands of locals and constants, the bottom of
+// the VM stack is kept in r13 and the constants of the chunk in r14.
+static const uint8 kLocalOperand = 0x85;     // [r13 + disp32]
+static const uint8 kConstantOperand = 0x86;  // [r14 + disp32]
+
+// Returns true if `Value` has the layout the generated code expects, i.e.
+// not when built with `XYXY_NAN_BOXING`.
+inline bool ValueLayoutSupported() {
+#ifdef XYXY_NAN_BOXING
+  return false;
+#else
+  static_assert(sizeof(Value) == kValueSize, "Unexpected layout of Value.");
+  Value num(2.5);
+  Value boolean(true);
+  int32 type;
+  double payload;
+  std::memcpy(&type, &num, sizeof(type));
+  std::memcpy(&payload, reinterpret_cast<uint8*>(&num) + kPayloadOffset,
+              sizeof(payload));
+  if (type != (int32)ValueType::VAL_FLOAT || payload != 2.5) {
+    return false;
+  }
+  std::memcpy(&type, &boolean, sizeof(type));
+  return type == (int32)ValueType::VAL_BOOL &&
+         reinterpret_cast<uint8*>(&boolean)[kPayloadOffset] == 1;
+#endif
+}
+
+// Emits x86-64 machine code into a buffer, with the templates shared by the
+// JIT compilers. The generated code keeps the VM stack in memory:
+//   rbx: address of the stack top pointer of the VM.
+//   r12: the stack top pointer, written back before calling into C++.
+//   r13: the bottom of the VM stack, where the locals live.
+//   r14: the constants of the chunk.
+//   r15: free for the compiler.
+class Assembler {
+ public:
+  void Emit(std::initializer_list<uint8> bytes) {
+    code_.insert(code_.end(), bytes.begin(), bytes.end());
+  }
+
+  void Emit32(uint32 val) {
+    for (int i = 0; i < 4; i++) {
+      code_.push_back((val >> (i * 8)) & 0xff);
+    }
+  }
+
+  void Emit64(uint64 val) {
+    Emit32(val & 0xffffffff);
+    Emit32(val >> 32);
+  }
+
+  // Emits a jump with a 32 bits displacement, returns where the
+  // displacement is for `Bind`.
+  int EmitJump(std::initializer_list<uint8> opcode) {
+    Emit(opcode);
+    Emit32(0);
+    return size() - 4;
+  }
+
+  // Points the jump emitted at `at` to `target`.
+  void Bind(int at, int target) {
+    int32 disp = target - (at + 4);
+    std::memcpy(&code_[at], &disp, sizeof(disp));
+  }
+
+  // Saves the callee saved registers, moves the first argument into r15
+  // and loads the registers described above.
+  void Prologue(Value** top, Value* bottom, const Value* constants) {
+    // push rbx; push r12; push r13; push r14; push r15
+    Emit({0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57});
+    // mov r15, rdi
+    Emit({0x49, 0x89, 0xff});
+    // mov rbx, top; mov r12, [rbx]
+    Emit({0x48, 0xbb});
+    Emit64(reinterpret_cast<uint64>(top));
+    Emit({0x4c, 0x8b, 0x23});
+    // mov r13, bottom
+    Emit({0x49, 0xbd});
+    Emit64(reinterpret_cast<uint64>(bottom));
+    // mov r14, constants
+    Emit({0x49, 0xbe});
+    Emit64(reinterpret_cast<uint64>(constants));
+  }
+
+  // Writes the stack top back and returns eax.
+  void Epilogue() {
+    // mov [rbx], r12; pop r15; pop r14; pop r13; pop r12; pop rbx; ret
+    Emit({0x4c, 0x89, 0x23, 0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c,
+          0x5b, 0xc3});
+  }
+
+  // Calls `func` with `arg0` and `arg1`, the stack top is written back
+  // before the call and loaded again after it.
+  void Call(const void* func, uint64 arg0, uint64 arg1) {
+    // mov [rbx], r12
+    Emit({0x4c, 0x89, 0x23});
+    // mov rdi, arg0; mov rsi, arg1
+    Emit({0x48, 0xbf});
+    Emit64(arg0);
+    Emit({0x48, 0xbe});
+    Emit64(arg1);
+    // mov rax, func; call rax
+    Emit({0x48, 0xb8});
+    Emit64(reinterpret_cast<uint64>(func));
+    Emit({0xff, 0xd0});
+    // mov r12, [rbx]
+    Emit({0x4c, 0x8b, 0x23});
+  }
+
+  // Pushes the value at `disp` from the base of `modrm`, see
+  // `kLocalOperand`.
+  void PushValue(uint8 modrm, int32 disp) {
+    // movups xmm0, [base + disp32]
+    Emit({0x41, 0x0f, 0x10, modrm});
+    Emit32(disp);
+    // movups [r12], xmm0; add r12, 16
+    Emit({0x41, 0x0f, 0x11, 0x04, 0x24, 0x49, 0x83, 0xc4, kValueSize});
+  }
+
+  // Stores the top into the local at `disp`, without popping it.
+  void StoreLocal(int32 disp) {
+    // movups xmm0, [r12 - 16]; movups [r13 + disp32], xmm0
+    Emit({0x41, 0x0f, 0x10, 0x44, 0x24, 0xf0, 0x41, 0x0f, 0x11,
+          kLocalOperand});
+    Emit32(disp);
+  }
+
+  // Pushes a value with the given type and payload.
+  void PushLiteral(ValueType type, int32 payload) {
+    // mov dword [r12], type
+    Emit({0x41, 0xc7, 0x04, 0x24});
+    Emit32((int32)type);
+    // mov qword [r12 + 8], payload
+    Emit({0x49, 0xc7, 0x44, 0x24, kPayloadOffset});
+    Emit32(payload);
+    // add r12, 16
+    Emit({0x49, 0x83, 0xc4, kValueSize});
+  }
+
+  void Pop() {
+    // sub r12, 16
+    Emit({0x49, 0x83, 0xec, kValueSize});
+  }
+
+  // Applies the SSE2 op `sse_op` (e.g. 0x58 for addsd) to the two numbers on
+  // the top, and pushes the result in their place.
+  void NumberOp(uint8 sse_op) {
+    // movsd xmm0, [r12 - 24]; op xmm0, [r12 - 8]; movsd [r12 - 24], xmm0
+    Emit({0xf2, 0x41, 0x0f, 0x10, 0x44, 0x24, 0xe8});
+    Emit({0xf2, 0x41, 0x0f, sse_op, 0x44, 0x24, 0xf8});
+    Emit({0xf2, 0x41, 0x0f, 0x11, 0x44, 0x24, 0xe8});
+    Pop();
+  }
+
+  // Compares the two numbers on the top and pushes the result in their
+  // place: `==` if `equal`, otherwise `<` if `less` and `>` if not.
+  // Comparisons with NaN are false.
+  void CompareNumbers(bool equal, bool less) {
+    if (less) {
+      // movsd xmm0, [r12 - 8]; ucomisd xmm0, [r12 - 24]
+      Emit({0xf2, 0x41, 0x0f, 0x10, 0x44, 0x24, 0xf8});
+      Emit({0x66, 0x41, 0x0f, 0x2e, 0x44, 0x24, 0xe8});
+    }
+    else {
+      // movsd xmm0, [r12 - 24]; ucomisd xmm0, [r12 - 8]
+      Emit({0xf2, 0x41, 0x0f, 0x10, 0x44, 0x24, 0xe8});
+      Emit({0x66, 0x41, 0x0f, 0x2e, 0x44, 0x24, 0xf8});
+    }
+    if (equal) {
+      // sete al; setnp cl; and al, cl
+      Emit({0x0f, 0x94, 0xc0, 0x0f, 0x9b, 0xc1, 0x20, 0xc8});
+    }
+    else {
+      // seta al, false when unordered.
+      Emit({0x0f, 0x97, 0xc0});
+    }
+    // mov dword [r12 - 32], VAL_BOOL
+    Emit({0x41, 0xc7, 0x44, 0x24, 0xe0});
+    Emit32((int32)ValueType::VAL_BOOL);
+    // movzx eax, al; mov [r12 - 24], rax
+    Emit({0x0f, 0xb6, 0xc0, 0x49, 0x89, 0x44, 0x24, 0xe8});
+    Pop();
+  }
+
+  // Negates the number on the top.
+  void NegateNumber() {
+    // mov rax, [r12 - 8]; btc rax, 63; mov [r12 - 8], rax
+    Emit({0x49, 0x8b, 0x44, 0x24, 0xf8, 0x48, 0x0f, 0xba, 0xf8, 0x3f});
+    Emit({0x49, 0x89, 0x44, 0x24, 0xf8});
+  }
+
+  int size() const { return code_.size(); }
+  const std::vector<uint8>& code() const { return code_; }
+
+ private:
+  std::vector<uint8> code_;
+};
+
+#ifdef XYXY_JIT_X64
+
+// Copies `code` into new executable memory, returns nullptr on failure.
+inline uint8* AllocateExecutable(const std::vector<uint8>& code) {
+  void* mem = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    return nullptr;
+  }
+  std::memcpy(mem, code.data(), code.size());
+  if (mprotect(mem, code.size(), PROT_READ | PROT_EXEC) != 0) {
+    munmap(mem, code.size());
+    return nullptr;
+  }
+  return static_cast<uint8*>(mem);
+}
+
+inline void FreeExecutable(uint8* code, size_t size) { munmap(code, size); }
+
+#endif
+
+}  // namespace xyxy
+
+#endif  // XYXY_JIT_ASSEMBLER_H_
@@ -0,0 +1,107 @@
+#include "xyxy/jit.h"
+
+#include "gtest/gtest.h"
+#include "xyxy/compiler.h"
+#include "xyxy/vm.h"
+
+namespace xyxy {
+
+// Runs `source` with both the interpreter and the JIT, and expects the same
+// result, the JIT must not fall back to the interpreter.
+#define XY_RUN_BOTH(source, result)                                 \
+  Compiler compiler;                                                \
+  compiler.Compile(source);                                         \
+  VM vm(compiler.GetChunk());                                       \
+  Status status = vm.Run();                                         \
+  EXPECT_EQ(vm.FinalResult(), result);                              \
+  VMOptions options;                                                \
+  options.jit = true;                                               \
+  VM jit_vm(compiler.GetChunk(), options);                          \
+  EXPECT_NE(JitCompiler::Compile(&jit_vm), nullptr);                \
+  Status jit_status = jit_vm.Run();                                 \
+  EXPECT_EQ(jit_vm.FinalResult(), result);                          \
+  EXPECT_EQ(jit_status.ok(), status.ok());                          \
+  EXPECT_EQ(jit_status.error_message(), status.error_message());    \
+  EXPECT_EQ(jit_vm.PC(), vm.PC());                                  \
+  EXPECT_EQ(jit_vm.GetStack().Size(), vm.GetStack().Size());
+
+#if defined(__x86_64__) && defined(__linux__)
+
+TEST(Supported, TestJit) { EXPECT_TRUE(JitCompiler::Supported()); }
+
+TEST(Loop, TestJit) {
+  XY_RUN_BOTH(R"(
+    var a = 0;
+    for (var i = 0; i < 1000; i = i + 1) {
+      {
+        var b = i * 2 - 1;
+        if (b / 2 > 100 and !(i == 500)) {
+          a = a + b;
+        }
+      }
+    }
+    print a;
+  )",
+              "987002")
+}
+
+TEST(Literals, TestJit) {
+  XY_RUN_BOTH(R"(
+    var s = "a" + "b";
+    print -(1 - 3);
+    print !nil;
+    print !0;
+    print s;
+  )",
+              "ab")
+}
+
+TEST(NaN, TestJit) {
+  XY_RUN_BOTH(R"(
+    var n = 0 / 0;
+    var r = "r";
+    if (n == n) { r = r + "a"; }
+    if (n < 1) { r = r + "b"; }
+    if (n > 1) { r = r + "c"; }
+    if (!(n < 1)) { r = r + "d"; }
+    print r;
+  )",
+              "rd")
+}
+
+TEST(RuntimeError, TestJit) {
+  XY_RUN_BOTH(R"(
+    print 1;
+    print -"a";
+    print 2;
+  )",
+              "1")
+  EXPECT_FALSE(jit_status.ok());
+}
+
+TEST(StringError, TestJit) {
+  XY_RUN_BOTH(R"(
+    var a = 1;
+    print a + "a";
+  )",
+              "")
+  EXPECT_EQ(jit_status.error_message(), "Operand must be a string.");
+}
+
+TEST(Resume, TestJit) {
+  Compiler compiler;
+  VMOptions options;
+  options.jit = true;
+  VM vm(compiler.GetChunk(), options);
+  compiler.Compile("var a = 1;");
+  EXPECT_TRUE(vm.Run().ok());
+  // Runs the new code only, with the chunk compiled again.
+  compiler.Compile("a = a + 1; print a;");
+  EXPECT_TRUE(vm.Run().ok());
+  EXPECT_EQ(vm.FinalResult(), "2");
+  EXPECT_EQ(vm.PC(), compiler.GetChunk()->size());
+}
+
+#endif
+
+}  // namespace xyxy
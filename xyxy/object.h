@@ -1,53 +1,345 @@
 #ifndef XYXY_OBJECT_H_
 #define XYXY_OBJECT_H_
 
+#include <cstring>
+#include <mutex>
+#include <new>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include "xyxy/base.h"
+#include "xyxy/hash_table.h"
+
 namespace xyxy {
 
 class Object;
 
-// Temporary garbage collector to free all objects, later when we
-// add a real garbage collector, this will be removed.
-static std::vector<Object*>* Collector() {
-  static std::vector<Object*>* collector = new std::vector<Object*>;
+// Owns the objects allocated by a thread while it is the heap of that
+// thread, see `Heap::Scope`, and frees them along with itself. Every VM has
+// its own heap, so the VMs running on different threads don't share any
+// object they allocate.
+class Heap {
+ public:
+  // A `shared` heap may be used by many threads at once.
+  explicit Heap(bool shared = false) : shared_(shared) {}
+  ~Heap();
+
+  void Track(Object* obj) {
+    if (shared_) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      objects_.push_back(obj);
+    }
+    else {
+      objects_.push_back(obj);
+    }
+  }
+
+  size_t NumObjects() const { return objects_.size(); }
+
+  // Moves all the objects into `heap`, which frees them from now on. Neither
+  // heap may be used by other threads meanwhile.
+  void MoveTo(Heap* heap) {
+    heap->objects_.insert(heap->objects_.end(), objects_.begin(),
+                          objects_.end());
+    objects_.clear();
+  }
+
+  // Frees all the objects, the heap is empty after.
+  void Clear();
+
+  // Returns the heap of the calling thread, `Collector()` if none is set.
+  static Heap* Current();
+
+  // Sets the heap of the calling thread for the lifetime of the scope.
+  class Scope {
+   public:
+    explicit Scope(Heap* heap) : prev_(ThreadHeap()) { ThreadHeap() = heap; }
+    ~Scope() { ThreadHeap() = prev_; }
+
+   private:
+    Heap* prev_;
+  };
+
+ private:
+  static Heap*& ThreadHeap() {
+    static thread_local Heap* heap = nullptr;
+    return heap;
+  }
+
+  const bool shared_;
+  std::mutex mutex_;
+  std::vector<Object*> objects_;
+};
+
+// Temporary garbage collector holding the objects allocated outside of a
+// VM, e.g. the constants of the compiler, they are never freed. Later when
+// we add a real garbage collector, this will be removed.
+inline Heap* Collector() {
+  static Heap* collector = new Heap(/*shared=*/true);
   return collector;
 }
 
-enum class ObjType {
+inline Heap* Heap::Current() {
+  Heap* heap = ThreadHeap();
+  return heap ? heap : Collector();
+}
+
+enum class ObjType : uint8 {
   OBJ_STRING,
+  OBJ_TASK,
 };
 
+// The header of every object, 8 bytes and no vtable: what depends on the
+// type of the object switches on its tag, see `ToString` and `Free`.
 class Object {
  public:
-  Object(ObjType type) : type_(type) {}
+  ObjType Type() const { return type_; }
 
-  virtual ~Object() = default;
+  bool IsString() const { return type_ == ObjType::OBJ_STRING; }
 
-  ObjType Type() const { return type_; }
+  bool IsTask() const { return type_ == ObjType::OBJ_TASK; }
 
-  bool IsString() { return type_ == ObjType::OBJ_STRING; }
+  std::string ToString() const;
 
-  // Must inherted by all subclasses.
-  virtual std::string ToString() = 0;
+  // Destroys `obj` and releases its memory, see `Heap::Clear`.
+  static void Free(Object* obj);
 
- private:
-  ObjType type_;
+ protected:
+  // The bits of `flags_`.
+  enum : uint8 {
+    // Reserved for the garbage collector that will replace `Collector()`.
+    kMarked = 1 << 0,
+    kInterned = 1 << 1,
+  };
+
+  explicit Object(ObjType type) : type_(type) {}
+
+  // Only `Free` destroys objects.
+  ~Object() = default;
+
+  const ObjType type_;
+  uint8 flags_ = 0;
+  // The hash of the contents, cached by the types that have one.
+  mutable uint32 hash_ = 0;
 };
 
-class ObjString : Object {
+// Frees a task, defined in task.cc, since object.h doesn't know `ObjTask`.
+void FreeTask(Object* task);
+
+// A string is a single allocation: the header, then its bytes. Its hash is
+// computed once, so that the tables keyed by strings never hash them again.
+// See `Intern` for the strings shared by all the VMs.
+//
+// A string may also be a rope node, the concatenation of a left string, its
+// own bytes and a right string, so that concatenating copies nothing, see
+// `Value::Concat`. A node is flattened into a buffer of its own the first
+// time its contents or its hash are read, which makes building a string by
+// appending to it linear rather than quadratic.
+class ObjString : public Object {
  public:
-  ObjString(const std::string& str) : Object(ObjType::OBJ_STRING), str_(str) {
-    Collector()->push_back(this);
+  static ObjString* New(std::string_view str, Heap* heap = Heap::Current()) {
+    return New(nullptr, str, nullptr, heap);
+  }
+
+  // The concatenation of `left`, `str` and `right`, either string may be
+  // null.
+  static ObjString* New(const ObjString* left, std::string_view str,
+                        const ObjString* right, Heap* heap = Heap::Current()) {
+    void* memory = ::operator new(sizeof(ObjString) + str.size() + 1);
+    ObjString* obj = new (memory) ObjString(left, str, right);
+    heap->Track(obj);
+    return obj;
+  }
+
+  // The concatenation of `left`, which may be null, and `size` bytes that
+  // `write(char* bytes)` writes straight into the string.
+  template <typename Write>
+  static ObjString* New(const ObjString* left, size_t size, Write write,
+                        Heap* heap = Heap::Current()) {
+    void* memory = ::operator new(sizeof(ObjString) + size + 1);
+    ObjString* obj = new (memory) ObjString(left, size, nullptr);
+    write(obj->Bytes());
+    obj->Seal(size);
+    heap->Track(obj);
+    return obj;
+  }
+
+  std::string_view str() const {
+    if (IsRope()) {
+      Flatten();
+    }
+    return std::string_view(chars_, size_);
   }
 
-  std::string ToString() override { return str_; }
+  size_t size() const { return size_; }
+
+  uint32 Hash() const {
+    if (IsRope()) {
+      Flatten();
+    }
+    return hash_;
+  }
+
+  bool IsRope() const { return left_ || right_; }
+
+  bool IsInterned() const { return flags_ & kInterned; }
+
+  bool Equals(const ObjString* other) const {
+    if (this == other) {
+      return true;
+    }
+    // Interned strings with the same contents are the same object.
+    if (IsInterned() && other->IsInterned()) {
+      return false;
+    }
+    return size_ == other->size_ && Hash() == other->Hash() &&
+           str() == other->str();
+  }
 
  private:
-  std::string str_;
+  friend class Object;
+  friend ObjString* Intern(const std::string& str);
+
+  ObjString(const ObjString* left, std::string_view str,
+            const ObjString* right)
+      : ObjString(left, str.size(), right) {
+    std::memcpy(Bytes(), str.data(), str.size());
+    Seal(str.size());
+  }
+
+  // Leaves the `own` bytes of the string to be written, then sealed.
+  ObjString(const ObjString* left, size_t own, const ObjString* right)
+      : Object(ObjType::OBJ_STRING),
+        chars_(Bytes()),
+        left_(left),
+        right_(right),
+        size_((left ? left->size_ : 0) + own + (right ? right->size_ : 0)) {}
+
+  // Terminates the `own` bytes written after the string, and hashes them
+  // unless the string is a rope.
+  void Seal(size_t own) {
+    Bytes()[own] = '\0';
+    if (!IsRope()) {
+      hash_ = DefaultHasher<std::string_view>().Hash(
+          std::string_view(Bytes(), own));
+    }
+  }
+
+  ~ObjString() {
+    if (chars_ != Bytes()) {
+      delete[] chars_;
+    }
+  }
+
+  // The bytes allocated along with the string, right after it.
+  char* Bytes() const {
+    return reinterpret_cast<char*>(const_cast<ObjString*>(this + 1));
+  }
+
+  // Copies the strings of the tree from the left to the right, without
+  // recursing, as appending in a loop builds trees as deep as the loop.
+  void Flatten() const {
+    char* flat = new char[size_ + 1];
+    size_t size = 0;
+    // A node is pushed twice: to visit its left string, then to copy its
+    // bytes and visit its right string.
+    std::vector<std::pair<const ObjString*, bool>> todo = {{this, false}};
+    while (!todo.empty()) {
+      const ObjString* node = todo.back().first;
+      bool left_done = todo.back().second;
+      todo.pop_back();
+      if (!node->IsRope()) {
+        std::memcpy(flat + size, node->chars_, node->size_);
+        size += node->size_;
+      }
+      else if (!left_done) {
+        todo.emplace_back(node, true);
+        if (node->left_) {
+          todo.emplace_back(node->left_, false);
+        }
+      }
+      else {
+        size_t own = node->size_ - (node->left_ ? node->left_->size_ : 0) -
+                     (node->right_ ? node->right_->size_ : 0);
+        std::memcpy(flat + size, node->chars_, own);
+        size += own;
+        if (node->right_) {
+          todo.emplace_back(node->right_, false);
+        }
+      }
+    }
+    flat[size_] = '\0';
+    chars_ = flat;
+    left_ = right_ = nullptr;
+    hash_ = DefaultHasher<std::string_view>().Hash(
+        std::string_view(flat, size_));
+  }
+
+  // The bytes of the string, the ones allocated along with it unless it has
+  // been flattened. A rope node only holds its own bytes there.
+  mutable const char* chars_;
+  // The children of a rope node, null once flattened. A rope is only read by
+  // the VM that built it, the values passed to other VMs are flattened first,
+  // see `Value::FlattenString`, so the nodes are flattened without locking.
+  mutable const ObjString* left_ = nullptr;
+  mutable const ObjString* right_ = nullptr;
+  size_t size_;
 };
 
+inline std::string Object::ToString() const {
+  switch (type_) {
+    case ObjType::OBJ_STRING:
+      return std::string(static_cast<const ObjString*>(this)->str());
+    case ObjType::OBJ_TASK:
+      return "<task>";
+  }
+  return "";
+}
+
+inline void Object::Free(Object* obj) {
+  switch (obj->type_) {
+    case ObjType::OBJ_STRING: {
+      ObjString* str = static_cast<ObjString*>(obj);
+      str->~ObjString();
+      ::operator delete(str);
+      break;
+    }
+    case ObjType::OBJ_TASK:
+      FreeTask(obj);
+      break;
+  }
+}
+
+// Returns the only interned string with the contents `str`, created on the
+// first call by the collector, i.e. never freed. The compiler interns the
+// names of the variables, so the globals are looked up by address, see
+// `Globals`, and the string literals too long to be stored in a value, see
+// `Value::String`. The strings built while running, e.g. by concatenation,
+// aren't interned: they are freed with their heap.
+inline ObjString* Intern(const std::string& str) {
+  static std::mutex mutex;
+  static auto* strings = new std::unordered_map<std::string, ObjString*>();
+  std::lock_guard<std::mutex> lock(mutex);
+  ObjString*& interned = (*strings)[str];
+  if (!interned) {
+    interned = ObjString::New(str, Collector());
+    interned->flags_ |= ObjString::kInterned;
+  }
+  return interned;
+}
+
+inline Heap::~Heap() { Clear(); }
+
+inline void Heap::Clear() {
+  for (Object* obj : objects_) {
+    Object::Free(obj);
+  }
+  objects_.clear();
+}
+
 }  // namespace xyxy
 
 #endif  // XYXY_OBJECTH_
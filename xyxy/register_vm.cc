@@ -0,0 +1,515 @@
+#include "xyxy/register_vm.h"
+
+#include "xyxy/logging.h"
+#include "xyxy/type.h"
+#include "xyxy/vm.h"
+
+namespace xyxy {
+
+static const char* RegOpcodeName(uint8 opcode) {
+#define XYXY_REG_OPCODE_NAME(opcode) #opcode,
+  static const char* kNames[] = {XYXY_REG_OPCODE_LIST(XYXY_REG_OPCODE_NAME)};
+#undef XYXY_REG_OPCODE_NAME
+  return opcode < ROP_COUNT ? kNames[opcode] : "ROP_UNKNOWN";
+}
+
+int RegChunk::AddConstant(Value val) {
+  constants_.push_back(val);
+  return (int)constants_.size() - 1;
+}
+
+void RegChunk::DumpInsts() const {
+  LOGvv << "-------------REGISTER CODE--------------";
+  for (int i = 0; i < size(); i++) {
+    const RegInst& inst = code_[i];
+    char buf[96];
+    snprintf(buf, sizeof(buf), "%010d %-20s %u %u %u", i,
+             RegOpcodeName(inst.opcode), inst.a, inst.b, inst.c);
+    LOGvv << buf;
+  }
+  LOGvv << "---------------------------------------";
+}
+
+// Returns the opcode at `pc`, superinsts are lowered as the insts they fuse.
+static uint8 OpcodeAt(const Chunk& chunk, int pc) {
+  return BaseOpcode(chunk.GetByte(pc));
+}
+
+class RegLowering {
+ public:
+  RegLowering(const Chunk& chunk, RegChunk* out) : chunk_(chunk), out_(out) {}
+
+  Status Lower();
+
+ private:
+  // Computes the stack depth before every reachable inst, and marks the
+  // targets of jumps.
+  Status ComputeDepths();
+
+  Status LowerInst(int pc);
+
+  // Returns true if the inst computes a new value into R(a).
+  static bool IsComputation(uint8 opcode) {
+    return (opcode >= ROP_NEGATE && opcode <= ROP_LESS) ||
+           opcode == ROP_GET_GLOBAL;
+  }
+
+  uint16 Constant(int index) { return kRegisterCount + index; }
+
+  uint16 LiteralConstant(Value val, int* cache);
+
+  void Emit(uint8 opcode, uint32 a, uint16 b = 0, uint16 c = 0) {
+    out_->Write(RegInst{opcode, a, b, c});
+  }
+
+  // Pops out the operand on top of the virtual stack.
+  uint16 Pop() {
+    uint16 operand = vstack_.back();
+    vstack_.pop_back();
+    return operand;
+  }
+
+  // Stores all the pending values into the registers of their slot.
+  void Flush();
+
+  // Stores all the pending values that read register `reg` before it gets
+  // overwritten.
+  void SpillReaders(uint16 reg);
+
+  const Chunk& chunk_;
+  RegChunk* out_;  // Not owned.
+  std::vector<int> depth_;
+  std::vector<bool> is_target_;
+  // Operand holding the value of every stack slot, a slot whose value is
+  // already in its own register holds the register itself.
+  std::vector<uint16> vstack_;
+  // Index of the first inst emitted for the current basic block.
+  int block_start_ = 0;
+  // Jumps to patch with the register pc of their target.
+  std::vector<std::pair<int, int>> jumps_;
+  std::vector<int> reg_pc_;
+  int nil_ = -1;
+  int true_ = -1;
+  int false_ = -1;
+};
+
+Status RegLowering::ComputeDepths() {
+  const int size = chunk_.size();
+  depth_.assign(size + 1, -1);
+  is_target_.assign(size + 1, false);
+  std::vector<int> worklist;
+  auto visit = [&](int pc, int depth) {
+    if (pc < 0 || pc > size) {
+      return Status(INVALID_ARGUMENT, "Jump out of the chunk.");
+    }
+    if (depth_[pc] == -1) {
+      depth_[pc] = depth;
+      worklist.push_back(pc);
+    }
+    else if (depth_[pc] != depth) {
+      return Status(INVALID_ARGUMENT, "Inconsistent stack depth at " +
+                                          std::to_string(pc) + ".");
+    }
+    return Status();
+  };
+  Status status = visit(0, 0);
+  while (status.ok() && !worklist.empty()) {
+    int pc = worklist.back();
+    worklist.pop_back();
+    if (pc == size) {
+      continue;
+    }
+    uint8 opcode = OpcodeAt(chunk_, pc);
+    if (opcode >= OP_COUNT) {
+      return Status(INVALID_ARGUMENT, "Unknown opcode.");
+    }
+    int depth = depth_[pc] + StackEffect(chunk_, pc);
+    if (depth < 0 || depth > kRegisterCount) {
+      return Status(INVALID_ARGUMENT, "Stack depth out of range.");
+    }
+    if (opcode == OP_JUMP_IF_FALSE || opcode == OP_JUMP ||
+        opcode == OP_LOOP) {
+      int target = JumpTarget(chunk_, pc);
+      status.Update(visit(target, depth));
+      if (target <= size) {
+        is_target_[target] = true;
+      }
+      if (opcode != OP_JUMP_IF_FALSE) {
+        continue;
+      }
+    }
+    status.Update(visit(pc + InstLength(opcode), depth));
+  }
+  return status;
+}
+
+uint16 RegLowering::LiteralConstant(Value val, int* cache) {
+  if (*cache == -1) {
+    *cache = out_->AddConstant(val);
+  }
+  return Constant(*cache);
+}
+
+void RegLowering::Flush() {
+  // NOTE: a pending value only reads registers of lower slots that already
+  // hold their values, so storing them from the bottom up is safe.
+  for (size_t i = 0; i < vstack_.size(); i++) {
+    if (vstack_[i] != i) {
+      Emit(ROP_MOVE, i, vstack_[i]);
+      vstack_[i] = i;
+    }
+  }
+}
+
+void RegLowering::SpillReaders(uint16 reg) {
+  for (size_t i = 0; i < vstack_.size(); i++) {
+    if (i != reg && vstack_[i] == reg) {
+      Emit(ROP_MOVE, i, reg);
+      vstack_[i] = i;
+    }
+  }
+}
+
+Status RegLowering::LowerInst(int pc) {
+  uint8 opcode = OpcodeAt(chunk_, pc);
+  switch (opcode) {
+    case OP_RETURN: {
+      break;
+    }
+    case OP_CONSTANT: {
+      vstack_.push_back(Constant(chunk_.GetByte(pc + 1)));
+      break;
+    }
+    case OP_NIL: {
+      vstack_.push_back(LiteralConstant(XYXY_NIL, &nil_));
+      break;
+    }
+    case OP_TRUE: {
+      vstack_.push_back(LiteralConstant(Value(true), &true_));
+      break;
+    }
+    case OP_FALSE: {
+      vstack_.push_back(LiteralConstant(Value(false), &false_));
+      break;
+    }
+    case OP_NEGATE:
+    case OP_NOT: {
+      uint16 operand = Pop();
+      uint16 dst = vstack_.size();
+      Emit(opcode == OP_NEGATE ? ROP_NEGATE : ROP_NOT, dst, operand);
+      vstack_.push_back(dst);
+      break;
+    }
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_EQUAL:
+    case OP_GREATER:
+    case OP_LESS: {
+      uint8 rop = ROP_ADD;
+      switch (opcode) {
+        case OP_SUB:
+          rop = ROP_SUB;
+          break;
+        case OP_MUL:
+          rop = ROP_MUL;
+          break;
+        case OP_DIV:
+          rop = ROP_DIV;
+          break;
+        case OP_EQUAL:
+          rop = ROP_EQUAL;
+          break;
+        case OP_GREATER:
+          rop = ROP_GREATER;
+          break;
+        case OP_LESS:
+          rop = ROP_LESS;
+          break;
+      }
+      uint16 rhs = Pop();
+      uint16 lhs = Pop();
+      uint16 dst = vstack_.size();
+      Emit(rop, dst, lhs, rhs);
+      vstack_.push_back(dst);
+      break;
+    }
+    case OP_CONCAT: {
+      // Adds the operands one by one into the slot of the first, as the
+      // `OP_ADD`s it replaces, the other operands must not read it.
+      const int n = chunk_.GetByte(pc + 1);
+      uint16 dst = vstack_.size() - n;
+      SpillReaders(dst);
+      std::vector<uint16> operands(vstack_.end() - n, vstack_.end());
+      vstack_.resize(dst);
+      Emit(ROP_ADD, dst, operands[0], operands[1]);
+      for (int i = 2; i < n; i++) {
+        Emit(ROP_ADD, dst, dst, operands[i]);
+      }
+      vstack_.push_back(dst);
+      break;
+    }
+    case OP_PRINT: {
+      Emit(ROP_PRINT, 0, Pop());
+      break;
+    }
+    case OP_POP: {
+      Pop();
+      break;
+    }
+    case OP_DEFINE_GLOBAL: {
+      Emit(ROP_DEFINE_GLOBAL, Constant(chunk_.GetByte(pc + 1)), Pop());
+      break;
+    }
+    case OP_GET_GLOBAL: {
+      uint16 dst = vstack_.size();
+      Emit(ROP_GET_GLOBAL, dst, Constant(chunk_.GetByte(pc + 1)));
+      vstack_.push_back(dst);
+      break;
+    }
+    case OP_SET_GLOBAL: {
+      Emit(ROP_SET_GLOBAL, Constant(chunk_.GetByte(pc + 1)), vstack_.back());
+      break;
+    }
+    case OP_GET_LOCAL: {
+      vstack_.push_back(vstack_[chunk_.GetByte(pc + 1)]);
+      break;
+    }
+    case OP_SET_LOCAL: {
+      uint16 slot = chunk_.GetByte(pc + 1);
+      uint16 top = vstack_.size() - 1;
+      SpillReaders(slot);
+      int last = out_->size() - 1;
+      if (slot != top && vstack_[top] == top && last >= block_start_ &&
+          IsComputation(out_->GetInst(last).opcode) &&
+          out_->GetInst(last).a == top) {
+        // The value was just computed into the register of the top slot,
+        // let the inst store it into the local register directly.
+        out_->MutableInst(last)->a = slot;
+      }
+      else if (vstack_[top] != slot) {
+        Emit(ROP_MOVE, slot, vstack_[top]);
+      }
+      vstack_[slot] = slot;
+      vstack_[top] = slot;
+      break;
+    }
+    case OP_JUMP_IF_FALSE: {
+      Flush();
+      jumps_.push_back({out_->size(), JumpTarget(chunk_, pc)});
+      Emit(ROP_JUMP_IF_FALSE, 0, vstack_.back());
+      block_start_ = out_->size();
+      break;
+    }
+    case OP_JUMP:
+    case OP_LOOP: {
+      Flush();
+      jumps_.push_back({out_->size(), JumpTarget(chunk_, pc)});
+      Emit(ROP_JUMP, 0);
+      block_start_ = out_->size();
+      break;
+    }
+    default: {
+      return Status(UNIMPLEMENTED, "Unsupported opcode for register code.");
+    }
+  }
+  return Status();
+}
+
+Status RegLowering::Lower() {
+  Status status = ComputeDepths();
+  if (!status.ok()) {
+    return status;
+  }
+  // Constants keep their index in the chunk.
+  for (int i = 0; i < chunk_.NumConstants(); i++) {
+    out_->AddConstant(chunk_.GetConstant(i));
+  }
+  const int size = chunk_.size();
+  reg_pc_.assign(size + 1, -1);
+  for (int pc = 0; pc <= size;) {
+    if (depth_[pc] == -1) {
+      // Unreachable code, e.g. the rest of a loop body after `continue`.
+      pc += pc < size ? InstLength(OpcodeAt(chunk_, pc)) : 1;
+      continue;
+    }
+    if (is_target_[pc]) {
+      // Every value must be in its register when entering a basic block.
+      Flush();
+      vstack_.resize(depth_[pc]);
+      for (int i = 0; i < depth_[pc]; i++) {
+        vstack_[i] = i;
+      }
+      block_start_ = out_->size();
+    }
+    if (pc == size) {
+      Flush();
+      reg_pc_[pc] = out_->size();
+      break;
+    }
+    CHECK((int)vstack_.size() == depth_[pc]);
+    reg_pc_[pc] = out_->size();
+    status = LowerInst(pc);
+    if (!status.ok()) {
+      return status;
+    }
+    pc += InstLength(OpcodeAt(chunk_, pc));
+  }
+  for (auto& jump : jumps_) {
+    CHECK(reg_pc_[jump.second] != -1);
+    out_->MutableInst(jump.first)->a = reg_pc_[jump.second];
+  }
+  if (VLOG_IS_ON(2)) {
+    out_->DumpInsts();
+  }
+  return Status();
+}
+
+Status LowerToRegisters(const Chunk& chunk, RegChunk* out) {
+  RegLowering lowering(chunk, out);
+  return lowering.Lower();
+}
+
+RegisterVM::RegisterVM(const RegChunk* chunk)
+    : chunk_(chunk), regs_(kRegisterCount) {}
+
+Status RegisterVM::Run() {
+  Heap::Scope heap_scope(&heap_);
+  Value* regs = regs_.data();
+  const int size = chunk_->size();
+  std::vector<Value> constants(chunk_->NumConstants());
+  for (size_t i = 0; i < constants.size(); i++) {
+    constants[i] = chunk_->GetConstant(i);
+  }
+
+#define R(x) (regs[(x)])
+#define RK(x) \
+  ((x) < kRegisterCount ? regs[(x)] : constants[(x) - kRegisterCount])
+#define K(x) (constants[(x) - kRegisterCount])
+
+#define BINARY_OP(op)                                                \
+  {                                                                  \
+    Value lhs = RK(inst.b);                                          \
+    Value rhs = RK(inst.c);                                          \
+    if (!lhs.IsFloat()) {                                            \
+      return Status(RUNTIME_ERROR, "Unsupported binary operation."); \
+    }                                                                \
+    if (!rhs.IsFloat()) {                                            \
+      return Status(RUNTIME_ERROR, "Operand must be a number.");     \
+    }                                                                \
+    R(inst.a) = Value(lhs.AsFloat() op rhs.AsFloat());               \
+  }
+
+  while ((int)pc_ < size) {
+    const RegInst& inst = chunk_->GetInst(pc_++);
+    inst_count_++;
+    switch (inst.opcode) {
+      case ROP_MOVE: {
+        R(inst.a) = RK(inst.b);
+        break;
+      }
+      case ROP_NEGATE: {
+        Value val = RK(inst.b);
+        if (!val.IsFloat()) {
+          return Status(RUNTIME_ERROR, "Operand must be a number.");
+        }
+        R(inst.a) = Value(-val.AsFloat());
+        break;
+      }
+      case ROP_NOT: {
+        R(inst.a) = Value(RK(inst.b).IsFalsey());
+        break;
+      }
+      case ROP_ADD: {
+        Value rhs = RK(inst.c);
+        if (rhs.IsString()) {
+          Value lhs = RK(inst.b);
+          if (!lhs.IsString()) {
+            return Status(RUNTIME_ERROR, "Operand must be a string.");
+          }
+          R(inst.a) = Value::Concat(lhs, rhs);
+        }
+        else {
+          BINARY_OP(+);
+        }
+        break;
+      }
+      case ROP_SUB: {
+        BINARY_OP(-);
+        break;
+      }
+      case ROP_MUL: {
+        BINARY_OP(*);
+        break;
+      }
+      case ROP_DIV: {
+        BINARY_OP(/);
+        break;
+      }
+      case ROP_EQUAL: {
+        BINARY_OP(==);
+        break;
+      }
+      case ROP_GREATER: {
+        BINARY_OP(>);
+        break;
+      }
+      case ROP_LESS: {
+        BINARY_OP(<);
+        break;
+      }
+      case ROP_PRINT: {
+        final_print_ = RK(inst.b);
+        printed_ = true;
+        final_print_.PrintLine(stdout);
+        break;
+      }
+      case ROP_DEFINE_GLOBAL: {
+        global_.Insert(K(inst.a).ToString(), RK(inst.b));
+        break;
+      }
+      case ROP_GET_GLOBAL: {
+        Value val;
+        if (!global_.Find(K(inst.b).ToString(), &val)) {
+          // TODO(): Error handling
+          CHECK(false);
+        }
+        R(inst.a) = val;
+        break;
+      }
+      case ROP_SET_GLOBAL: {
+        string var_name = K(inst.a).ToString();
+        if (!global_.Find(var_name)) {
+          // TODO(): Error handling
+          CHECK(false);
+        }
+        global_.Insert(var_name, RK(inst.b));
+        break;
+      }
+      case ROP_JUMP: {
+        pc_ = inst.a;
+        break;
+      }
+      case ROP_JUMP_IF_FALSE: {
+        if (RK(inst.b).IsFalsey()) {
+          pc_ = inst.a;
+        }
+        break;
+      }
+      default: {
+        CHECK(false) << "Unkown register inst to run with pc: " << pc_ - 1;
+        break;
+      }
+    }
+  }
+
+#undef BINARY_OP
+#undef K
+#undef RK
+#undef R
+
+  return Status();
+}
+
+}  // namespace xyxy
@@ -0,0 +1,119 @@
+#ifndef XYXY_REGISTER_VM_H_
+#define XYXY_REGISTER_VM_H_
+
+#include <vector>
+
+#include "xyxy/chunk.h"
+#include "xyxy/hash_table.h"
+#include "xyxy/status.h"
+
+namespace xyxy {
+
+// Opcodes of the register based bytecode, every inst has up to three
+// operands `a`, `b` and `c`:
+//   R(x):  the register x.
+//   K(x):  the constant x.
+//   RK(x): the register x if x < kRegisterCount, otherwise the constant
+//          x - kRegisterCount.
+#define XYXY_REG_OPCODE_LIST(V)                          \
+  V(ROP_MOVE)          /* R(a) = RK(b)                */ \
+  V(ROP_NEGATE)        /* R(a) = -RK(b)               */ \
+  V(ROP_NOT)           /* R(a) = RK(b) is falsey      */ \
+  V(ROP_ADD)           /* R(a) = RK(b) + RK(c)        */ \
+  V(ROP_SUB)           /* R(a) = RK(b) - RK(c)        */ \
+  V(ROP_MUL)           /* R(a) = RK(b) * RK(c)        */ \
+  V(ROP_DIV)           /* R(a) = RK(b) / RK(c)        */ \
+  V(ROP_EQUAL)         /* R(a) = RK(b) == RK(c)       */ \
+  V(ROP_GREATER)       /* R(a) = RK(b) > RK(c)        */ \
+  V(ROP_LESS)          /* R(a) = RK(b) < RK(c)        */ \
+  V(ROP_PRINT)         /* print RK(b)                 */ \
+  V(ROP_DEFINE_GLOBAL) /* define global K(a) = RK(b)  */ \
+  V(ROP_GET_GLOBAL)    /* R(a) = global K(b)          */ \
+  V(ROP_SET_GLOBAL)    /* global K(a) = RK(b)         */ \
+  V(ROP_JUMP)          /* pc = a                      */ \
+  V(ROP_JUMP_IF_FALSE) /* if RK(b) is falsey, pc = a  */
+
+#define XYXY_REG_OPCODE_ENUM(opcode) opcode,
+
+typedef enum { XYXY_REG_OPCODE_LIST(XYXY_REG_OPCODE_ENUM) ROP_COUNT } RegOpCode;
+
+#undef XYXY_REG_OPCODE_ENUM
+
+// Stack slot i of the stack based VM is lowered to register i, so a local
+// variable lives in the register of its slot in `Compiler::locals_`.
+static const int kRegisterCount = STACK_SIZE;
+
+struct RegInst {
+  uint8 opcode;
+  uint32 a;
+  uint16 b;
+  uint16 c;
+};
+
+// A chunk of register based bytecode.
+class RegChunk {
+ public:
+  RegChunk() = default;
+  virtual ~RegChunk() = default;
+
+  void Write(RegInst inst) { code_.push_back(inst); }
+
+  const RegInst& GetInst(int index) const { return code_[index]; }
+  RegInst* MutableInst(int index) { return &code_[index]; }
+
+  int size() const { return code_.size(); }
+
+  int AddConstant(Value val);
+  Value GetConstant(int index) const { return constants_[index]; }
+  int NumConstants() const { return constants_.size(); }
+
+  void DumpInsts() const;
+
+ private:
+  std::vector<RegInst> code_;
+  std::vector<Value> constants_;
+};
+
+// Lowers the stack based bytecode of `chunk` into three address register
+// code stored in `out`. Values are kept in the register of the stack slot
+// they would live in, pushes of constants and locals are deferred until
+// their value is consumed, so most of `OP_CONSTANT`, `OP_GET_LOCAL` and
+// `OP_POP` disappear.
+Status LowerToRegisters(const Chunk& chunk, RegChunk* out);
+
+// Executes register based bytecode, the stack based `VM` is the reference
+// implementation that this one must behave the same as.
+class RegisterVM {
+ public:
+  explicit RegisterVM(const RegChunk* chunk);
+
+  virtual ~RegisterVM() = default;
+
+  Status Run();
+
+  std::string FinalResult() { return printed_ ? final_print_.ToString() : ""; }
+
+  hash_table<string, Value>& GetGlobal() { return global_; }
+
+  Value GetRegister(int index) { return regs_[index]; }
+
+  // Number of insts executed so far.
+  uint64 InstCount() { return inst_count_; }
+
+  // The objects allocated while running, freed along with the VM.
+  Heap* GetHeap() { return &heap_; }
+
+ private:
+  Value final_print_;
+  bool printed_ = false;
+  const RegChunk* chunk_;  // Not owned.
+  std::vector<Value> regs_;
+  hash_table<string, Value> global_;
+  Heap heap_;
+  uint32 pc_ = 0;
+  uint64 inst_count_ = 0;
+};
+
+}  // namespace xyxy
+
+#endif  // XYXY_REGISTER_VM_H_
@@ -0,0 +1,194 @@
+#include "xyxy/register_vm.h"
+
+#include "gtest/gtest.h"
+#include "xyxy/compiler.h"
+#include "xyxy/vm.h"
+
+namespace xyxy {
+
+// Returns the number of insts emitted by the compiler, i.e. superinsts count
+// as the insts they fuse.
+static int CountInsts(Chunk* chunk) {
+  int count = 0;
+  for (int pc = 0; pc < chunk->size();
+       pc += InstLength(BaseOpcode(chunk->GetByte(pc)))) {
+    count++;
+  }
+  return count;
+}
+
+// Runs `source` on both the stack VM and the register VM, and expects they
+// print the same result.
+#define XY_RUN_BOTH(source, result)                                     \
+  Compiler compiler;                                                    \
+  compiler.Compile(source);                                             \
+  VM vm(compiler.GetChunk());                                           \
+  EXPECT_TRUE(vm.Run().ok());                                           \
+  EXPECT_EQ(vm.FinalResult(), result);                                  \
+  RegChunk reg_chunk;                                                   \
+  EXPECT_TRUE(LowerToRegisters(*compiler.GetChunk(), &reg_chunk).ok()); \
+  RegisterVM reg_vm(&reg_chunk);                                        \
+  EXPECT_TRUE(reg_vm.Run().ok());                                       \
+  EXPECT_EQ(reg_vm.FinalResult(), result);
+
+TEST(Arithmetic, TestRegisterVM) {
+  XY_RUN_BOTH("print 1 + 2 * 10 - (2 + 3) * 6;", "-9")
+  // Constants are used as operands directly, only the 5 arithmetic insts and
+  // the print are left.
+  EXPECT_EQ(reg_chunk.size(), 6);
+}
+
+TEST(StringAdd, TestRegisterVM) {
+  XY_RUN_BOTH(R"(
+    var xy = "aaaa";
+    var xx = xy + "bbbb";
+    print xy;
+    print xx;
+  )",
+              "aaaabbbb")
+}
+
+TEST(Concat, TestRegisterVM) {
+  XY_RUN_BOTH(R"(
+    var a = "a";
+    {
+      var b = "b";
+      print a + "-" + b + "-" + a;
+    }
+  )",
+              "a-b-a")
+}
+
+TEST(Heap, TestRegisterVM) {
+  XY_RUN_BOTH(R"(
+    var a = "a long enough string";
+    print a + a;
+  )",
+              "a long enough stringa long enough string")
+  // The concatenation is allocated on the heap of the VM running it.
+  EXPECT_EQ(vm.GetHeap()->NumObjects(), 1);
+  EXPECT_EQ(reg_vm.GetHeap()->NumObjects(), 1);
+}
+
+TEST(Locals, TestRegisterVM) {
+  XY_RUN_BOTH(R"(
+    var g = 0; {
+      var a = 1; {
+        var b = 2; {
+          var c = 3;
+          g = g + c;
+        }
+        g = g + b;
+      }
+      var d = a;
+      a = 5;
+      g = g + a + d;
+    }
+    print g;
+  )",
+              "11")
+}
+
+TEST(LocalSwap, TestRegisterVM) {
+  // A pending read of a local must survive the local being overwritten.
+  XY_RUN_BOTH(R"(
+    {
+      var a = 1;
+      var b = 2;
+      var t = a;
+      a = b;
+      b = t;
+      print a * 10 + b;
+    }
+  )",
+              "21")
+}
+
+TEST(IfElse, TestRegisterVM) {
+  XY_RUN_BOTH(R"(
+    var a = 3;
+    if (a == 1) {
+      a = 2;
+    }
+    elif (a == 2) {
+      a = 3;
+    }
+    else if (a == 3 and !nil) {
+      a = 5;
+    }
+    else {
+      a = 4;
+    }
+    if (a > 9 or a >= 5) {
+      a = a + 1;
+    }
+    print a;
+  )",
+              "6")
+}
+
+TEST(ForBreakContinue, TestRegisterVM) {
+  XY_RUN_BOTH(R"(
+    var a = 0;
+    for (var i = 0; i < 100; i = i + 1) {
+      var b = "b";
+      if (a > 10) {
+        break;
+      }
+      for (var j = 0; j < 3; j = j + 1) {
+        var e = "e";
+        if (j > 1) {
+          continue;
+        }
+        a = a + 1;
+      }
+    }
+    print a;
+  )",
+              "12")
+}
+
+TEST(InstCount, TestRegisterVM) {
+  XY_RUN_BOTH(R"(
+    var a = 0;
+    for (var i = 0; i < 10; i = i + 1) {
+      for (var j = 0; j < 10; j = j + 1) {
+        var k = i * j;
+        a = a + k - 1;
+      }
+    }
+    print a;
+  )",
+              "1925")
+  EXPECT_LE(reg_chunk.size() * 2, CountInsts(compiler.GetChunk()));
+}
+
+TEST(Lowering, TestRegisterVM) {
+  Compiler compiler;
+  compiler.Compile(R"(
+    {
+      var a = 1;
+      a = a + 2;
+    }
+  )");
+  RegChunk reg_chunk;
+  EXPECT_TRUE(LowerToRegisters(*compiler.GetChunk(), &reg_chunk).ok());
+  // The local lives in R(0) and still holds the constant 1 when it is read,
+  // so the addition reads the constant and stores into R(0) directly.
+  ASSERT_EQ(reg_chunk.size(), 1);
+  EXPECT_EQ(reg_chunk.GetInst(0).opcode, ROP_ADD);
+  EXPECT_EQ(reg_chunk.GetInst(0).a, 0);
+  EXPECT_GE(reg_chunk.GetInst(0).b, kRegisterCount);
+  EXPECT_GE(reg_chunk.GetInst(0).c, kRegisterCount);
+}
+
+TEST(InvalidJump, TestRegisterVM) {
+  Chunk chunk;
+  chunk.Write(OP_JUMP, 1);
+  chunk.Write(0, 1);
+  chunk.Write(100, 1);
+  RegChunk reg_chunk;
+  EXPECT_FALSE(LowerToRegisters(chunk, &reg_chunk).ok());
+}
+
+}  // namespace xyxy
@@ -0,0 +1,72 @@
+#include "xyxy/runtime.h"
+
+#include "xyxy/logging.h"
+#include "xyxy/superinst.h"
+
+namespace xyxy {
+
+Runtime::Runtime(Chunk* chunk, int num_threads, const VMOptions& options)
+    : chunk_(chunk), options_(options) {
+  CHECK(num_threads > 0);
+  options_.quicken = false;
+  int count = Dequicken(chunk_);
+  LOGcc << "Dequickened " << count << " insts before sharing the chunk";
+  for (int i = 0; i < num_threads; i++) {
+    workers_.emplace_back([this] { WorkerLoop(); });
+  }
+}
+
+Runtime::~Runtime() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+std::future<JobResult> Runtime::Submit(Job job) {
+  std::packaged_task<JobResult(VM*)> task(
+      [job = std::move(job)](VM* vm) { return RunJob(vm, job); });
+  std::future<JobResult> result = task.get_future();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CHECK(!stopping_);
+    jobs_.push_back(std::move(task));
+  }
+  cv_.notify_one();
+  return result;
+}
+
+void Runtime::WorkerLoop() {
+  // Reset between the jobs rather than created for every job.
+  VM vm(chunk_, options_);
+  while (true) {
+    std::packaged_task<JobResult(VM*)> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+      if (jobs_.empty()) {
+        return;
+      }
+      task = std::move(jobs_.front());
+      jobs_.pop_front();
+    }
+    task(&vm);
+  }
+}
+
+JobResult Runtime::RunJob(VM* vm, const Job& job) {
+  vm->Reset();
+  for (const auto& global : job.globals) {
+    vm->GetGlobal().Insert(global.first, global.second);
+  }
+  JobResult result;
+  result.status = vm->Run();
+  result.final_result = vm->FinalResult();
+  return result;
+}
+
+}  // namespace xyxy
@@ -0,0 +1,67 @@
+#ifndef XYXY_RUNTIME_H_
+#define XYXY_RUNTIME_H_
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "xyxy/chunk.h"
+#include "xyxy/status.h"
+#include "xyxy/vm.h"
+
+namespace xyxy {
+
+// Input of a job run by `Runtime`, the globals defined before running the
+// chunk. Strings must outlive the job, the VM doesn't own them.
+struct Job {
+  std::vector<std::pair<std::string, Value>> globals;
+};
+
+struct JobResult {
+  Status status;
+  // The last value printed by the job, see `VM::FinalResult`.
+  std::string final_result;
+};
+
+// Runs jobs over one compiled chunk on a pool of worker threads. The chunk
+// is shared read only by all the workers, while every job runs on the VM of
+// its worker, i.e. its own stack, globals and heap, reset before every job.
+class Runtime {
+ public:
+  // Starts `num_threads` workers running `chunk`, not owned. The quickened
+  // insts of the chunk are turned back into generic ones and the VMs don't
+  // quicken, see `VMOptions::quicken`, so nothing else may run or modify
+  // the chunk while the runtime is alive.
+  Runtime(Chunk* chunk, int num_threads,
+          const VMOptions& options = VMOptions());
+
+  // Waits for the jobs already submitted, then stops the workers.
+  ~Runtime();
+
+  // Queues `job`, run by the first idle worker.
+  std::future<JobResult> Submit(Job job);
+
+  int NumThreads() const { return workers_.size(); }
+
+ private:
+  void WorkerLoop();
+  // Runs `job` on `vm`, the VM of the worker.
+  static JobResult RunJob(VM* vm, const Job& job);
+
+  Chunk* chunk_;  // Not owned.
+  VMOptions options_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::packaged_task<JobResult(VM*)>> jobs_;
+  bool stopping_ = false;
+  std::vector<std::thread> workers_;
+};
+
+}  // namespace xyxy
+
+#endif  // XYXY_RUNTIME_H_
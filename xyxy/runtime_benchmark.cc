@@ -0,0 +1,101 @@
+// Benchmarks how `Runtime` scales with its number of worker threads, every
+// job runs the same loop heavy script over the shared chunk, and how a
+// parallel `for` scales with the number of threads of the VM:
+//   bazel run -c opt //xyxy:runtime_benchmark
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "xyxy/compiler.h"
+#include "xyxy/runtime.h"
+
+namespace xyxy {
+
+static const char* kScript = R"(
+  var a = 0;
+  for (var i = 0; i < 100000; i = i + 1) {
+    a = a + i * seed;
+  }
+)";
+
+static const int kNumJobs = 256;
+
+// The same amount of work as all the jobs, in a single script.
+static const char* kParallelScript = R"(
+  var a = 0;
+  parallel for (var job = 0; job < 256; job = job + 1) reduce (a) {
+    for (var i = 0; i < 100000; i = i + 1) {
+      a = a + i * job;
+    }
+  }
+)";
+
+// Returns the time in milliseconds to run `kNumJobs` jobs on `num_threads`
+// workers.
+static double RunJobs(Chunk* chunk, int num_threads) {
+  auto start = std::chrono::steady_clock::now();
+  {
+    Runtime runtime(chunk, num_threads);
+    std::vector<std::future<JobResult>> results;
+    for (int i = 0; i < kNumJobs; i++) {
+      Job job;
+      job.globals.emplace_back("seed", Value(i));
+      results.push_back(runtime.Submit(std::move(job)));
+    }
+    for (auto& result : results) {
+      JobResult job_result = result.get();
+      CHECK(job_result.status.ok()) << job_result.status;
+    }
+  }
+  auto stop = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(stop - start).count();
+}
+
+// Returns the time in milliseconds to run `kParallelScript` with
+// `num_threads` threads.
+static double RunParallelFor(int num_threads) {
+  Compiler compiler;
+  compiler.Compile(kParallelScript);
+  auto start = std::chrono::steady_clock::now();
+  {
+    VMOptions options;
+    options.task_threads = num_threads - 1;
+    VM vm(compiler.GetChunk(), options);
+    Status status = vm.Run();
+    CHECK(status.ok()) << status;
+  }
+  auto stop = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(stop - start).count();
+}
+
+}  // namespace xyxy
+
+int main(int argc, char** argv) {
+  xyxy::Compiler compiler;
+  compiler.Compile(xyxy::kScript);
+  fprintf(stderr, "hardware threads: %u\n",
+          std::thread::hardware_concurrency());
+  fprintf(stderr, "%8s %13s %13s %9s\n", "threads", "time", "jobs/s",
+          "speedup");
+  double base = 0;
+  for (int threads = 1; threads <= 64; threads *= 2) {
+    double ms = xyxy::RunJobs(compiler.GetChunk(), threads);
+    if (threads == 1) {
+      base = ms;
+    }
+    fprintf(stderr, "%8d %10.3f ms %13.1f %8.2fx\n", threads, ms,
+            xyxy::kNumJobs * 1000 / ms, base / ms);
+  }
+  fprintf(stderr, "\nparallel for:\n%8s %13s %9s\n", "threads", "time",
+          "speedup");
+  for (int threads = 1; threads <= 64; threads *= 2) {
+    double ms = xyxy::RunParallelFor(threads);
+    if (threads == 1) {
+      base = ms;
+    }
+    fprintf(stderr, "%8d %10.3f ms %8.2fx\n", threads, ms, base / ms);
+  }
+  return 0;
+}
@@ -0,0 +1,84 @@
+#include "xyxy/runtime.h"
+
+#include "gtest/gtest.h"
+#include "xyxy/compiler.h"
+
+namespace xyxy {
+
+TEST(Jobs, TestRuntime) {
+  Compiler compiler;
+  compiler.Compile(R"(
+    var s = "s";
+    var a = 0;
+    for (var i = 0; i < n; i = i + 1) {
+      a = a + i;
+      s = s + "x";
+    }
+    print s;
+    print a;
+  )");
+  Chunk* chunk = compiler.GetChunk();
+  std::vector<uint8> code(chunk->code(), chunk->code() + chunk->size());
+
+  std::vector<std::future<JobResult>> results;
+  {
+    Runtime runtime(chunk, 4);
+    EXPECT_EQ(runtime.NumThreads(), 4);
+    for (int n = 0; n < 200; n++) {
+      Job job;
+      job.globals.emplace_back("n", Value(n % 50));
+      results.push_back(runtime.Submit(std::move(job)));
+    }
+  }
+  for (int n = 0; n < 200; n++) {
+    JobResult result = results[n].get();
+    EXPECT_TRUE(result.status.ok()) << result.status.ToString();
+    EXPECT_EQ(result.final_result, Value((n % 50) * (n % 50 - 1) / 2).ToString());
+  }
+  // Nothing was quickened.
+  EXPECT_EQ(std::vector<uint8>(chunk->code(), chunk->code() + chunk->size()),
+            code);
+}
+
+TEST(Error, TestRuntime) {
+  Compiler compiler;
+  compiler.Compile("print -x;");
+  Runtime runtime(compiler.GetChunk(), 2);
+  Job number;
+  number.globals.emplace_back("x", Value(1));
+  Job boolean;
+  boolean.globals.emplace_back("x", Value(true));
+  std::future<JobResult> ok = runtime.Submit(number);
+  std::future<JobResult> failed = runtime.Submit(boolean);
+  EXPECT_EQ(ok.get().final_result, "-1");
+  EXPECT_EQ(failed.get().status.error_message(), "Operand must be a number.");
+}
+
+TEST(Dequicken, TestRuntime) {
+  Compiler compiler;
+  compiler.Compile(R"(
+    var a = 1;
+    for (var i = 0; i < 3; i = i + 1) {
+      a = a * 2;
+    }
+    print a;
+  )");
+  Chunk* chunk = compiler.GetChunk();
+  {
+    VM vm(chunk);
+    testing::internal::CaptureStdout();
+    EXPECT_TRUE(vm.Run().ok());
+    testing::internal::GetCapturedStdout();
+  }
+  // The chunk ran quickened before, the runtime turns it back.
+  Runtime runtime(chunk, 1);
+  bool quickened = false;
+  for (int pc = 0; pc < chunk->size();
+       pc += InstLength(BaseOpcode(chunk->GetByte(pc)))) {
+    quickened |= chunk->GetByte(pc) == OP_MUL_NUM_NUM;
+  }
+  EXPECT_FALSE(quickened);
+  EXPECT_EQ(runtime.Submit(Job()).get().final_result, "8");
+}
+
+}  // namespace xyxy
@@ -105,12 +105,45 @@ TokenType Scanner::IdentifierType() {
       return CheckKeyword("nil", TOKEN_NIL);
     case 'o':
       return CheckKeyword("or", TOKEN_OR);
-    case 'p':
-      return CheckKeyword("print", TOKEN_PRINT);
-    case 'r':
-      return CheckKeyword("return", TOKEN_RETURN);
-    case 's':
-      return CheckKeyword("super", TOKEN_SUPER);
+    case 'p': {
+      char n = source_[start_ + 1];
+      switch (n) {
+        case 'a':
+          return CheckKeyword("parallel", TOKEN_PARALLEL);
+        case 'r':
+          return CheckKeyword("print", TOKEN_PRINT);
+        default:
+          break;
+      }
+      break;
+    }
+    case 'r': {
+      // The lexeme may be `r` alone, e.g. at the end of the source.
+      char n = current_ - start_ > 2 ? source_[start_ + 2] : '\0';
+      switch (n) {
+        case 'd':
+          return CheckKeyword("reduce", TOKEN_REDUCE);
+        case 't':
+          return CheckKeyword("return", TOKEN_RETURN);
+        default:
+          break;
+      }
+      break;
+    }
+    case 's': {
+      char n = source_[start_ + 1];
+      switch (n) {
+        case 'p':
+          return CheckKeyword("spawn", TOKEN_SPAWN);
+        case 'u':
+          return CheckKeyword("super", TOKEN_SUPER);
+        default:
+          break;
+      }
+      break;
+    }
+    case 'j':
+      return CheckKeyword("join", TOKEN_JOIN);
     case 'v':
       return CheckKeyword("var", TOKEN_VAR);
     case 'w':
@@ -129,7 +162,7 @@ TokenType Scanner::IdentifierType() {
       }
     }
     case 'e': {
-      char n = source_[start_ + 2];
+      char n = current_ - start_ > 2 ? source_[start_ + 2] : '\0';
       switch (n) {
         case 'i':
           return CheckKeyword("elif", TOKEN_ELIF);
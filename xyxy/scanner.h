@@ -55,6 +55,10 @@ enum TokenType {
   TOKEN_TRUE,      // "true"
   TOKEN_VAR,       // "var"
   TOKEN_WHILE,     // "while"
+  TOKEN_SPAWN,     // "spawn"
+  TOKEN_JOIN,      // "join"
+  TOKEN_PARALLEL,  // "parallel"
+  TOKEN_REDUCE,    // "reduce"
 
   TOKEN_NEWLINE,     // "\n"
   TOKEN_WHITESPACE,  // "white"
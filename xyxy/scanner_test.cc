@@ -90,6 +90,20 @@ TEST(Nil, TestScanner) {
   // EXPECT_TRUE(sc.AtEnd());
 }
 
+TEST(ShortIdentifier, TestScanner) {
+  // Identifiers shorter than the keywords starting with the same letters,
+  // the last one at the very end of the source.
+  string source = "print re + e + r";
+  Scanner sc(source);
+  EXPECT_TRUE(Compare(&sc, "print", Token{TOKEN_PRINT, 0, 5, 1}));
+  EXPECT_TRUE(Compare(&sc, "re", Token{TOKEN_IDENTIFIER, 6, 2, 1}));
+  EXPECT_TRUE(Compare(&sc, "+", Token{TOKEN_PLUS, 9, 1, 1}));
+  EXPECT_TRUE(Compare(&sc, "e", Token{TOKEN_IDENTIFIER, 11, 1, 1}));
+  EXPECT_TRUE(Compare(&sc, "+", Token{TOKEN_PLUS, 13, 1, 1}));
+  EXPECT_TRUE(Compare(&sc, "r", Token{TOKEN_IDENTIFIER, 15, 1, 1}));
+  EXPECT_TRUE(sc.AtEnd());
+}
+
 TEST(TokenEqual, TestToken) {
   Token a, b;
   EXPECT_TRUE(a == b);
@@ -0,0 +1,48 @@
+#include "xyxy/scheduler.h"
+
+#include "xyxy/logging.h"
+
+namespace xyxy {
+
+Scheduler::Scheduler(int64 slice) : slice_(slice) { CHECK(slice_ > 0); }
+
+int Scheduler::Spawn(Chunk* chunk, int priority) {
+  VMOptions options;
+  options.budget = slice_;
+  int id = threads_.size();
+  threads_.push_back(
+      Thread{std::make_unique<VM>(chunk, options), priority, false, Status()});
+  Enqueue(id);
+  return id;
+}
+
+void Scheduler::Enqueue(int id) {
+  runnable_.push(Entry{threads_[id].priority, seq_++, id});
+}
+
+int Scheduler::RunSlice() {
+  if (runnable_.empty()) {
+    return -1;
+  }
+  int id = runnable_.top().id;
+  runnable_.pop();
+  Thread& thread = threads_[id];
+  Status status = thread.vm->Run();
+  if (status.code() == RESOURCE_EXHAUSTED) {
+    // Preempted at a loop header, the next `Run` resumes from there.
+    Enqueue(id);
+  }
+  else {
+    LOGcc << "Thread " << id << " finished: " << status.ToString();
+    thread.finished = true;
+    thread.status = status;
+  }
+  return id;
+}
+
+void Scheduler::RunAll() {
+  while (RunSlice() != -1) {
+  }
+}
+
+}  // namespace xyxy
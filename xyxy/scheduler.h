@@ -0,0 +1,79 @@
+#ifndef XYXY_SCHEDULER_H_
+#define XYXY_SCHEDULER_H_
+
+#include <memory>
+#include <queue>
+#include <vector>
+
+#include "xyxy/chunk.h"
+#include "xyxy/status.h"
+#include "xyxy/vm.h"
+
+namespace xyxy {
+
+// Runs many scripts as green threads on the calling thread. Every thread is
+// a VM preempted after a slice of loop iterations, see `VMOptions::budget`,
+// and resumed at the header of the loop on its next turn. The runnable
+// thread with the highest priority runs next, threads of the same priority
+// take turns.
+class Scheduler {
+ public:
+  // `slice` is the number of loop iterations a thread runs per turn.
+  explicit Scheduler(int64 slice);
+
+  // Adds a thread running `chunk` from its start, returns the id of the
+  // thread. The chunk isn't owned and may be shared by many threads.
+  int Spawn(Chunk* chunk, int priority = 0);
+
+  // Runs one slice of the next thread, returns its id or -1 when every
+  // thread finished.
+  int RunSlice();
+
+  // Runs until every thread finished.
+  void RunAll();
+
+  int NumThreads() const { return threads_.size(); }
+  int NumRunnable() const { return runnable_.size(); }
+
+  // Returns true if the thread `id` reached the end of its chunk or stopped
+  // at an error.
+  bool Finished(int id) const { return threads_[id].finished; }
+
+  // Returns how the thread `id` finished, OK until then.
+  const Status& GetStatus(int id) const { return threads_[id].status; }
+
+  VM* GetVM(int id) { return threads_[id].vm.get(); }
+
+ private:
+  struct Thread {
+    std::unique_ptr<VM> vm;
+    int priority;
+    bool finished;
+    Status status;
+  };
+
+  // A runnable thread, ordered by priority then by when it was queued.
+  struct Entry {
+    int priority;
+    uint64 seq;
+    int id;
+
+    bool operator<(const Entry& other) const {
+      if (priority != other.priority) {
+        return priority < other.priority;
+      }
+      return seq > other.seq;
+    }
+  };
+
+  void Enqueue(int id);
+
+  const int64 slice_;
+  std::vector<Thread> threads_;
+  std::priority_queue<Entry> runnable_;
+  uint64 seq_ = 0;
+};
+
+}  // namespace xyxy
+
+#endif  // XYXY_SCHEDULER_H_
@@ -0,0 +1,90 @@
+#include "xyxy/scheduler.h"
+
+#include "gtest/gtest.h"
+#include "xyxy/compiler.h"
+
+namespace xyxy {
+
+static const char* kLoop = R"(
+  var a = 0;
+  for (var i = 0; i < 100; i = i + 1) {
+    a = a + i;
+  }
+  print a;
+)";
+
+TEST(RoundRobin, TestScheduler) {
+  Compiler compiler;
+  compiler.Compile(kLoop);
+  Scheduler scheduler(50);
+  EXPECT_EQ(scheduler.Spawn(compiler.GetChunk()), 0);
+  EXPECT_EQ(scheduler.Spawn(compiler.GetChunk()), 1);
+  EXPECT_EQ(scheduler.Spawn(compiler.GetChunk()), 2);
+  // Each thread jumps back 200 times, a slice stops at the 51st one, i.e. 4
+  // slices.
+  std::vector<int> order;
+  for (int id = scheduler.RunSlice(); id != -1; id = scheduler.RunSlice()) {
+    order.push_back(id);
+  }
+  ASSERT_EQ(order.size(), 12);
+  for (size_t i = 0; i < order.size(); i++) {
+    EXPECT_EQ(order[i], i % 3);
+  }
+  for (int id = 0; id < scheduler.NumThreads(); id++) {
+    EXPECT_TRUE(scheduler.Finished(id));
+    EXPECT_TRUE(scheduler.GetStatus(id).ok());
+    EXPECT_EQ(scheduler.GetVM(id)->FinalResult(), "4950");
+  }
+}
+
+TEST(Priority, TestScheduler) {
+  Compiler compiler;
+  compiler.Compile(kLoop);
+  Scheduler scheduler(50);
+  int low = scheduler.Spawn(compiler.GetChunk(), 0);
+  int high = scheduler.Spawn(compiler.GetChunk(), 1);
+  EXPECT_EQ(scheduler.RunSlice(), high);
+  while (!scheduler.Finished(high)) {
+    EXPECT_EQ(scheduler.RunSlice(), high);
+  }
+  EXPECT_EQ(scheduler.GetVM(low)->PC(), 0);
+  scheduler.RunAll();
+  EXPECT_TRUE(scheduler.Finished(low));
+  EXPECT_EQ(scheduler.NumRunnable(), 0);
+}
+
+TEST(Error, TestScheduler) {
+  Compiler loop;
+  loop.Compile(kLoop);
+  Compiler error;
+  error.Compile(R"(
+    for (var i = 0; i < 100; i = i + 1) {
+      if (i == 60) {
+        print -"a";
+      }
+    }
+  )");
+  Scheduler scheduler(10);
+  int ok = scheduler.Spawn(loop.GetChunk());
+  int failed = scheduler.Spawn(error.GetChunk());
+  scheduler.RunAll();
+  EXPECT_TRUE(scheduler.GetStatus(ok).ok());
+  EXPECT_EQ(scheduler.GetStatus(failed).code(), RUNTIME_ERROR);
+  EXPECT_EQ(scheduler.GetVM(ok)->FinalResult(), "4950");
+}
+
+TEST(ManyThreads, TestScheduler) {
+  Compiler compiler;
+  compiler.Compile(kLoop);
+  Scheduler scheduler(7);
+  for (int i = 0; i < 1000; i++) {
+    scheduler.Spawn(compiler.GetChunk(), i % 3);
+  }
+  scheduler.RunAll();
+  for (int id = 0; id < scheduler.NumThreads(); id++) {
+    EXPECT_TRUE(scheduler.GetStatus(id).ok());
+    EXPECT_EQ(scheduler.GetVM(id)->FinalResult(), "4950");
+  }
+}
+
+}  // namespace xyxy
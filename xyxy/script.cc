@@ -0,0 +1,28 @@
+#include "xyxy/script.h"
+
+namespace xyxy {
+
+Script::Script(const std::string& source, const VMOptions& options) {
+  compiler_.Compile(source);
+  vm_ = std::make_unique<VM>(compiler_.GetChunk(), options);
+}
+
+void Script::Bind(const std::string& name, Value val) {
+  for (auto& binding : bindings_) {
+    if (binding.first == name) {
+      binding.second = val;
+      return;
+    }
+  }
+  bindings_.emplace_back(name, val);
+}
+
+Status Script::Run() {
+  vm_->Reset();
+  for (const auto& binding : bindings_) {
+    vm_->GetGlobal().Insert(binding.first, binding.second);
+  }
+  return vm_->Run();
+}
+
+}  // namespace xyxy
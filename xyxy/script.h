@@ -0,0 +1,59 @@
+#ifndef XYXY_SCRIPT_H_
+#define XYXY_SCRIPT_H_
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "xyxy/compiler.h"
+#include "xyxy/status.h"
+#include "xyxy/vm.h"
+
+namespace xyxy {
+
+// A script compiled once and run many times, e.g. by a service embedding
+// xyxy once per call. The inputs are bound to globals defined before every
+// run, and the results are read back as values:
+//
+//   Script script("var y = x * 2 + 1;");
+//   script.Bind("x", Value(20));
+//   Status status = script.Run();
+//   Value y;
+//   script.GetGlobal("y", &y);
+//
+// Every run resets the same VM, see `VM::Reset`, rather than creating a new
+// one.
+class Script {
+ public:
+  // Compile errors are fatal, as with `Compiler`.
+  explicit Script(const std::string& source,
+                  const VMOptions& options = VMOptions());
+
+  // Defines the global `name` to `val` before every run from now on. A
+  // string must outlive the script, it isn't owned.
+  void Bind(const std::string& name, Value val);
+
+  // Runs the script over the bound globals, from a fresh state.
+  Status Run();
+
+  // The last value printed by the last run, nil if none. The values read
+  // from the script are only valid until the next run.
+  Value Result() { return vm_->FinalValue(); }
+
+  // Returns false if the last run didn't define `name`.
+  bool GetGlobal(const std::string& name, Value* val) {
+    return vm_->GetGlobal().Find(name, val);
+  }
+
+  VM* GetVM() { return vm_.get(); }
+
+ private:
+  Compiler compiler_;
+  std::unique_ptr<VM> vm_;
+  std::vector<std::pair<std::string, Value>> bindings_;
+};
+
+}  // namespace xyxy
+
+#endif  // XYXY_SCRIPT_H_
@@ -0,0 +1,124 @@
+#include "xyxy/script.h"
+
+#include "gtest/gtest.h"
+
+namespace xyxy {
+
+TEST(Bind, TestScript) {
+  Script script(R"(
+    var y = x * 2 + 1;
+    print y - 1;
+  )");
+  for (int x = 0; x < 5; x++) {
+    script.Bind("x", Value(x));
+    testing::internal::CaptureStdout();
+    Status status = script.Run();
+    testing::internal::GetCapturedStdout();
+    EXPECT_TRUE(status.ok()) << status.ToString();
+    EXPECT_EQ(script.Result(), Value(x * 2));
+    Value y;
+    EXPECT_TRUE(script.GetGlobal("y", &y));
+    EXPECT_EQ(y, Value(x * 2 + 1));
+  }
+  // Strings are bound as any other value, owned by the collector here.
+  Script greeting("print \"hi \" + name;");
+  greeting.Bind("name", Value(ObjString::New("xy")));
+  testing::internal::CaptureStdout();
+  EXPECT_TRUE(greeting.Run().ok());
+  testing::internal::GetCapturedStdout();
+  EXPECT_EQ(greeting.Result().AsString(), "hi xy");
+}
+
+TEST(Reset, TestScript) {
+  Script script(R"(
+    var s = "a";
+    var n = 0;
+    while (n < 10) {
+      s = s + "b";
+      n = n + 1;
+    }
+    print n;
+  )");
+  size_t num_objects = 0;
+  for (int i = 0; i < 3; i++) {
+    testing::internal::CaptureStdout();
+    EXPECT_TRUE(script.Run().ok());
+    testing::internal::GetCapturedStdout();
+    // Every run starts over from the same state.
+    EXPECT_EQ(script.Result(), Value(10));
+    Value s;
+    EXPECT_TRUE(script.GetGlobal("s", &s));
+    EXPECT_EQ(s.AsString(), "abbbbbbbbbb");
+    // The strings of the previous runs are freed.
+    if (i > 0) {
+      EXPECT_EQ(script.GetVM()->GetHeap()->NumObjects(), num_objects);
+    }
+    num_objects = script.GetVM()->GetHeap()->NumObjects();
+  }
+}
+
+TEST(Errors, TestScript) {
+  Script script(R"(
+    {
+      var a = 1;
+      print a + x;
+    }
+  )");
+  script.Bind("x", Value(true));
+  Status status = script.Run();
+  EXPECT_EQ(status.code(), RUNTIME_ERROR);
+  // Runs again from a clean stack.
+  script.Bind("x", Value(2));
+  testing::internal::CaptureStdout();
+  status = script.Run();
+  testing::internal::GetCapturedStdout();
+  EXPECT_TRUE(status.ok()) << status.ToString();
+  EXPECT_EQ(script.Result(), Value(3));
+  EXPECT_TRUE(script.GetVM()->GetStack().Empty());
+}
+
+TEST(Tiers, TestScript) {
+  const char* source = R"(
+    var a = 0;
+    for (var i = 0; i < 1000; i = i + 1) {
+      a = a + i * k;
+    }
+    print a;
+  )";
+  VMOptions trace;
+  trace.trace_jit = true;
+  VMOptions jit;
+  jit.jit = true;
+  VMOptions tasks;
+  tasks.task_threads = 1;
+  for (const VMOptions& options : {VMOptions(), trace, jit, tasks}) {
+    Script script(source, options);
+    for (int k = 1; k <= 3; k++) {
+      script.Bind("k", Value(k));
+      testing::internal::CaptureStdout();
+      Status status = script.Run();
+      testing::internal::GetCapturedStdout();
+      EXPECT_TRUE(status.ok()) << status.ToString();
+      EXPECT_EQ(script.Result(), Value(k * 499500));
+    }
+  }
+  // The tasks not joined are dropped by the reset.
+  Script spawning(R"(
+    {
+      var v = k;
+      var t = spawn { return v; };
+      var u = spawn { return v; };
+      print join t + 1;
+    }
+  )",
+                  tasks);
+  for (int k = 1; k <= 3; k++) {
+    spawning.Bind("k", Value(k));
+    testing::internal::CaptureStdout();
+    EXPECT_TRUE(spawning.Run().ok());
+    testing::internal::GetCapturedStdout();
+    EXPECT_EQ(spawning.Result(), Value(k + 1));
+  }
+}
+
+}  // namespace xyxy
@@ -0,0 +1,365 @@
+#include "xyxy/snapshot.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+
+#include "xyxy/logging.h"
+#include "xyxy/superinst.h"
+#include "xyxy/verifier.h"
+
+namespace xyxy {
+
+static const char kMagic[8] = {'X', 'Y', 'X', 'Y', 'I', 'M', 'G', '1'};
+
+enum ValueTag : uint8 {
+  TAG_BOOL,
+  TAG_NIL,
+  TAG_FLOAT,
+  TAG_STRING,
+};
+
+// Appends the values of a VM to an image, every string once.
+class ImageWriter {
+ public:
+  void PutU32(uint32 n) {
+    for (int i = 0; i < 4; i++) {
+      out_.push_back((n >> (8 * i)) & 0xff);
+    }
+  }
+
+  void PutBytes(const void* data, size_t size) {
+    const uint8* bytes = static_cast<const uint8*>(data);
+    out_.insert(out_.end(), bytes, bytes + size);
+  }
+
+  // Returns the index of `str` in the string table.
+  uint32 Intern(const std::string& str) {
+    auto it = indices_.find(str);
+    if (it != indices_.end()) {
+      return it->second;
+    }
+    uint32 index = strings_.size();
+    strings_.push_back(str);
+    indices_.emplace(str, index);
+    return index;
+  }
+
+  Status PutValue(Value val) {
+    if (val.IsBool()) {
+      out_.push_back(TAG_BOOL);
+      out_.push_back(val.AsBool());
+    }
+    else if (val.IsNil()) {
+      out_.push_back(TAG_NIL);
+    }
+    else if (val.IsFloat()) {
+      out_.push_back(TAG_FLOAT);
+      uint64 bits;
+      double number = val.AsFloat();
+      std::memcpy(&bits, &number, sizeof(bits));
+      PutU32(bits & 0xffffffff);
+      PutU32(bits >> 32);
+    }
+    else if (val.IsString()) {
+      out_.push_back(TAG_STRING);
+      PutU32(Intern(val.AsString()));
+    }
+    else {
+      return Status(UNIMPLEMENTED,
+                    "Can't save a " + val.ToString() + " into a snapshot.");
+    }
+    return Status();
+  }
+
+  // The image, i.e. the header and the string table before the values.
+  std::vector<uint8> Finish() {
+    ImageWriter head;
+    head.PutBytes(kMagic, sizeof(kMagic));
+    head.PutU32(OP_COUNT);
+    head.PutU32(strings_.size());
+    for (const std::string& str : strings_) {
+      head.PutU32(str.size());
+      head.PutBytes(str.data(), str.size());
+    }
+    head.out_.insert(head.out_.end(), out_.begin(), out_.end());
+    return std::move(head.out_);
+  }
+
+ private:
+  std::vector<uint8> out_;
+  std::vector<std::string> strings_;
+  std::unordered_map<std::string, uint32> indices_;
+};
+
+// Reads an image, every read fails once past its end.
+class ImageReader {
+ public:
+  ImageReader(const uint8* data, size_t size) : data_(data), size_(size) {}
+
+  bool GetU32(uint32* n) {
+    if (size_ - pos_ < 4) {
+      return false;
+    }
+    *n = 0;
+    for (int i = 0; i < 4; i++) {
+      *n |= uint32(data_[pos_++]) << (8 * i);
+    }
+    return true;
+  }
+
+  // Points `bytes` to the next `size` bytes of the image.
+  bool GetBytes(size_t size, const uint8** bytes) {
+    if (size_ - pos_ < size) {
+      return false;
+    }
+    *bytes = data_ + pos_;
+    pos_ += size;
+    return true;
+  }
+
+  bool GetValue(const std::vector<ObjString*>& strings, Value* val) {
+    const uint8* tag;
+    if (!GetBytes(1, &tag)) {
+      return false;
+    }
+    uint32 lo, hi;
+    switch (*tag) {
+      case TAG_BOOL: {
+        const uint8* b;
+        if (!GetBytes(1, &b) || *b > 1) {
+          return false;
+        }
+        *val = Value(*b == 1);
+        return true;
+      }
+      case TAG_NIL:
+        *val = Value();
+        return true;
+      case TAG_FLOAT: {
+        if (!GetU32(&lo) || !GetU32(&hi)) {
+          return false;
+        }
+        uint64 bits = (uint64(hi) << 32) | lo;
+        double number;
+        std::memcpy(&number, &bits, sizeof(number));
+        *val = Value(number);
+        return true;
+      }
+      case TAG_STRING:
+        if (!GetU32(&lo) || lo >= strings.size()) {
+          return false;
+        }
+        *val = Value(strings[lo]);
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  bool AtEnd() const { return pos_ == size_; }
+
+ private:
+  const uint8* data_;
+  size_t size_;
+  size_t pos_ = 0;
+};
+
+Status Snapshot::Save(VM* vm, const std::string& path) {
+  ImageWriter writer;
+  // The quickened insts depend on the values seen so far, save the generic
+  // ones.
+  Chunk chunk;
+  const Chunk& saved = *vm->GetChunk();
+  for (int i = 0; i < saved.size(); i++) {
+    chunk.Write(saved.GetByte(i));
+  }
+  Dequicken(&chunk);
+  writer.PutU32(chunk.size());
+  writer.PutBytes(chunk.code(), chunk.size());
+  writer.PutU32(saved.NumConstants());
+  for (int i = 0; i < saved.NumConstants(); i++) {
+    Status status = writer.PutValue(saved.GetConstant(i));
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  writer.PutU32(vm->PC());
+  ValueStack& stack = vm->GetStack();
+  writer.PutU32(stack.Size());
+  for (int i = 0; i < stack.Size(); i++) {
+    Status status = writer.PutValue(stack.Get(i));
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  std::vector<std::pair<std::string, Value>> globals;
+  vm->GetGlobal().ForEach([&globals](const std::string& name, Value val) {
+    globals.emplace_back(name, val);
+  });
+  writer.PutU32(globals.size());
+  for (auto& global : globals) {
+    writer.PutU32(writer.Intern(global.first));
+    Status status = writer.PutValue(global.second);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  std::vector<uint8> image = writer.Finish();
+  FILE* file = fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    return Status(NOT_FOUND, "Can't open " + path + ".");
+  }
+  size_t written = fwrite(image.data(), 1, image.size(), file);
+  if (fclose(file) != 0 || written != image.size()) {
+    return Status(INTERNAL, "Can't write " + path + ".");
+  }
+  LOGcc << "Saved " << globals.size() << " globals and " << stack.Size()
+        << " stack slots into " << image.size() << " bytes";
+  return Status();
+}
+
+Status Snapshot::Load(const std::string& path,
+                      std::unique_ptr<Snapshot>* out) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return Status(NOT_FOUND, "Can't open " + path + ".");
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return Status(INTERNAL, "Can't read " + path + ".");
+  }
+  size_t size = st.st_size;
+  void* data = nullptr;
+  if (size > 0) {
+    data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (data == MAP_FAILED) {
+    return Status(INTERNAL, "Can't map " + path + ".");
+  }
+  std::unique_ptr<Snapshot> snapshot(new Snapshot());
+  Status status = snapshot->Decode(static_cast<const uint8*>(data), size);
+  if (data) {
+    munmap(data, size);
+  }
+  if (status.ok()) {
+    *out = std::move(snapshot);
+  }
+  return status;
+}
+
+Status Snapshot::Decode(const uint8* data, size_t size) {
+  const Status corrupted(INVALID_ARGUMENT, "Corrupted snapshot.");
+  ImageReader reader(data, size);
+  const uint8* magic;
+  uint32 num_opcodes;
+  if (!reader.GetBytes(sizeof(kMagic), &magic) ||
+      std::memcmp(magic, kMagic, sizeof(kMagic)) != 0 ||
+      !reader.GetU32(&num_opcodes)) {
+    return corrupted;
+  }
+  if (num_opcodes != OP_COUNT) {
+    return Status(INVALID_ARGUMENT,
+                  "Snapshot saved by another version of the VM.");
+  }
+
+  uint32 count;
+  if (!reader.GetU32(&count)) {
+    return corrupted;
+  }
+  std::vector<ObjString*> strings;
+  for (uint32 i = 0; i < count; i++) {
+    uint32 length;
+    const uint8* bytes;
+    if (!reader.GetU32(&length) || !reader.GetBytes(length, &bytes)) {
+      return corrupted;
+    }
+    strings.push_back(
+        Intern(std::string(reinterpret_cast<const char*>(bytes), length)));
+  }
+
+  const uint8* code;
+  if (!reader.GetU32(&count) || !reader.GetBytes(count, &code)) {
+    return corrupted;
+  }
+  for (uint32 i = 0; i < count; i++) {
+    chunk_.Write(code[i]);
+  }
+  if (!reader.GetU32(&count)) {
+    return corrupted;
+  }
+  for (uint32 i = 0; i < count; i++) {
+    Value val;
+    if (!reader.GetValue(strings, &val)) {
+      return corrupted;
+    }
+    chunk_.AddConstant(val);
+  }
+
+  if (!reader.GetU32(&pc_) || !reader.GetU32(&count)) {
+    return corrupted;
+  }
+  for (uint32 i = 0; i < count; i++) {
+    Value val;
+    if (!reader.GetValue(strings, &val)) {
+      return corrupted;
+    }
+    stack_.push_back(val);
+  }
+
+  if (!reader.GetU32(&count)) {
+    return corrupted;
+  }
+  for (uint32 i = 0; i < count; i++) {
+    uint32 name;
+    Value val;
+    if (!reader.GetU32(&name) || name >= strings.size() ||
+        !reader.GetValue(strings, &val)) {
+      return corrupted;
+    }
+    globals_.emplace_back(strings[name]->str(), val);
+  }
+  if (!reader.AtEnd()) {
+    return corrupted;
+  }
+
+  // The chunk is run unchecked once built with `XYXY_UNCHECKED`, verify it
+  // along with the saved stack.
+  std::vector<int> depths;
+  Status status = VerifyChunk(chunk_, &depths);
+  if (!status.ok()) {
+    return status;
+  }
+  if (pc_ > (uint32)chunk_.size() || depths[pc_] != (int)stack_.size()) {
+    return corrupted;
+  }
+  return Status();
+}
+
+std::unique_ptr<VM> Snapshot::NewVM(const VMOptions& options) {
+  auto vm = std::make_unique<VM>(&chunk_, options);
+  vm->pc_ = pc_;
+  for (const Value& val : stack_) {
+    vm->stack_.Push(val);
+  }
+  RestoreGlobals(vm.get());
+  return vm;
+}
+
+void Snapshot::RestoreGlobals(VM* vm) {
+  for (const auto& global : globals_) {
+    vm->GetGlobal().Insert(global.first, global.second);
+  }
+}
+
+}  // namespace xyxy
@@ -0,0 +1,71 @@
+#ifndef XYXY_SNAPSHOT_H_
+#define XYXY_SNAPSHOT_H_
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "xyxy/chunk.h"
+#include "xyxy/object.h"
+#include "xyxy/status.h"
+#include "xyxy/vm.h"
+
+namespace xyxy {
+
+// The state of a VM saved into an image file once its initialization ran,
+// i.e. the compiled chunk, the pc, the stack and the globals, so that a new
+// VM can resume from there without compiling the source nor running the
+// initialization again.
+//
+// The image has a header with the version of the bytecode, then every
+// string reachable from the chunk, the stack and the globals once, and the
+// values referring to them by index:
+//   "XYXYIMG1" OP_COUNT:u32
+//   strings:   count:u32 (size:u32 bytes)*
+//   code:      size:u32 bytes
+//   constants: count:u32 value*
+//   pc:u32
+//   stack:     count:u32 value*
+//   globals:   count:u32 (name:u32 value)*
+// with a value being a tag byte followed by a bool byte, nothing for nil, 8
+// bytes for a number or the index of a string. Integers are little endian.
+// Values and strings aren't position independent, so the mapped image is
+// decoded once on load rather than used in place. The strings are interned,
+// see `Intern`, the names of the saved globals in particular.
+class Snapshot {
+ public:
+  // Saves the state of `vm` into `path`. The VM must not be running, nor
+  // have tasks on its stack or in its globals, which can't be saved.
+  static Status Save(VM* vm, const std::string& path);
+
+  // Loads the image saved at `path`, verifying its chunk.
+  static Status Load(const std::string& path, std::unique_ptr<Snapshot>* out);
+
+  // The saved chunk, without quickened insts.
+  Chunk* GetChunk() { return &chunk_; }
+
+  // Returns a VM resuming the saved one, i.e. running the saved chunk from
+  // the saved pc with a copy of its stack and globals. The chunk is shared
+  // by all the VMs, the snapshot must outlive them.
+  std::unique_ptr<VM> NewVM(const VMOptions& options = VMOptions());
+
+  // Defines the saved globals into `vm`, e.g. a VM running another chunk
+  // over the initialized state.
+  void RestoreGlobals(VM* vm);
+
+ private:
+  Snapshot() = default;
+
+  // Decodes the image `data` of `size` bytes.
+  Status Decode(const uint8* data, size_t size);
+
+  Chunk chunk_;
+  uint32 pc_ = 0;
+  std::vector<Value> stack_;
+  std::vector<std::pair<std::string, Value>> globals_;
+};
+
+}  // namespace xyxy
+
+#endif  // XYXY_SNAPSHOT_H_
@@ -0,0 +1,146 @@
+#include "xyxy/snapshot.h"
+
+#include <fstream>
+
+#include "gtest/gtest.h"
+#include "xyxy/compiler.h"
+
+namespace xyxy {
+
+static std::string ImagePath(const std::string& name) {
+  return testing::TempDir() + "/" + name + ".img";
+}
+
+TEST(Resume, TestSnapshot) {
+  const char* source = R"(
+    var name = "sum";
+    var total = 0;
+    {
+      var step = 3;
+      for (var i = 0; i < 1000; i = i + 1) {
+        total = total + i * step;
+      }
+      print name + " done";
+    }
+    print total;
+  )";
+  Compiler compiler;
+  compiler.Compile(source);
+  VMOptions options;
+  options.budget = 100;
+  VM vm(compiler.GetChunk(), options);
+  // Stops in the middle of the loop, with the locals of the block on the
+  // stack.
+  EXPECT_EQ(vm.Run().code(), RESOURCE_EXHAUSTED);
+  EXPECT_FALSE(vm.GetStack().Empty());
+  const std::string path = ImagePath("resume");
+  Status status = Snapshot::Save(&vm, path);
+  ASSERT_TRUE(status.ok()) << status.ToString();
+
+  std::unique_ptr<Snapshot> snapshot;
+  status = Snapshot::Load(path, &snapshot);
+  ASSERT_TRUE(status.ok()) << status.ToString();
+  EXPECT_EQ(snapshot->GetChunk()->size(), compiler.GetChunk()->size());
+  // Every VM resumes from the same state.
+  for (int i = 0; i < 2; i++) {
+    VMOptions resume_options;
+    resume_options.verify = true;
+    std::unique_ptr<VM> resumed = snapshot->NewVM(resume_options);
+    testing::internal::CaptureStdout();
+    status = resumed->Run();
+    std::string printed = testing::internal::GetCapturedStdout();
+    EXPECT_TRUE(status.ok()) << status.ToString();
+    EXPECT_NE(printed.find("sum done"), std::string::npos);
+    EXPECT_EQ(resumed->FinalResult(), Value(3 * 499500).ToString());
+    EXPECT_TRUE(resumed->GetStack().Empty());
+  }
+}
+
+TEST(RestoreGlobals, TestSnapshot) {
+  Compiler init;
+  init.Compile(R"(
+    var greeting = "hello";
+    var answer = 6 * 7;
+    var ready = true;
+    var missing = nil;
+  )");
+  VM vm(init.GetChunk());
+  ASSERT_TRUE(vm.Run().ok());
+  const std::string path = ImagePath("globals");
+  ASSERT_TRUE(Snapshot::Save(&vm, path).ok());
+  std::unique_ptr<Snapshot> snapshot;
+  ASSERT_TRUE(Snapshot::Load(path, &snapshot).ok());
+
+  // Another chunk run over the initialized globals.
+  Compiler compiler;
+  compiler.Compile(R"(
+    if (ready) {
+      print greeting + " world";
+    }
+    print answer + 1;
+  )");
+  VM other(compiler.GetChunk());
+  snapshot->RestoreGlobals(&other);
+  testing::internal::CaptureStdout();
+  Status status = other.Run();
+  std::string printed = testing::internal::GetCapturedStdout();
+  EXPECT_TRUE(status.ok()) << status.ToString();
+  EXPECT_NE(printed.find("hello world"), std::string::npos);
+  EXPECT_EQ(other.FinalResult(), Value(43).ToString());
+  EXPECT_TRUE(other.GetGlobal().FindValue("missing")->IsNil());
+}
+
+TEST(Corrupted, TestSnapshot) {
+  Compiler compiler;
+  compiler.Compile("var s = \"abc\"; print s;");
+  VM vm(compiler.GetChunk());
+  testing::internal::CaptureStdout();
+  ASSERT_TRUE(vm.Run().ok());
+  testing::internal::GetCapturedStdout();
+  const std::string path = ImagePath("corrupted");
+  ASSERT_TRUE(Snapshot::Save(&vm, path).ok());
+  std::string image;
+  {
+    std::ifstream in(path, std::ios::binary);
+    image.assign(std::istreambuf_iterator<char>(in),
+                 std::istreambuf_iterator<char>());
+  }
+  auto load = [&path](const std::string& bytes) {
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << bytes;
+    std::unique_ptr<Snapshot> snapshot;
+    Status status = Snapshot::Load(path, &snapshot);
+    EXPECT_EQ(snapshot == nullptr, !status.ok());
+    return status;
+  };
+  EXPECT_TRUE(load(image).ok());
+  // Every truncated image is rejected.
+  for (size_t size = 0; size < image.size(); size++) {
+    EXPECT_EQ(load(image.substr(0, size)).code(), INVALID_ARGUMENT) << size;
+  }
+  EXPECT_EQ(load(image + "x").code(), INVALID_ARGUMENT);
+  std::string other_magic = image;
+  other_magic[0] = 'Z';
+  EXPECT_EQ(load(other_magic).error_message(), "Corrupted snapshot.");
+  // A different number of opcodes.
+  std::string other_version = image;
+  other_version[8]++;
+  EXPECT_EQ(load(other_version).code(), INVALID_ARGUMENT);
+
+  std::unique_ptr<Snapshot> snapshot;
+  EXPECT_EQ(Snapshot::Load(ImagePath("not_saved"), &snapshot).code(),
+            NOT_FOUND);
+}
+
+TEST(Tasks, TestSnapshot) {
+  Compiler compiler;
+  compiler.Compile("var t = spawn { return 1; }; print join t;");
+  VMOptions options;
+  options.task_threads = 0;
+  VM vm(compiler.GetChunk(), options);
+  testing::internal::CaptureStdout();
+  ASSERT_TRUE(vm.Run().ok());
+  testing::internal::GetCapturedStdout();
+  EXPECT_EQ(Snapshot::Save(&vm, ImagePath("tasks")).code(), UNIMPLEMENTED);
+}
+
+}  // namespace xyxy
@@ -7,7 +7,10 @@
 
 namespace xyxy {
 
-template <class T, int N>
+// A fixed size stack. With `kChecked` false, pushing onto a full stack and
+// popping an empty one aren't checked even in debug builds, for callers that
+// know the maximum depth beforehand.
+template <class T, int N, bool kChecked = true>
 class Stack {
  public:
   Stack() {
@@ -28,32 +31,39 @@ class Stack {
   bool Empty() { return top_ == stk_; }
 
   void Push(const T& value) {
-    assert(!Full());
+    assert(!kChecked || !Full());
     *top_++ = value;
   }
 
   T Get(int idx) {
-    assert(idx < N);
+    assert(!kChecked || idx < N);
     return *(stk_ + idx);
   }
 
   int Size() { return top_ - stk_; }
 
+  // Drops all the values at once, they aren't destroyed.
+  void Clear() { top_ = stk_; }
+
   void Set(int idx, const T& val) {
-    assert(idx < N);
+    assert(!kChecked || idx < N);
     *(stk_ + idx) = val;
   }
 
   T Pop() {
-    assert(!Empty());
+    assert(!kChecked || !Empty());
     return *(--top_);
   }
 
   T Top() {
-    assert(!Empty());
+    assert(!kChecked || !Empty());
     return *(top_ - 1);
   }
 
+  // Raw access for the JIT, which keeps the top pointer in a register.
+  T* Data() { return stk_; }
+  T** MutableTop() { return &top_; }
+
  private:
   T* stk_;
   T* top_;
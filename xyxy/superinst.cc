@@ -0,0 +1,204 @@
+#include "xyxy/superinst.h"
+
+#include <algorithm>
+#include <initializer_list>
+
+#include "xyxy/logging.h"
+#include "xyxy/vm.h"
+
+namespace xyxy {
+
+static const char* OpcodeName(uint8 opcode) {
+#define XYXY_OPCODE_NAME(opcode, length) #opcode,
+  static const char* kNames[] = {XYXY_OPCODE_LIST(XYXY_OPCODE_NAME)};
+#undef XYXY_OPCODE_NAME
+  return opcode < OP_COUNT ? kNames[opcode] : "OP_UNKNOWN";
+}
+
+// Returns true if the insts starting at `pc` have the opcodes `seq`. The
+// first opcode is the one the caller matched, the chunk may already have
+// the superinst there.
+static bool MatchInsts(const Chunk& chunk, int pc,
+                       std::initializer_list<uint8> seq) {
+  const int start = pc;
+  for (uint8 opcode : seq) {
+    if (pc + InstLength(opcode) > chunk.size() ||
+        (pc != start && BaseOpcode(chunk.GetByte(pc)) != opcode)) {
+      return false;
+    }
+    pc += InstLength(opcode);
+  }
+  return true;
+}
+
+// Returns the superinst fusing the insts starting at `pc` with `opcode`
+// first, or `opcode` if there is none. Longer sequences are preferred.
+static uint8 MatchSuperInst(const Chunk& chunk, int pc, uint8 opcode) {
+  switch (opcode) {
+    case OP_GET_LOCAL:
+      // `slot = slot + constant;`
+      if (MatchInsts(chunk, pc, {OP_GET_LOCAL, OP_CONSTANT, OP_ADD,
+                                 OP_SET_LOCAL, OP_POP}) &&
+          chunk.GetByte(pc + 1) == chunk.GetByte(pc + 6)) {
+        return OP_INC_LOCAL;
+      }
+      break;
+    case OP_GET_GLOBAL:
+      // `name = name + constant;`
+      if (MatchInsts(chunk, pc, {OP_GET_GLOBAL, OP_CONSTANT, OP_ADD,
+                                 OP_SET_GLOBAL, OP_POP}) &&
+          chunk.GetConstant(chunk.GetByte(pc + 1)).ToString() ==
+              chunk.GetConstant(chunk.GetByte(pc + 6)).ToString()) {
+        return OP_INC_GLOBAL;
+      }
+      break;
+    case OP_CONSTANT:
+      // The condition of a loop or branch, e.g. `i < 100`.
+      if (MatchInsts(chunk, pc,
+                     {OP_CONSTANT, OP_LESS, OP_JUMP_IF_FALSE, OP_POP})) {
+        return OP_TEST_LESS_CONST;
+      }
+      if (MatchInsts(chunk, pc,
+                     {OP_CONSTANT, OP_GREATER, OP_JUMP_IF_FALSE, OP_POP})) {
+        return OP_TEST_GREATER_CONST;
+      }
+      break;
+    case OP_EQUAL:
+      if (MatchInsts(chunk, pc, {OP_EQUAL, OP_NOT})) {
+        return OP_NOT_EQUAL;
+      }
+      break;
+    case OP_LESS:
+      if (MatchInsts(chunk, pc, {OP_LESS, OP_NOT})) {
+        return OP_GREATER_EQUAL;
+      }
+      break;
+    case OP_GREATER:
+      if (MatchInsts(chunk, pc, {OP_GREATER, OP_NOT})) {
+        return OP_LESS_EQUAL;
+      }
+      break;
+    case OP_JUMP_IF_FALSE:
+      if (MatchInsts(chunk, pc, {OP_JUMP_IF_FALSE, OP_POP})) {
+        return OP_JUMP_IF_FALSE_POP;
+      }
+      break;
+    case OP_SET_LOCAL:
+      if (MatchInsts(chunk, pc, {OP_SET_LOCAL, OP_POP})) {
+        return OP_SET_LOCAL_POP;
+      }
+      break;
+    case OP_SET_GLOBAL:
+      if (MatchInsts(chunk, pc, {OP_SET_GLOBAL, OP_POP})) {
+        return OP_SET_GLOBAL_POP;
+      }
+      break;
+    default:
+      break;
+  }
+  return opcode;
+}
+
+int FuseSuperInsts(Chunk* chunk) {
+  int count = 0;
+  for (int pc = 0; pc < chunk->size();) {
+    uint8 opcode = chunk->GetByte(pc);
+    if (opcode >= OP_COUNT) {
+      break;
+    }
+    uint8 fused = MatchSuperInst(*chunk, pc, opcode);
+    if (fused != opcode) {
+      LOGcc << "Fuse superinst at " << pc << ": " << OpcodeName(fused);
+      chunk->WriteAt(pc, fused);
+      count++;
+    }
+    pc += InstLength(fused);
+  }
+  return count;
+}
+
+bool IsValidSuperInst(const Chunk& chunk, int pc) {
+  uint8 opcode = chunk.GetByte(pc);
+  return MatchSuperInst(chunk, pc, BaseOpcode(opcode)) == opcode;
+}
+
+static bool IsQuickened(uint8 opcode) {
+#define XYXY_QUICKENED_OPCODE(opcode, length) opcode,
+  static const uint8 kQuickened[] = {XYXY_QUICKENED_LIST(XYXY_QUICKENED_OPCODE)};
+#undef XYXY_QUICKENED_OPCODE
+  return std::find(std::begin(kQuickened), std::end(kQuickened), opcode) !=
+         std::end(kQuickened);
+}
+
+int Dequicken(Chunk* chunk) {
+  int count = 0;
+  // Also walks through the insts fused by superinsts, which may have been
+  // quickened on their own.
+  for (int pc = 0; pc < chunk->size();
+       pc += InstLength(BaseOpcode(chunk->GetByte(pc)))) {
+    uint8 opcode = chunk->GetByte(pc);
+    if (IsQuickened(opcode)) {
+      chunk->WriteAt(pc, BaseOpcode(opcode));
+      count++;
+    }
+  }
+  return count;
+}
+
+OpcodeProfile::OpcodeProfile()
+    : pairs_(OP_COUNT * OP_COUNT), triples_(OP_COUNT * OP_COUNT * OP_COUNT) {}
+
+void OpcodeProfile::Record(const uint8* ip) {
+  if (prev_ && prev_ + InstLength(*prev_) == ip) {
+    pairs_[*prev_ * OP_COUNT + *ip]++;
+    if (prev2_ && prev2_ + InstLength(*prev2_) == prev_) {
+      triples_[(*prev2_ * OP_COUNT + *prev_) * OP_COUNT + *ip]++;
+    }
+  }
+  else {
+    prev_ = nullptr;
+  }
+  prev2_ = prev_;
+  prev_ = ip;
+}
+
+uint64 OpcodeProfile::PairCount(uint8 first, uint8 second) const {
+  return pairs_[first * OP_COUNT + second];
+}
+
+uint64 OpcodeProfile::TripleCount(uint8 first, uint8 second,
+                                  uint8 third) const {
+  return triples_[(first * OP_COUNT + second) * OP_COUNT + third];
+}
+
+std::string OpcodeProfile::Report(int top) const {
+  std::string ret;
+  auto report = [&](const std::vector<uint64>& counts, int n) {
+    std::vector<int> order(counts.size());
+    for (size_t i = 0; i < order.size(); i++) {
+      order[i] = i;
+    }
+    std::sort(order.begin(), order.end(),
+              [&](int a, int b) { return counts[a] > counts[b]; });
+    for (int i = 0; i < top && i < (int)order.size(); i++) {
+      int index = order[i];
+      if (counts[index] == 0) {
+        break;
+      }
+      std::string seq;
+      for (int j = 0; j < n; j++) {
+        seq = std::string(OpcodeName(index % OP_COUNT)) +
+              (seq.empty() ? "" : " ") + seq;
+        index /= OP_COUNT;
+      }
+      ret += std::to_string(counts[order[i]]) + " " + seq + "\n";
+    }
+  };
+  ret += "--- pairs ---\n";
+  report(pairs_, 2);
+  ret += "--- triples ---\n";
+  report(triples_, 3);
+  return ret;
+}
+
+}  // namespace xyxy
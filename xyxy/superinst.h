@@ -0,0 +1,53 @@
+#ifndef XYXY_SUPERINST_H_
+#define XYXY_SUPERINST_H_
+
+#include <string>
+#include <vector>
+
+#include "xyxy/chunk.h"
+
+namespace xyxy {
+
+// Rewrites the sequences of insts listed in `XYXY_SUPERINST_LIST` into their
+// superinsts, returns the number of superinsts written. Only the first
+// opcode of a sequence is rewritten, so jumps into the middle of a sequence
+// still land on the original insts. Superinsts already in `chunk` are kept,
+// so this can run again after more code is appended.
+int FuseSuperInsts(Chunk* chunk);
+
+// Returns true if the superinst at `pc` is followed by the insts it fuses.
+bool IsValidSuperInst(const Chunk& chunk, int pc);
+
+// Rewrites the quickened insts of `chunk` back into their generic opcode,
+// see `XYXY_QUICKENED_LIST`, returns the number of insts rewritten. Used
+// before sharing a chunk with VMs which don't quicken.
+int Dequicken(Chunk* chunk);
+
+// Counts the opcode pairs and triples executed by the VM, only sequences
+// that fall through from one inst to the next are counted since a
+// superinstruction can't span a jump. Used to pick which sequences are worth
+// to be fused, build with `-DXYXY_PROFILE_OPCODES` to enable it in the VM.
+class OpcodeProfile {
+ public:
+  OpcodeProfile();
+  virtual ~OpcodeProfile() = default;
+
+  // Records the execution of the inst at `ip`.
+  void Record(const uint8* ip);
+
+  uint64 PairCount(uint8 first, uint8 second) const;
+  uint64 TripleCount(uint8 first, uint8 second, uint8 third) const;
+
+  // Returns the `top` most executed pairs and triples, one per line.
+  std::string Report(int top) const;
+
+ private:
+  std::vector<uint64> pairs_;
+  std::vector<uint64> triples_;
+  const uint8* prev_ = nullptr;
+  const uint8* prev2_ = nullptr;
+};
+
+}  // namespace xyxy
+
+#endif  // XYXY_SUPERINST_H_
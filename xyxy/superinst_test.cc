@@ -0,0 +1,104 @@
+#include "xyxy/superinst.h"
+
+#include "gtest/gtest.h"
+#include "xyxy/compiler.h"
+#include "xyxy/vm.h"
+
+namespace xyxy {
+
+// Returns the number of times `opcode` appears as an inst of `chunk`.
+static int CountOpcode(Chunk* chunk, uint8 opcode) {
+  int count = 0;
+  for (int pc = 0; pc < chunk->size(); pc += InstLength(chunk->GetByte(pc))) {
+    count += chunk->GetByte(pc) == opcode;
+  }
+  return count;
+}
+
+TEST(Fuse, TestSuperInst) {
+  Compiler compiler;
+  compiler.Compile(R"(
+    var a = 0;
+    for (var i = 0; i < 1000; i = i + 1) {
+      a = a + 2;
+      if (a != 10 and a >= 4) {
+        a = a + 1;
+      }
+    }
+    print a;
+  )");
+  Chunk* chunk = compiler.GetChunk();
+  EXPECT_EQ(CountOpcode(chunk, OP_INC_LOCAL), 1);
+  EXPECT_EQ(CountOpcode(chunk, OP_INC_GLOBAL), 2);
+  EXPECT_EQ(CountOpcode(chunk, OP_TEST_LESS_CONST), 1);
+  EXPECT_EQ(CountOpcode(chunk, OP_NOT_EQUAL), 1);
+  EXPECT_EQ(CountOpcode(chunk, OP_GREATER_EQUAL), 1);
+  // Superinsts are left alone by another pass.
+  EXPECT_EQ(FuseSuperInsts(chunk), 0);
+
+  VM vm(chunk);
+  EXPECT_TRUE(vm.Run().ok());
+  EXPECT_EQ(vm.FinalResult(), "2998");
+  EXPECT_TRUE(vm.GetStack().Empty());
+}
+
+TEST(BaseOpcode, TestSuperInst) {
+  EXPECT_EQ(BaseOpcode(OP_ADD), OP_ADD);
+  EXPECT_EQ(BaseOpcode(OP_INC_LOCAL), OP_GET_LOCAL);
+  EXPECT_EQ(BaseOpcode(OP_TEST_GREATER_CONST), OP_CONSTANT);
+  EXPECT_EQ(InstLength(OP_INC_LOCAL),
+            InstLength(OP_GET_LOCAL) + InstLength(OP_CONSTANT) +
+                InstLength(OP_ADD) + InstLength(OP_SET_LOCAL) +
+                InstLength(OP_POP));
+}
+
+TEST(Fallback, TestSuperInst) {
+  // The increments are fused but the operands are strings.
+  Compiler compiler;
+  compiler.Compile(R"(
+    var g = "a";
+    g = g + "b";
+    {
+      var l = g;
+      l = l + "c";
+      print l;
+    }
+  )");
+  EXPECT_EQ(CountOpcode(compiler.GetChunk(), OP_INC_GLOBAL), 1);
+  EXPECT_EQ(CountOpcode(compiler.GetChunk(), OP_INC_LOCAL), 1);
+  VM vm(compiler.GetChunk());
+  EXPECT_TRUE(vm.Run().ok());
+  EXPECT_EQ(vm.FinalResult(), "abc");
+}
+
+TEST(FallbackError, TestSuperInst) {
+  Compiler compiler;
+  compiler.Compile(R"(
+    if ("a" < 1) {
+      print 1;
+    }
+  )");
+  EXPECT_EQ(CountOpcode(compiler.GetChunk(), OP_TEST_LESS_CONST), 1);
+  VM vm(compiler.GetChunk());
+  Status status = vm.Run();
+  EXPECT_FALSE(status.ok());
+  EXPECT_EQ(status.error_message(), "Unsupported binary operation.");
+}
+
+TEST(Profile, TestSuperInst) {
+  const uint8 code[] = {OP_CONSTANT, 0, OP_CONSTANT, 1, OP_ADD, OP_POP};
+  OpcodeProfile profile;
+  profile.Record(code);
+  profile.Record(code + 2);
+  profile.Record(code + 4);
+  profile.Record(code + 5);
+  // A jump back to the start doesn't count as a sequence.
+  profile.Record(code);
+  EXPECT_EQ(profile.PairCount(OP_CONSTANT, OP_CONSTANT), 1);
+  EXPECT_EQ(profile.PairCount(OP_CONSTANT, OP_ADD), 1);
+  EXPECT_EQ(profile.PairCount(OP_POP, OP_CONSTANT), 0);
+  EXPECT_EQ(profile.TripleCount(OP_CONSTANT, OP_CONSTANT, OP_ADD), 1);
+  EXPECT_EQ(profile.TripleCount(OP_CONSTANT, OP_ADD, OP_POP), 1);
+}
+
+}  // namespace xyxy
@@ -0,0 +1,117 @@
+#include "xyxy/task.h"
+
+#include "xyxy/vm.h"
+
+namespace xyxy {
+
+ObjTask::ObjTask(std::unique_ptr<VM> vm)
+    : Object(ObjType::OBJ_TASK), vm_(std::move(vm)) {}
+
+ObjTask::~ObjTask() = default;
+
+void FreeTask(Object* task) { delete static_cast<ObjTask*>(task); }
+
+void ObjTask::Run() {
+  // The body stops at its `OP_TASK_END`, with the result on top.
+  status_ = vm_->Run();
+  if (status_.ok()) {
+    // The joining threads may read the result at once.
+    vm_->GetStack().Top().FlattenString();
+  }
+  done_.store(true, std::memory_order_release);
+}
+
+Value ObjTask::Result() {
+  assert(Done() && status_.ok());
+  return vm_->GetStack().Top();
+}
+
+// The pool and the deque of the calling thread, set on the threads of a
+// pool only.
+struct TaskThread {
+  const TaskPool* pool = nullptr;
+  int self = 0;
+};
+
+static thread_local TaskThread task_thread;
+
+TaskPool::TaskPool(int num_threads) {
+  CHECK(num_threads >= 0);
+  for (int i = 0; i <= num_threads; i++) {
+    deques_.push_back(std::make_unique<WorkStealingDeque<ObjTask*>>());
+  }
+  for (int i = 1; i <= num_threads; i++) {
+    threads_.emplace_back([this, i] { WorkerLoop(i); });
+  }
+}
+
+TaskPool::~TaskPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+int TaskPool::Self() const {
+  return task_thread.pool == this ? task_thread.self : 0;
+}
+
+void TaskPool::Push(ObjTask* task) {
+  deques_[Self()]->Push(task);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_++;
+  }
+  cv_.notify_one();
+}
+
+ObjTask* TaskPool::Take(int self) {
+  ObjTask* task = deques_[self]->Pop();
+  // Steals from the next deques in turn, so that the thieves don't all
+  // start with the same victim.
+  const int num_deques = deques_.size();
+  for (int i = 1; task == nullptr && i < num_deques; i++) {
+    task = deques_[(self + i) % num_deques]->Steal();
+  }
+  if (task) {
+    pending_--;
+  }
+  return task;
+}
+
+void TaskPool::Wait(ObjTask* task) {
+  const int self = Self();
+  while (!task->Done()) {
+    ObjTask* other = Take(self);
+    if (other) {
+      other->Run();
+    }
+    else {
+      // The task runs on another thread.
+      std::this_thread::yield();
+    }
+  }
+}
+
+void TaskPool::WorkerLoop(int self) {
+  task_thread.pool = this;
+  task_thread.self = self;
+  while (true) {
+    ObjTask* task = Take(self);
+    if (task) {
+      task->Run();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return stopping_ || pending_ > 0; });
+    if (stopping_) {
+      return;
+    }
+  }
+}
+
+}  // namespace xyxy
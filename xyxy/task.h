@@ -0,0 +1,204 @@
+#ifndef XYXY_TASK_H_
+#define XYXY_TASK_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "xyxy/base.h"
+#include "xyxy/logging.h"
+#include "xyxy/object.h"
+#include "xyxy/status.h"
+#include "xyxy/type.h"
+
+namespace xyxy {
+
+class VM;
+
+// The work stealing deque of Chase and Lev, "Dynamic Circular Work-Stealing
+// Deque" (SPAA 2005), with the memory orders of Lê et al. (PPoPP 2013). The
+// owner thread pushes and pops at the bottom, any other thread steals from
+// the top. `T` is a pointer, null meaning nothing was taken.
+template <class T>
+class WorkStealingDeque {
+ public:
+  explicit WorkStealingDeque(int64 capacity = 64) {
+    CHECK(capacity > 0 && (capacity & (capacity - 1)) == 0);
+    arrays_.push_back(std::make_unique<Array>(capacity));
+    array_.store(arrays_.back().get(), std::memory_order_relaxed);
+  }
+
+  // Owner only.
+  void Push(T item) {
+    int64 bottom = bottom_.load(std::memory_order_relaxed);
+    int64 top = top_.load(std::memory_order_acquire);
+    Array* array = array_.load(std::memory_order_relaxed);
+    if (bottom - top > array->capacity - 1) {
+      array = Grow(array, top, bottom);
+    }
+    array->Put(bottom, item);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(bottom + 1, std::memory_order_release);
+  }
+
+  // Owner only, takes the item pushed last.
+  T Pop() {
+    int64 bottom = bottom_.load(std::memory_order_relaxed) - 1;
+    Array* array = array_.load(std::memory_order_relaxed);
+    bottom_.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64 top = top_.load(std::memory_order_relaxed);
+    if (top > bottom) {
+      // Empty.
+      bottom_.store(bottom + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    T item = array->Get(bottom);
+    if (top == bottom) {
+      // The last item, races with the thieves.
+      if (!top_.compare_exchange_strong(top, top + 1,
+                                        std::memory_order_seq_cst,
+                                        std::memory_order_relaxed)) {
+        item = nullptr;
+      }
+      bottom_.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return item;
+  }
+
+  // Any thread, takes the item pushed first. Also returns null when losing
+  // the race for the item to another thread.
+  T Steal() {
+    int64 top = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64 bottom = bottom_.load(std::memory_order_acquire);
+    if (top >= bottom) {
+      return nullptr;
+    }
+    Array* array = array_.load(std::memory_order_acquire);
+    T item = array->Get(top);
+    if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed)) {
+      return nullptr;
+    }
+    return item;
+  }
+
+  // Approximate when other threads use the deque.
+  int64 Size() const {
+    int64 size = bottom_.load(std::memory_order_relaxed) -
+                 top_.load(std::memory_order_relaxed);
+    return size > 0 ? size : 0;
+  }
+
+ private:
+  // A circular array, indexed by the ever growing top and bottom.
+  struct Array {
+    explicit Array(int64 n)
+        : capacity(n), items(new std::atomic<T>[n]) {}
+
+    T Get(int64 i) const {
+      return items[i & (capacity - 1)].load(std::memory_order_relaxed);
+    }
+
+    void Put(int64 i, T item) {
+      items[i & (capacity - 1)].store(item, std::memory_order_relaxed);
+    }
+
+    const int64 capacity;
+    std::unique_ptr<std::atomic<T>[]> items;
+  };
+
+  Array* Grow(Array* array, int64 top, int64 bottom) {
+    arrays_.push_back(std::make_unique<Array>(array->capacity * 2));
+    Array* grown = arrays_.back().get();
+    for (int64 i = top; i < bottom; i++) {
+      grown->Put(i, array->Get(i));
+    }
+    array_.store(grown, std::memory_order_release);
+    return grown;
+  }
+
+  std::atomic<int64> top_{0};
+  std::atomic<int64> bottom_{0};
+  std::atomic<Array*> array_{nullptr};
+  // Thieves may still read the smaller arrays after growing, they are kept
+  // along with the deque.
+  std::vector<std::unique_ptr<Array>> arrays_;
+};
+
+// The handle of a task, returned by `spawn` and consumed by `join`. The
+// task runs the body of the `spawn` block on a VM of its own, i.e. its own
+// stack and heap, starting with a copy of the locals of the block spawning
+// it. It owns its VM, so that the values it returns stay alive along with
+// the handle. Unlike strings, a task isn't tracked by the heap of its
+// thread on creation, see `VM::Spawn`.
+class ObjTask : public Object {
+ public:
+  explicit ObjTask(std::unique_ptr<VM> vm);
+  ~ObjTask();
+
+  // Runs the task up to its end, on the calling thread.
+  void Run();
+
+  bool Done() const { return done_.load(std::memory_order_acquire); }
+
+  // Only once done.
+  const Status& GetStatus() const { return status_; }
+  Value Result();
+
+ private:
+  friend class VM;
+
+  std::unique_ptr<VM> vm_;
+  Status status_;
+  std::atomic<bool> done_{false};
+};
+
+// Runs the tasks spawned by a VM and by its tasks on a fixed set of threads,
+// one `WorkStealingDeque` per thread. A spawned task is pushed onto the
+// deque of the spawning thread, idle threads steal from the others. The
+// thread running the VM, i.e. outside of the pool, uses the deque 0 and
+// runs tasks only while joining one.
+class TaskPool {
+ public:
+  // Starts `num_threads` threads besides the caller.
+  explicit TaskPool(int num_threads);
+
+  // Waits for the running tasks, the ones not started yet are dropped.
+  ~TaskPool();
+
+  void Push(ObjTask* task);
+
+  // Runs tasks on the calling thread until `task` is done.
+  void Wait(ObjTask* task);
+
+  int NumThreads() const { return threads_.size(); }
+
+ private:
+  // Index of the deque of the calling thread.
+  int Self() const;
+
+  // Pops a task from the deque `self`, otherwise steals one from the
+  // others, null if none.
+  ObjTask* Take(int self);
+
+  void WorkerLoop(int self);
+
+  std::vector<std::unique_ptr<WorkStealingDeque<ObjTask*>>> deques_;
+  // Number of tasks in the deques, only increased under `mutex_`, so that
+  // an idle thread doesn't miss a wake up.
+  std::atomic<int64> pending_{0};
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace xyxy
+
+#endif  // XYXY_TASK_H_
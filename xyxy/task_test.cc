@@ -0,0 +1,389 @@
+#include "xyxy/task.h"
+
+#include <algorithm>
+#include <set>
+
+#include "gtest/gtest.h"
+#include "xyxy/compiler.h"
+#include "xyxy/vm.h"
+
+namespace xyxy {
+
+// Runs `source` and returns the last value it printed.
+static std::string RunScript(const std::string& source, int task_threads,
+                             Status* status = nullptr) {
+  Compiler compiler;
+  compiler.Compile(source);
+  VMOptions options;
+  options.task_threads = task_threads;
+  VM vm(compiler.GetChunk(), options);
+  testing::internal::CaptureStdout();
+  Status run_status = vm.Run();
+  testing::internal::GetCapturedStdout();
+  if (status) {
+    *status = run_status;
+  }
+  else {
+    EXPECT_TRUE(run_status.ok()) << run_status.ToString();
+  }
+  return vm.FinalResult();
+}
+
+TEST(Deque, TestTask) {
+  WorkStealingDeque<int*> deque(2);
+  int items[5] = {0, 1, 2, 3, 4};
+  EXPECT_EQ(deque.Pop(), nullptr);
+  EXPECT_EQ(deque.Steal(), nullptr);
+  for (int& item : items) {
+    deque.Push(&item);
+  }
+  EXPECT_EQ(deque.Size(), 5);
+  // The owner takes the last one, the thieves the first one.
+  EXPECT_EQ(deque.Pop(), &items[4]);
+  EXPECT_EQ(deque.Steal(), &items[0]);
+  EXPECT_EQ(deque.Steal(), &items[1]);
+  EXPECT_EQ(deque.Pop(), &items[3]);
+  EXPECT_EQ(deque.Pop(), &items[2]);
+  EXPECT_EQ(deque.Pop(), nullptr);
+  EXPECT_EQ(deque.Size(), 0);
+}
+
+TEST(DequeConcurrent, TestTask) {
+  const int kNumItems = 100000;
+  std::vector<int> items(kNumItems);
+  WorkStealingDeque<int*> deque(4);
+  std::atomic<bool> pushed{false};
+  std::vector<std::vector<int*>> stolen(3);
+  std::vector<std::thread> thieves;
+  for (auto& taken : stolen) {
+    thieves.emplace_back([&deque, &pushed, &taken] {
+      while (true) {
+        bool done = pushed.load();
+        int* item = deque.Steal();
+        if (item) {
+          taken.push_back(item);
+        }
+        else if (done && deque.Size() == 0) {
+          break;
+        }
+      }
+    });
+  }
+  std::vector<int*> popped;
+  for (int i = 0; i < kNumItems; i++) {
+    deque.Push(&items[i]);
+    if (i % 3 == 0) {
+      int* item = deque.Pop();
+      if (item) {
+        popped.push_back(item);
+      }
+    }
+  }
+  pushed = true;
+  while (int* item = deque.Pop()) {
+    popped.push_back(item);
+  }
+  for (std::thread& thief : thieves) {
+    thief.join();
+  }
+  // Every item is taken exactly once.
+  std::set<int*> taken(popped.begin(), popped.end());
+  size_t total = popped.size();
+  for (const auto& items_stolen : stolen) {
+    taken.insert(items_stolen.begin(), items_stolen.end());
+    total += items_stolen.size();
+  }
+  EXPECT_EQ(total, kNumItems);
+  EXPECT_EQ(taken.size(), kNumItems);
+}
+
+TEST(SpawnJoin, TestTask) {
+  const char* source = R"(
+    {
+      var n = 1000;
+      var a = spawn {
+        var s = 0;
+        for (var i = 0; i < n; i = i + 1) {
+          s = s + i;
+        }
+        return s;
+      };
+      var b = spawn {
+        var s = 0;
+        for (var i = n; i < 2 * n; i = i + 1) {
+          s = s + i;
+        }
+        return s;
+      };
+      print join a + join b;
+    }
+  )";
+  for (int threads : {0, 1, 3}) {
+    EXPECT_EQ(RunScript(source, threads), Value(1999000).ToString());
+  }
+}
+
+TEST(CaptureByValue, TestTask) {
+  // The task works on a copy of the locals.
+  EXPECT_EQ(RunScript(R"(
+    {
+      var x = 1;
+      var t = spawn {
+        x = x + 10;
+        return x;
+      };
+      x = 5;
+      print join t + x;
+    }
+  )",
+                      2),
+            Value(16).ToString());
+}
+
+TEST(FanOut, TestTask) {
+  // Per shard sums, joined in order, with nested tasks.
+  EXPECT_EQ(RunScript(R"(
+    var total = 0;
+    for (var shard = 0; shard < 8; shard = shard + 1) {
+      var t = spawn {
+        var left = spawn {
+          var s = 0;
+          for (var i = 0; i < 500; i = i + 1) {
+            s = s + shard;
+          }
+          return s;
+        };
+        var s = 0;
+        for (var i = 0; i < 500; i = i + 1) {
+          s = s + 1;
+        }
+        return s + join left;
+      };
+      total = total + join t;
+    }
+    print total;
+  )",
+                      3),
+            Value(8 * 500 + 500 * 28).ToString());
+}
+
+TEST(Results, TestTask) {
+  EXPECT_EQ(RunScript("print join spawn { return \"s\" + \"t\"; };", 1), "st");
+  EXPECT_EQ(RunScript("print join spawn { var a = 1; };", 1), "Nill");
+  EXPECT_EQ(RunScript("print spawn { return 1; };", 1), "<task>");
+  // Joining twice returns the same result.
+  EXPECT_EQ(RunScript(R"(
+    {
+      var t = spawn { return 2; };
+      print join t + join t;
+    }
+  )",
+                      1),
+            Value(4).ToString());
+}
+
+TEST(SharedRope, TestTask) {
+  // The tasks and the VM spawning them read the same string, built as a rope.
+  // The loop gives the tasks time to read it first.
+  std::string expected = "a long enough piece";
+  for (int i = 0; i < 100; i++) {
+    expected += "a long enough piece";
+  }
+  EXPECT_EQ(RunScript(R"(
+    {
+      var a = "a long enough piece";
+      var b = a;
+      for (var i = 0; i < 100; i = i + 1) {
+        b = b + a;
+      }
+      var t1 = spawn { print b; return b + a; };
+      var t2 = spawn { print b; return b; };
+      var t3 = spawn { print b; return b; };
+      for (var i = 0; i < 1000; i = i + 1) {
+        var c = b;
+      }
+      print b;
+      var r1 = join t1;
+      var r2 = join t2;
+      print join t3;
+    }
+  )",
+                      3),
+            expected);
+}
+
+TEST(Errors, TestTask) {
+  Status status;
+  RunScript("{ var t = spawn { return -nil; }; print join t; }", 2, &status);
+  EXPECT_EQ(status.code(), RUNTIME_ERROR);
+  EXPECT_EQ(status.error_message(), "Operand must be a number.");
+  RunScript("print join 1;", 2, &status);
+  EXPECT_EQ(status.error_message(), "Operand must be a task.");
+  // A failed task not joined doesn't fail the script.
+  EXPECT_EQ(RunScript("{ var t = spawn { return -nil; }; print 1; }", 2),
+            Value(1).ToString());
+}
+
+TEST(Verify, TestTask) {
+  Compiler compiler;
+  compiler.Compile(R"(
+    {
+      var a = 3;
+      print join spawn { var b = a; return b * 2; };
+    }
+  )");
+  VMOptions options;
+  options.verify = true;
+  options.task_threads = 1;
+  VM vm(compiler.GetChunk(), options);
+  testing::internal::CaptureStdout();
+  Status status = vm.Run();
+  testing::internal::GetCapturedStdout();
+  EXPECT_TRUE(status.ok()) << status.ToString();
+  EXPECT_EQ(vm.FinalResult(), Value(6).ToString());
+}
+
+TEST(ParallelFor, TestTask) {
+  const char* source = R"(
+    var sum = 0;
+    var big = 0;
+    {
+      var n = 1001;
+      parallel for (var i = 0; i < n; i = i + 1) reduce (sum, big) {
+        var sq = i * i;
+        sum = sum + sq;
+        if (sq > 100) {
+          big = big + 1;
+        }
+      }
+    }
+    print sum * 10000 + big;
+  )";
+  // Sum of the squares below 1001 and number of squares above 100.
+  for (int threads : {0, 1, 3}) {
+    EXPECT_EQ(RunScript(source, threads),
+              Value(1000.0 * 1001 * 2001 / 6 * 10000 + 990).ToString());
+  }
+}
+
+TEST(ParallelForRange, TestTask) {
+  // A step and a range not divisible by the number of tasks, added up to
+  // the values before the loop.
+  EXPECT_EQ(RunScript(R"(
+    {
+      var sum = 10;
+      var count = 0;
+      parallel for (var i = 3; i < 20; i = i + 3) reduce (sum, count) {
+        sum = sum + i;
+        count = count + 1 - 0;
+      }
+      parallel for (var i = 5; i < 2; i = i + 1) reduce (count) {
+        count = count + 1;
+      }
+      print sum * 100 + count;
+    }
+  )",
+                      2),
+            Value((10 + 3 + 6 + 9 + 12 + 15 + 18) * 100 + 6).ToString());
+}
+
+TEST(ParallelForFractionalStep, TestTask) {
+  // The tasks run the iterations of the sequential loop, whose variable
+  // rounds as it grows, none twice and none skipped.
+  const char* source = R"(
+    {
+      var count = 0;
+      var sum = 0;
+      parallel for (var i = 0; i < 3; i = i + 0.1) reduce (count, sum) {
+        count = count + 1;
+        sum = sum + i;
+      }
+      var expected_count = 0;
+      var expected_sum = 0;
+      for (var i = 0; i < 3; i = i + 0.1) {
+        expected_count = expected_count + 1;
+        expected_sum = expected_sum + i;
+      }
+      print count == expected_count and sum > expected_sum - 0.000001 and
+            sum < expected_sum + 0.000001;
+    }
+  )";
+  for (int threads : {0, 1, 3, 7}) {
+    EXPECT_EQ(RunScript(source, threads), Value(true).ToString()) << threads;
+  }
+}
+
+TEST(ParallelForErrors, TestTask) {
+  Status status;
+  RunScript(R"(
+    parallel for (var i = 0; i < 100; i = i + 1) {
+      if (i == 57) {
+        print -nil;
+      }
+    }
+  )",
+            2, &status);
+  EXPECT_EQ(status.error_message(), "Operand must be a number.");
+  RunScript("parallel for (var i = 0; i < nil; i = i + 1) {}", 2, &status);
+  EXPECT_EQ(status.error_message(), "Loop bounds must be numbers.");
+}
+
+TEST(CompileErrors, TestTask) {
+  // Globals are shared by all the tasks.
+  EXPECT_DEATH(
+      {
+        Compiler compiler;
+        compiler.Compile("var g = 1; print join spawn { return g; };");
+      },
+      "");
+  // `break` can't leave the task.
+  EXPECT_DEATH(
+      {
+        Compiler compiler;
+        compiler.Compile("for (;;) { var t = spawn { break; }; }");
+      },
+      "");
+  EXPECT_DEATH(
+      {
+        Compiler compiler;
+        compiler.Compile("return 1;");
+      },
+      "");
+  // A parallel `for` only writes its own locals and its accumulators.
+  EXPECT_DEATH(
+      {
+        Compiler compiler;
+        compiler.Compile(R"(
+          {
+            var a = 0;
+            parallel for (var i = 0; i < 9; i = i + 1) { a = i; }
+          }
+        )");
+      },
+      "");
+  EXPECT_DEATH(
+      {
+        Compiler compiler;
+        compiler.Compile(R"(
+          var a = 0;
+          parallel for (var i = 0; i < 9; i = i + 1) reduce (a) { a = i; }
+        )");
+      },
+      "");
+  EXPECT_DEATH(
+      {
+        Compiler compiler;
+        compiler.Compile(
+            "parallel for (var i = 0; i < 9; i = i + 1) { i = i + 1; }");
+      },
+      "");
+  EXPECT_DEATH(
+      {
+        Compiler compiler;
+        compiler.Compile(
+            "parallel for (var i = 0; i < 9; i = i * 2) { print i; }");
+      },
+      "");
+}
+
+}  // namespace xyxy
@@ -0,0 +1,444 @@
+#include "xyxy/trace.h"
+
+#include "xyxy/jit_assembler.h"
+#include "xyxy/logging.h"
+#include "xyxy/vm.h"
+
+namespace xyxy {
+
+Trace::~Trace() {
+#ifdef XYXY_JIT_X64
+  if (code_) {
+    FreeExecutable(code_, capacity_);
+  }
+#endif
+}
+
+int Trace::Run() {
+  typedef int (*EntryFunc)();
+  return reinterpret_cast<EntryFunc>(code_)();
+}
+
+bool TraceCompiler::Supported() {
+#ifdef XYXY_JIT_X64
+  return ValueLayoutSupported();
+#else
+  return false;
+#endif
+}
+
+const char* TraceCompiler::Print(VM* vm, const uint8* ip) {
+  vm->PrintTop();
+  return nullptr;
+}
+
+#ifdef XYXY_JIT_X64
+
+// Emits the insts of a trace, keeping the types of the stack slots and of
+// the globals while going through them.
+class TraceCompiler::Emitter {
+ public:
+  Emitter(VM* vm, const TraceRecord& record)
+      : vm_(vm), chunk_(vm->chunk_), record_(record) {}
+
+  // Returns false if the trace has something the compiler doesn't support.
+  bool EmitTrace();
+
+  const std::vector<uint8>& code() const { return asm_.code(); }
+
+ private:
+  static constexpr int kUnknown = -1;
+
+  bool EmitInst(const TraceInst& inst);
+
+  // Leaves the trace at `pc` with the jump `opcode`.
+  void EmitExit(std::initializer_list<uint8> opcode, int pc);
+  // Loads the address of the value of global `name` into rax.
+  bool EmitGlobalAddress(const std::string& name);
+
+  int Top(int n = 0) const { return types_[types_.size() - 1 - n]; }
+  void PushType(ValueType type) { types_.push_back((int)type); }
+
+  VM* vm_;
+  Chunk* chunk_;
+  const TraceRecord& record_;
+  Assembler asm_;
+  // Types of the values on the stack, kUnknown for the slots not read yet.
+  std::vector<int> types_;
+  std::map<std::string, int> global_types_;
+  // Guards at the loop header: the local at `disp` must have the type.
+  std::vector<std::pair<int32, ValueType>> slot_guards_;
+  std::vector<std::pair<std::string, ValueType>> global_guards_;
+  // Jumps to bind to the exit stubs, pairs of the position to patch and
+  // the pc to leave the trace at.
+  std::vector<std::pair<int, int>> exits_;
+};
+
+void TraceCompiler::Emitter::EmitExit(std::initializer_list<uint8> opcode,
+                                      int pc) {
+  exits_.emplace_back(asm_.EmitJump(opcode), pc);
+}
+
+bool TraceCompiler::Emitter::EmitGlobalAddress(const std::string& name) {
+  Value* val = vm_->global_.FindValue(name);
+  if (!val) {
+    return false;
+  }
+  // Values of the globals never move, see `hash_table::FindValue`.
+  // mov rax, val
+  asm_.Emit({0x48, 0xb8});
+  asm_.Emit64(reinterpret_cast<uint64>(val));
+  return true;
+}
+
+bool TraceCompiler::Emitter::EmitInst(const TraceInst& inst) {
+  const uint8* ip = chunk_->code() + inst.pc;
+  switch (inst.opcode) {
+    case OP_CONSTANT: {
+      asm_.PushValue(kConstantOperand, ip[1] * kValueSize);
+      PushType(chunk_->GetConstant(ip[1]).Type());
+      break;
+    }
+    case OP_NIL: {
+      asm_.PushLiteral(ValueType::VAL_NIL, 0);
+      PushType(ValueType::VAL_NIL);
+      break;
+    }
+    case OP_TRUE:
+    case OP_FALSE: {
+      asm_.PushLiteral(ValueType::VAL_BOOL, inst.opcode == OP_TRUE);
+      PushType(ValueType::VAL_BOOL);
+      break;
+    }
+    case OP_POP: {
+      asm_.Pop();
+      types_.pop_back();
+      break;
+    }
+    case OP_GET_LOCAL: {
+      int slot = ip[1];
+      if (types_[slot] == kUnknown) {
+        // Not written by the trace yet, i.e. the value from the header.
+        types_[slot] = (int)record_.slot_types[slot];
+        slot_guards_.emplace_back(slot * kValueSize, record_.slot_types[slot]);
+      }
+      asm_.PushValue(kLocalOperand, slot * kValueSize);
+      types_.push_back(types_[slot]);
+      break;
+    }
+    case OP_SET_LOCAL: {
+      asm_.StoreLocal(ip[1] * kValueSize);
+      types_[ip[1]] = Top();
+      break;
+    }
+    case OP_GET_GLOBAL: {
+      std::string name = chunk_->GetConstant(ip[1]).ToString();
+      if (!global_types_.count(name)) {
+        auto it = record_.global_types.find(name);
+        if (it == record_.global_types.end()) {
+          return false;
+        }
+        global_types_[name] = (int)it->second;
+        global_guards_.emplace_back(name, it->second);
+      }
+      if (!EmitGlobalAddress(name)) {
+        return false;
+      }
+      // movups xmm0, [rax]; movups [r12], xmm0; add r12, 16
+      asm_.Emit({0x0f, 0x10, 0x00, 0x41, 0x0f, 0x11, 0x04, 0x24, 0x49, 0x83,
+                 0xc4, kValueSize});
+      types_.push_back(global_types_[name]);
+      break;
+    }
+    case OP_SET_GLOBAL: {
+      std::string name = chunk_->GetConstant(ip[1]).ToString();
+      if (!EmitGlobalAddress(name)) {
+        return false;
+      }
+      // movups xmm0, [r12 - 16]; movups [rax], xmm0
+      asm_.Emit({0x41, 0x0f, 0x10, 0x44, 0x24, 0xf0, 0x0f, 0x11, 0x00});
+      global_types_[name] = Top();
+      break;
+    }
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV: {
+      if (Top() != (int)ValueType::VAL_FLOAT ||
+          Top(1) != (int)ValueType::VAL_FLOAT) {
+        return false;
+      }
+      asm_.NumberOp(inst.opcode == OP_ADD   ? 0x58   // addsd
+                    : inst.opcode == OP_SUB ? 0x5c   // subsd
+                    : inst.opcode == OP_MUL ? 0x59   // mulsd
+                                            : 0x5e); // divsd
+      types_.pop_back();
+      break;
+    }
+    case OP_EQUAL:
+    case OP_GREATER:
+    case OP_LESS: {
+      // Comparing anything but numbers is a runtime error.
+      if (Top() != (int)ValueType::VAL_FLOAT ||
+          Top(1) != (int)ValueType::VAL_FLOAT) {
+        return false;
+      }
+      asm_.CompareNumbers(inst.opcode == OP_EQUAL, inst.opcode == OP_LESS);
+      types_.pop_back();
+      types_.pop_back();
+      PushType(ValueType::VAL_BOOL);
+      break;
+    }
+    case OP_NEGATE: {
+      if (Top() != (int)ValueType::VAL_FLOAT) {
+        return false;
+      }
+      asm_.NegateNumber();
+      break;
+    }
+    case OP_NOT: {
+      if (Top() == (int)ValueType::VAL_BOOL) {
+        // xor byte [r12 - 8], 1
+        asm_.Emit({0x41, 0x80, 0x74, 0x24, 0xf8, 0x01});
+      }
+      else {
+        // Only nil is falsey among the other types.
+        asm_.Pop();
+        asm_.PushLiteral(ValueType::VAL_BOOL,
+                         Top() == (int)ValueType::VAL_NIL);
+        types_.back() = (int)ValueType::VAL_BOOL;
+      }
+      break;
+    }
+    case OP_PRINT: {
+      // Printing never fails.
+      asm_.Call(reinterpret_cast<const void*>(&TraceCompiler::Print),
+                reinterpret_cast<uint64>(vm_),
+                reinterpret_cast<uint64>(ip));
+      types_.pop_back();
+      break;
+    }
+    case OP_JUMP_IF_FALSE: {
+      int fallthrough = inst.pc + InstLength(OP_JUMP_IF_FALSE);
+      int target = fallthrough + ((ip[1] << 8) | ip[2]);
+      if (Top() == (int)ValueType::VAL_BOOL) {
+        // cmp byte [r12 - 8], 0
+        asm_.Emit({0x41, 0x80, 0x7c, 0x24, 0xf8, 0x00});
+        if (inst.taken) {
+          // jne fallthrough
+          EmitExit({0x0f, 0x85}, fallthrough);
+        }
+        else {
+          // je target
+          EmitExit({0x0f, 0x84}, target);
+        }
+      }
+      else if (inst.taken != (Top() == (int)ValueType::VAL_NIL)) {
+        return false;
+      }
+      break;
+    }
+    case OP_JUMP:
+    case OP_LOOP: {
+      // The trace follows the jumps.
+      break;
+    }
+    default: {
+      LOGcc << "Trace doesn't support opcode " << (int)inst.opcode;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool TraceCompiler::Emitter::EmitTrace() {
+  const int depth = record_.slot_types.size();
+  types_.assign(depth, kUnknown);
+  // The guards at the loop header are only known after the body, they
+  // follow it.
+  asm_.Prologue(vm_->stack_.MutableTop(), vm_->stack_.Data(),
+                chunk_->constants());
+  int to_guards = asm_.EmitJump({0xe9});
+  int body = asm_.size();
+  for (const TraceInst& inst : record_.insts) {
+    if (!EmitInst(inst)) {
+      return false;
+    }
+  }
+  if ((int)types_.size() != depth) {
+    return false;
+  }
+  int back_edge = asm_.EmitJump({0xe9});
+  asm_.Bind(to_guards, asm_.size());
+  asm_.Bind(back_edge, asm_.size());
+  for (auto& guard : slot_guards_) {
+    // cmp dword [r13 + disp32], type; jne header
+    asm_.Emit({0x41, 0x83, 0xbd});
+    asm_.Emit32(guard.first);
+    asm_.Emit({(uint8)guard.second});
+    EmitExit({0x0f, 0x85}, record_.header);
+  }
+  for (auto& guard : global_guards_) {
+    EmitGlobalAddress(guard.first);
+    // cmp dword [rax], type; jne header
+    asm_.Emit({0x83, 0x38, (uint8)guard.second});
+    EmitExit({0x0f, 0x85}, record_.header);
+  }
+  asm_.Bind(asm_.EmitJump({0xe9}), body);
+  // Exit stubs, the stack is always up to date in memory.
+  std::vector<int> epilogue_jumps;
+  for (auto& exit : exits_) {
+    asm_.Bind(exit.first, asm_.size());
+    // mov eax, pc; jmp epilogue
+    asm_.Emit({0xb8});
+    asm_.Emit32(exit.second);
+    epilogue_jumps.push_back(asm_.EmitJump({0xe9}));
+  }
+  for (int at : epilogue_jumps) {
+    asm_.Bind(at, asm_.size());
+  }
+  asm_.Epilogue();
+  return true;
+}
+
+std::unique_ptr<Trace> TraceCompiler::Compile(VM* vm,
+                                              const TraceRecord& record) {
+  if (!Supported()) {
+    return nullptr;
+  }
+  Emitter emitter(vm, record);
+  if (!emitter.EmitTrace()) {
+    return nullptr;
+  }
+  std::unique_ptr<Trace> trace(new Trace());
+  const std::vector<uint8>& code = emitter.code();
+  trace->code_ = AllocateExecutable(code);
+  if (!trace->code_) {
+    return nullptr;
+  }
+  trace->capacity_ = code.size();
+  LOGcc << "Trace of the loop at " << record.header << " compiled "
+        << record.insts.size() << " insts into " << code.size()
+        << " bytes of native code";
+  return trace;
+}
+
+#else  // XYXY_JIT_X64
+
+std::unique_ptr<Trace> TraceCompiler::Compile(VM* vm,
+                                              const TraceRecord& record) {
+  return nullptr;
+}
+
+#endif
+
+TraceCache::TraceCache(VM* vm) : vm_(vm) {}
+
+TraceCache::~TraceCache() {}
+
+void TraceCache::CheckChunk() {
+  int size = vm_->chunk_->size();
+  if (size == chunk_size_) {
+    return;
+  }
+  // The traces point into the chunk and its constants.
+  traces_.clear();
+  counts_.assign(size, 0);
+  chunk_size_ = size;
+}
+
+void TraceCache::Blacklist(int header) {
+  LOGcc << "Loop at " << header << " can't be traced";
+  counts_[header] = kBlacklisted;
+  traces_.erase(header);
+}
+
+bool TraceCache::Record(TraceRecord* record, Status* status) {
+  const uint32 header = vm_->pc_;
+  // Inner loops update `loop_` while stepping.
+  const int loop = loop_;
+  const int depth = vm_->stack_.Size();
+  const uint8* code = vm_->chunk_->code();
+  record->header = header;
+  for (int i = 0; i < depth; i++) {
+    record->slot_types.push_back(vm_->stack_.Get(i).Type());
+  }
+  int steps = 0;
+  do {
+    if (++steps > kMaxTraceLength) {
+      Blacklist(header);
+      return false;
+    }
+    const int pc = vm_->pc_;
+    const int end = pc + InstLength(code[pc]);
+    // The insts fused into a superinst start after its first one.
+    std::vector<std::pair<int, uint8>> insts;
+    for (int p = pc; p < end;) {
+      uint8 opcode = BaseOpcode(code[p]);
+      insts.emplace_back(p, opcode);
+      if (opcode == OP_GET_GLOBAL) {
+        std::string name = vm_->chunk_->GetConstant(code[p + 1]).ToString();
+        Value* val = vm_->global_.FindValue(name);
+        if (val && !record->global_types.count(name)) {
+          record->global_types[name] = val->Type();
+        }
+      }
+      p += InstLength(opcode);
+    }
+    *status = vm_->Step();
+    if (!status->ok()) {
+      return false;
+    }
+    const int next = vm_->pc_;
+    for (auto& inst : insts) {
+      TraceInst trace_inst = {inst.first, inst.second, false};
+      if (inst.second == OP_JUMP_IF_FALSE) {
+        const uint8* ip = code + inst.first;
+        int target = inst.first + InstLength(OP_JUMP_IF_FALSE) +
+                     ((ip[1] << 8) | ip[2]);
+        trace_inst.taken = next == target;
+      }
+      record->insts.push_back(trace_inst);
+      if (trace_inst.taken) {
+        break;
+      }
+    }
+    if (next > loop) {
+      // Left the loop, it is recorded again on its next back edge. Jumps
+      // before the header are fine, e.g. to the condition of a for loop.
+      return false;
+    }
+  } while (vm_->pc_ != header);
+  if (vm_->stack_.Size() != depth) {
+    Blacklist(header);
+    return false;
+  }
+  return true;
+}
+
+Status TraceCache::Run() {
+  const uint32 header = vm_->pc_;
+  auto it = traces_.find(header);
+  if (it == traces_.end()) {
+    TraceRecord record;
+    Status status;
+    if (!Record(&record, &status)) {
+      return status;
+    }
+    std::unique_ptr<Trace> trace = TraceCompiler::Compile(vm_, record);
+    if (!trace) {
+      Blacklist(header);
+      return Status();
+    }
+    // The recording ran one iteration, the VM is back at the header.
+    it = traces_.emplace(header, std::move(trace)).first;
+  }
+  Trace* trace = it->second.get();
+  vm_->pc_ = trace->Run();
+  if (vm_->pc_ == header && ++trace->guard_exits_ > kMaxGuardExits) {
+    Blacklist(header);
+  }
+  return Status();
+}
+
+}  // namespace xyxy
@@ -0,0 +1,141 @@
+#ifndef XYXY_TRACE_H_
+#define XYXY_TRACE_H_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "xyxy/base.h"
+#include "xyxy/status.h"
+#include "xyxy/type.h"
+
+namespace xyxy {
+
+class VM;
+
+// An inst emitted by the compiler, executed while recording a trace. The
+// insts fused into a superinst are recorded one by one.
+struct TraceInst {
+  int pc;
+  uint8 opcode;
+  // Whether the jump of an OP_JUMP_IF_FALSE was taken.
+  bool taken;
+};
+
+// One iteration of a loop, from its header back to its header.
+struct TraceRecord {
+  int header;
+  std::vector<TraceInst> insts;
+  // Types of the stack slots and of the globals read by the trace, when the
+  // iteration started.
+  std::vector<ValueType> slot_types;
+  std::map<std::string, ValueType> global_types;
+};
+
+// Native code of one trace, valid as long as the chunk doesn't grow.
+class Trace {
+ public:
+  virtual ~Trace();
+
+  // Runs the loop until a guard fails, returns the pc where the interpreter
+  // resumes.
+  int Run();
+
+ private:
+  friend class TraceCompiler;
+  friend class TraceCache;
+  Trace() = default;
+
+  // Executable memory from mmap.
+  uint8* code_ = nullptr;
+  size_t capacity_ = 0;
+  // Number of times the types at the loop header didn't match the trace.
+  int guard_exits_ = 0;
+};
+
+// Compiles a recorded trace into x86-64 code specialized on the observed
+// types. The types of the locals and globals read by the trace are checked
+// once per iteration at the loop header, everything else is known while
+// compiling and needs no check. A branch that goes the other way than
+// recorded leaves the trace at the pc of that branch.
+class TraceCompiler {
+ public:
+  // Returns true if traces can run on this platform.
+  static bool Supported();
+
+  // Returns nullptr if the trace has something the compiler doesn't support.
+  static std::unique_ptr<Trace> Compile(VM* vm, const TraceRecord& record);
+
+ private:
+  class Emitter;
+
+  static const char* Print(VM* vm, const uint8* ip);
+};
+
+// Finds the hot loops of the interpreter and runs their traces. The
+// interpreter counts the back edges of every loop, and yields to `Run` at
+// the header of a hot loop. The first `Run` records one iteration by
+// stepping the VM and compiles it, loops that can't be traced are
+// blacklisted and left to the interpreter.
+class TraceCache {
+ public:
+  // Back edges before a loop is recorded.
+  static const int kHotLoop = 50;
+  // Steps after which a recording is given up.
+  static const int kMaxTraceLength = 1000;
+  // Guard failures at the loop header before a trace is given up.
+  static const int kMaxGuardExits = 16;
+
+  explicit TraceCache(VM* vm);
+  virtual ~TraceCache();
+
+  // Called when the OP_LOOP at `loop` jumps back to `header`, returns true
+  // if the interpreter should yield to `Run`.
+  bool OnLoop(int header, int loop) {
+    uint16& count = counts_[header];
+    if (XY_PREDICT_TRUE(count < kHotLoop - 1)) {
+      count++;
+      return false;
+    }
+    if (count == kBlacklisted) {
+      return false;
+    }
+    count = kHotLoop;
+    loop_ = loop;
+    return true;
+  }
+
+  // Drops the traces if the chunk grew since they were compiled.
+  void CheckChunk();
+
+  // Runs the trace of the loop at the pc of the VM, after recording and
+  // compiling it if needed. Returns a runtime error hit while recording.
+  Status Run();
+
+  int NumTraces() const { return traces_.size(); }
+  bool IsBlacklisted(int header) const {
+    return counts_[header] == kBlacklisted;
+  }
+
+ private:
+  static const uint16 kBlacklisted = 0xffff;
+
+  // Steps the VM through one iteration of the loop at its pc. Returns false
+  // if the iteration can't be traced, or on a runtime error stored into
+  // `status`.
+  bool Record(TraceRecord* record, Status* status);
+  void Blacklist(int header);
+
+  VM* vm_;  // Not owned.
+  int chunk_size_ = 0;
+  // Back edges taken so far per loop header.
+  std::vector<uint16> counts_;
+  // The OP_LOOP of the last hot loop.
+  int loop_ = 0;
+  std::map<int, std::unique_ptr<Trace>> traces_;
+};
+
+}  // namespace xyxy
+
+#endif  // XYXY_TRACE_H_
@@ -0,0 +1,155 @@
+#include "xyxy/trace.h"
+
+#include "gtest/gtest.h"
+#include "xyxy/compiler.h"
+#include "xyxy/vm.h"
+
+namespace xyxy {
+
+// Runs `source` with the interpreter alone and with traces, and expects the
+// same result.
+#define XY_RUN_TRACED(source, result)                                \
+  Compiler compiler;                                                 \
+  compiler.Compile(source);                                          \
+  VM vm(compiler.GetChunk());                                        \
+  Status status = vm.Run();                                          \
+  EXPECT_EQ(vm.FinalResult(), result);                               \
+  VMOptions options;                                                 \
+  options.trace_jit = true;                                          \
+  VM trace_vm(compiler.GetChunk(), options);                         \
+  Status trace_status = trace_vm.Run();                              \
+  EXPECT_EQ(trace_vm.FinalResult(), result);                         \
+  EXPECT_EQ(trace_status.ok(), status.ok());                         \
+  EXPECT_EQ(trace_status.error_message(), status.error_message());   \
+  EXPECT_EQ(trace_vm.PC(), vm.PC());                                 \
+  EXPECT_EQ(trace_vm.GetStack().Size(), vm.GetStack().Size());
+
+#if defined(__x86_64__) && defined(__linux__)
+
+TEST(Supported, TestTrace) { EXPECT_TRUE(TraceCompiler::Supported()); }
+
+TEST(Loop, TestTrace) {
+  XY_RUN_TRACED(R"(
+    var a = 0;
+    for (var i = 0; i < 1000; i = i + 1) {
+      var b = i * 2 - 1;
+      if (b / 2 > 100 and !(i == 500)) {
+        a = a + b;
+      }
+    }
+    print a;
+  )",
+                "987002")
+  EXPECT_TRUE(status.ok());
+}
+
+TEST(SideExit, TestTrace) {
+  // Recorded with the first branch, the second one leaves the trace.
+  XY_RUN_TRACED(R"(
+    var a = 0;
+    var i = 0;
+    while (i < 1000) {
+      if (i < 600) {
+        a = a + 1;
+      } else {
+        a = a - 1;
+      }
+      i = i + 1;
+    }
+    print a;
+  )",
+                "200")
+}
+
+TEST(Nested, TestTrace) {
+  XY_RUN_TRACED(R"(
+    var a = 0;
+    for (var i = 0; i < 100; i = i + 1) {
+      for (var j = 0; j < 100; j = j + 1) {
+        a = a + i - j;
+      }
+    }
+    print a;
+  )",
+                "0")
+}
+
+TEST(TypeChange, TestTrace) {
+  // The guards at the header fail once `b` turns into a boolean.
+  XY_RUN_TRACED(R"(
+    var b = 1;
+    var c = nil;
+    for (var i = 0; i < 1000; i = i + 1) {
+      if (i > 700) {
+        b = true;
+      }
+      c = !b;
+    }
+    print c;
+  )",
+                "0")
+}
+
+TEST(Unsupported, TestTrace) {
+  // Strings are left to the interpreter.
+  XY_RUN_TRACED(R"(
+    var s = "s";
+    for (var i = 0; i < 100; i = i + 1) {
+      s = s + "a";
+    }
+    print "done";
+  )",
+                "done")
+  EXPECT_EQ(trace_vm.GetStack().Size(), 0);
+}
+
+TEST(CompareError, TestTrace) {
+  XY_RUN_TRACED(R"(
+    var a = 0;
+    for (var i = 0; i < 100; i = i + 1) {
+      if (i > 60) {
+        a = nil;
+      }
+      print a == 0;
+    }
+  )",
+                "1")
+  EXPECT_EQ(trace_status.error_message(), "Unsupported binary operation.");
+}
+
+TEST(RuntimeError, TestTrace) {
+  XY_RUN_TRACED(R"(
+    for (var i = 0; i < 1000; i = i + 1) {
+      if (i > 600) {
+        print -"a";
+      }
+      print i;
+    }
+  )",
+                "600")
+  EXPECT_EQ(trace_status.error_message(), "Operand must be a number.");
+}
+
+TEST(Cache, TestTrace) {
+  Compiler compiler;
+  compiler.Compile(R"(
+    var a = 0;
+    while (a < 1000) {
+      a = a + 1;
+    }
+  )");
+  VM vm(compiler.GetChunk());
+  TraceCache cache(&vm);
+  cache.CheckChunk();
+  for (int i = 1; i < TraceCache::kHotLoop; i++) {
+    EXPECT_FALSE(cache.OnLoop(2, 10));
+  }
+  EXPECT_TRUE(cache.OnLoop(2, 10));
+  EXPECT_TRUE(cache.OnLoop(2, 10));
+  EXPECT_FALSE(cache.IsBlacklisted(2));
+  EXPECT_EQ(cache.NumTraces(), 0);
+}
+
+#endif
+
+}  // namespace xyxy
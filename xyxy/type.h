@@ -1,8 +1,14 @@
 #ifndef XYXY_TYPE_H_
 #define XYXY_TYPE_H_
 
+#include <algorithm>
 #include <cassert>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
 #include <cstring>
+#include <string>
+#include <string_view>
 
 #include "xyxy/object.h"
 
@@ -13,22 +19,177 @@ enum class ValueType {
   VAL_NIL,
   VAL_FLOAT,
   VAL_OBJ,
+  // A string stored in the value itself, see `Value::String`.
+  VAL_SHORT_STR,
 };
 
+// The most bytes `FormatNumber` writes, e.g. "-2.2250738585072014e-308".
+constexpr int kMaxNumberChars = 32;
+
+// Writes into `buf` the shortest text that reads back as `number`, e.g. "3",
+// "0.1" or "1e+21", and returns its length. Unlike `std::to_string`, it
+// neither depends on the locale nor allocates.
+inline int FormatNumber(double number, char* buf) {
+  return std::to_chars(buf, buf + kMaxNumberChars, number).ptr - buf;
+}
+
+// Built with `XYXY_NAN_BOXING`, a value is a single 64 bit word: numbers are
+// stored as doubles and the other values as quiet NaNs, with the address of
+// an object or the bytes of a short string in the low 48 bits. Otherwise a
+// value is a type followed by a union of the payloads, 16 bytes, the layout
+// the JITs expect, see `ValueLayoutSupported`.
 class Value {
  private:
+#ifdef XYXY_NAN_BOXING
+  static_assert(sizeof(void*) == 8, "NaN boxing needs 64 bit addresses.");
+
+  // Numbers never have all these bits set, see `Value(double)`.
+  static constexpr uint64_t kQuietNaN = 0x7ffc000000000000ull;
+  static constexpr uint64_t kSignBit = 0x8000000000000000ull;
+  static constexpr uint64_t kNil = kQuietNaN | 1;
+  static constexpr uint64_t kFalse = kQuietNaN | 2;
+  static constexpr uint64_t kTrue = kQuietNaN | 3;
+  static constexpr uint64_t kObject = kSignBit | kQuietNaN;
+  // The bytes of a short string follow, padded with NULs.
+  static constexpr uint64_t kShortString = kQuietNaN | (1ull << 48);
+  // All the NaN numbers are stored as this one.
+  static constexpr uint64_t kCanonicalNaN = 0x7ff8000000000000ull;
+
+  uint64_t bits_;
+
+  void SetShortString(const std::string& str) {
+    bits_ = kShortString;
+    for (size_t i = 0; i < str.size(); i++) {
+      bits_ |= uint64_t(uint8_t(str[i])) << (8 * i);
+    }
+  }
+
+  std::string GetShortString() {
+    std::string str;
+    for (uint64_t bytes = bits_ & 0xffffffffffffull; bytes; bytes >>= 8) {
+      str.push_back(char(bytes & 0xff));
+    }
+    return str;
+  }
+
+ public:
+  // The NULs pad the bytes, so the short strings have none.
+  static constexpr size_t kMaxShortString = 6;
+
+  static bool FitsShortString(const std::string& str) {
+    return str.size() <= kMaxShortString &&
+           str.find('\0') == std::string::npos;
+  }
+
+  // By default, constructs a Nil value.
+  Value() : bits_(kNil) {}
+
+  Value(bool b) : bits_(b ? kTrue : kFalse) {}
+
+  Value(double n) {
+    if (n != n) {
+      bits_ = kCanonicalNaN;
+    }
+    else {
+      std::memcpy(&bits_, &n, sizeof(bits_));
+    }
+  }
+
+  Value(int n) : Value((double)n) {}
+
+  Value(Object* o) : bits_(kObject | reinterpret_cast<uint64_t>(o)) {}
+
+  Value(ObjString* p) : Value(reinterpret_cast<Object*>(p)) {}
+
+  // Same as the constructor, without turning the NaNs into `kCanonicalNaN`:
+  // the arithmetic on numbers only returns NaNs that aren't boxed values.
+  static Value Result(double n) {
+    Value val;
+    std::memcpy(&val.bits_, &n, sizeof(val.bits_));
+    return val;
+  }
+
+  ValueType Type() const {
+    if ((bits_ & kQuietNaN) != kQuietNaN) {
+      return ValueType::VAL_FLOAT;
+    }
+    else if ((bits_ & kObject) == kObject) {
+      return ValueType::VAL_OBJ;
+    }
+    else if (IsShortString()) {
+      return ValueType::VAL_SHORT_STR;
+    }
+    return bits_ == kNil ? ValueType::VAL_NIL : ValueType::VAL_BOOL;
+  }
+
+  bool IsBool() { return (bits_ | 1) == kTrue; }
+  bool IsFloat() { return (bits_ & kQuietNaN) != kQuietNaN; }
+  bool IsObject() { return (bits_ & kObject) == kObject; }
+  bool IsShortString() const {
+    return (bits_ & (kObject | kShortString)) == kShortString;
+  }
+  bool IsNil() { return bits_ == kNil; }
+  // Nil and false are next to each other.
+  bool IsFalsey() { return bits_ - kNil < 2; }
+
+  bool AsBool() {
+    assert(IsBool());
+    return bits_ == kTrue;
+  }
+
+  double AsFloat() {
+    assert(IsFloat());
+    double number;
+    std::memcpy(&number, &bits_, sizeof(number));
+    return number;
+  }
+
+  Object* AsRawObject() {
+    assert(IsObject());
+    return reinterpret_cast<Object*>(bits_ & ~kObject);
+  }
+#else
   // Denotes the value type.
   ValueType type_;
 
+  // The length and the first bytes of a short string, in the padding before
+  // the payload. The other bytes are in `as_.chars`.
+  uint8_t length_;
+  char head_[3];
+
   // An union type stores the real value for each kind.
   union {
     bool boolean;
     double number;
     // NOTE: this class only sort of serving as a `Object` container.
     Object* obj;  // not owned
+    char chars[8];
   } as_;
 
+  void SetShortString(const std::string& str) {
+    type_ = ValueType::VAL_SHORT_STR;
+    Reset();
+    length_ = str.size();
+    size_t head = std::min(str.size(), sizeof(head_));
+    std::memcpy(head_, str.data(), head);
+    std::memcpy(as_.chars, str.data() + head, str.size() - head);
+  }
+
+  std::string GetShortString() {
+    std::string str(head_, std::min<size_t>(length_, sizeof(head_)));
+    if (length_ > sizeof(head_)) {
+      str.append(as_.chars, length_ - sizeof(head_));
+    }
+    return str;
+  }
+
  public:
+  static constexpr size_t kMaxShortString = sizeof(head_) + sizeof(as_.chars);
+
+  static bool FitsShortString(const std::string& str) {
+    return str.size() <= kMaxShortString;
+  }
+
   // By default, constructs a Nil value.
   Value() : type_(ValueType::VAL_NIL) { Reset(); }
 
@@ -52,33 +213,29 @@ class Value {
     as_.obj = o;
   }
 
-  ValueType Type() const { return type_; }
-
-  ObjType ObjectType() {
-    assert(IsObject());
-    return as_.obj->Type();
+  Value(ObjString* p) : type_(ValueType::VAL_OBJ) {
+    as_.obj = reinterpret_cast<Object*>(p);
   }
 
+  static Value Result(double n) { return Value(n); }
+
+  ValueType Type() const { return type_; }
+
   // TODO(): Is this really sets the union to be zero?
   void Reset() { std::memset((void*)&as_, 0, sizeof(as_)); }
 
   bool IsBool() { return type_ == ValueType::VAL_BOOL; }
   bool IsFloat() { return type_ == ValueType::VAL_FLOAT; }
   bool IsObject() { return type_ == ValueType::VAL_OBJ; }
+  bool IsShortString() const { return type_ == ValueType::VAL_SHORT_STR; }
   bool IsNil() { return type_ == ValueType::VAL_NIL; }
   bool IsFalsey() { return IsNil() || (IsBool() && !AsBool()); }
-  bool IsString() { return IsObject() && AsRawObject()->IsString(); }
 
   bool AsBool() {
     assert(IsBool());
     return as_.boolean;
   }
 
-  bool AsNil() {
-    assert(IsNil());
-    return false;
-  }
-
   double AsFloat() {
     assert(IsFloat());
     return as_.number;
@@ -88,14 +245,109 @@ class Value {
     assert(IsObject());
     return as_.obj;
   }
+#endif
 
-  Value(ObjString* p) : type_(ValueType::VAL_OBJ) {
-    as_.obj = reinterpret_cast<Object*>(p);
+  // The value of an operation of the VM, see `Result(double)`.
+  static Value Result(bool b) { return Value(b); }
+
+  ObjType ObjectType() {
+    assert(IsObject());
+    return AsRawObject()->Type();
+  }
+
+  // Returns a string stored in the value if it fits, see `FitsShortString`,
+  // otherwise in an `ObjString` of the current heap.
+  static Value String(const std::string& str) {
+    if (!FitsShortString(str)) {
+      return Value(ObjString::New(str));
+    }
+    Value val;
+    val.SetShortString(str);
+    return val;
+  }
+
+  // Returns the concatenation of the strings `a` and `b`, copied if both are
+  // short, otherwise a rope node of the current heap, see `ObjString`.
+  static Value Concat(Value a, Value b) {
+    if ((a.IsShortString() && b.IsShortString()) ||
+        a.StringSize() + b.StringSize() <= kMaxShortString) {
+      return String(a.AsString() + b.AsString());
+    }
+    else if (a.IsShortString()) {
+      return Value(
+          ObjString::New(nullptr, a.GetShortString(), b.AsObjString()));
+    }
+    else if (b.IsShortString()) {
+      return Value(
+          ObjString::New(a.AsObjString(), b.GetShortString(), nullptr));
+    }
+    return Value(ObjString::New(a.AsObjString(), "", b.AsObjString()));
+  }
+
+  bool IsString() { return IsShortString() || IsObjString(); }
+  bool IsObjString() { return IsObject() && AsRawObject()->IsString(); }
+  bool IsTask() { return IsObject() && AsRawObject()->IsTask(); }
+
+  bool AsNil() {
+    assert(IsNil());
+    return false;
   }
 
   std::string AsString() {
-    assert(IsString());
-    return reinterpret_cast<ObjString*>(AsRawObject())->ToString();
+    return IsShortString() ? GetShortString()
+                           : std::string(AsObjString()->str());
+  }
+
+  // Copies the contents of the string to `out`, returns the number of bytes
+  // copied.
+  size_t CopyTo(char* out) {
+    if (IsShortString()) {
+      std::string str = GetShortString();
+      std::memcpy(out, str.data(), str.size());
+      return str.size();
+    }
+    std::string_view str = AsObjString()->str();
+    std::memcpy(out, str.data(), str.size());
+    return str.size();
+  }
+
+  size_t StringSize() {
+    return IsShortString() ? GetShortString().size() : AsObjString()->size();
+  }
+
+  // Flattens the string if it is a rope, see `ObjString`, as reading a rope
+  // writes it. Called on the values passed to other VMs, which may read
+  // them on other threads.
+  void FlattenString() {
+    if (IsObjString()) {
+      AsObjString()->str();
+    }
+  }
+
+  ObjString* AsObjString() {
+    assert(IsObjString());
+    return reinterpret_cast<ObjString*>(AsRawObject());
+  }
+
+  // Writes the value and a newline to `out`, as `print` does, the numbers
+  // and the strings without building a string first.
+  void PrintLine(FILE* out) {
+    if (IsFloat()) {
+      char buf[kMaxNumberChars + 1];
+      int size = FormatNumber(AsFloat(), buf);
+      buf[size] = '\n';
+      fwrite(buf, 1, size + 1, out);
+    }
+    else if (IsObjString()) {
+      std::string_view str = AsObjString()->str();
+      fwrite(str.data(), 1, str.size(), out);
+      fputc('\n', out);
+    }
+    else {
+      std::string str = ToString();
+      str.push_back('\n');
+      fwrite(str.data(), 1, str.size(), out);
+    }
   }
 
   std::string ToString() {
@@ -103,12 +355,15 @@ class Value {
       return std::to_string(AsBool());
     }
     else if (IsFloat()) {
-      // TODO(): make consistant float number formating.
-      return std::to_string(AsFloat());
+      char buf[kMaxNumberChars];
+      return std::string(buf, FormatNumber(AsFloat(), buf));
     }
     else if (IsNil()) {
       return "Nill";
     }
+    else if (IsShortString()) {
+      return GetShortString();
+    }
     else if (IsObject()) {
       return AsRawObject()->ToString();
     }
@@ -122,7 +377,8 @@ class Value {
 
 inline bool is_equal(Value a, Value b) {
   if (a.Type() != b.Type()) {
-    return false;
+    // The strings that fit in a value may still be objects, e.g. interned.
+    return a.IsString() && b.IsString() && a.AsString() == b.AsString();
   }
   if (a.Type() == ValueType::VAL_BOOL) {
     return a.AsBool() == b.AsBool();
@@ -133,6 +389,12 @@ inline bool is_equal(Value a, Value b) {
   else if (a.Type() == ValueType::VAL_FLOAT) {
     return a.AsFloat() == b.AsFloat();
   }
+  else if (a.Type() == ValueType::VAL_SHORT_STR) {
+    return a.AsString() == b.AsString();
+  }
+  else if (a.IsObjString() && b.IsObjString()) {
+    return a.AsObjString()->Equals(b.AsObjString());
+  }
   else {
     return false;
   }
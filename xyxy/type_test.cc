@@ -1,8 +1,13 @@
 #include "xyxy/type.h"
 
+#include <cmath>
+#include <initializer_list>
+#include <limits>
 #include <memory>
+#include <type_traits>
 
 #include "gtest/gtest.h"
+#include "xyxy/compiler.h"
 
 namespace xyxy {
 
@@ -56,11 +61,161 @@ TEST(Nil, TypeTest) {
 }
 
 TEST(String, TypeTest) {
-  std::unique_ptr<ObjString> p(new ObjString("hello world"));
-  Value val(p.get());
+  Heap heap;
+  Heap::Scope scope(&heap);
+  Value val(ObjString::New("hello world"));
   EXPECT_TRUE(val.IsString());
   EXPECT_EQ(val.AsString(), "hello world");
   EXPECT_EQ(val.ToString(), "hello world");
 }
 
+TEST(Intern, TypeTest) {
+  ObjString* hello = Intern("hello");
+  EXPECT_EQ(Intern("hello"), hello);
+  EXPECT_TRUE(hello->IsInterned());
+  EXPECT_EQ(hello->Hash(), DefaultHasher<std::string>().Hash("hello"));
+  EXPECT_NE(Intern("world"), hello);
+  EXPECT_NE(Value(Intern("world")), Value(hello));
+  // Strings built otherwise are equal by contents.
+  Heap heap;
+  Heap::Scope scope(&heap);
+  ObjString* built = ObjString::New("hel" + std::string("lo"));
+  EXPECT_FALSE(built->IsInterned());
+  EXPECT_EQ(built->Hash(), hello->Hash());
+  EXPECT_EQ(Value(built), Value(hello));
+  // The compiler interns the names, and the literals too long for a value.
+  Compiler compiler;
+  compiler.Compile("var hello = \"hello\"; var world = \"hello, world!\";");
+  Chunk* chunk = compiler.GetChunk();
+  EXPECT_EQ(chunk->GetConstant(0).AsObjString(), hello);
+  EXPECT_TRUE(chunk->GetConstant(1).IsShortString());
+  EXPECT_EQ(chunk->GetConstant(1), Value(hello));
+  EXPECT_EQ(chunk->GetConstant(3).AsObjString(), Intern("hello, world!"));
+}
+
+TEST(ShortString, TypeTest) {
+  Heap heap;
+  Heap::Scope scope(&heap);
+  for (const std::string& str :
+       std::initializer_list<std::string>{"", "a", "tag", "abcdef"}) {
+    Value val = Value::String(str);
+    EXPECT_EQ(val.Type(), ValueType::VAL_SHORT_STR) << str;
+    EXPECT_TRUE(val.IsString() && !val.IsObject() && !val.IsFalsey()) << str;
+    EXPECT_EQ(val.AsString(), str);
+    EXPECT_EQ(val.ToString(), str);
+    EXPECT_EQ(val, Value::String(str));
+    EXPECT_EQ(val, Value(Intern(str)));
+    EXPECT_NE(val, Value::String("?"));
+  }
+  EXPECT_EQ(heap.NumObjects(), 0);
+  // Up to 11 bytes, or 6 without NULs when NaN-boxed.
+  std::string longest(sizeof(Value) == 8 ? 6 : 11, 'x');
+  EXPECT_TRUE(Value::String(longest).IsShortString());
+  Value val = Value::String(longest + "x");
+  EXPECT_TRUE(val.IsObjString());
+  EXPECT_EQ(val.AsString(), longest + "x");
+  EXPECT_EQ(heap.NumObjects(), 1);
+  EXPECT_EQ(Value::String(std::string("a\0b", 3)).AsString(),
+            std::string("a\0b", 3));
+}
+
+TEST(Rope, TypeTest) {
+  Heap heap;
+  Heap::Scope scope(&heap);
+  // Deeper than the native stack would allow to flatten recursively.
+  std::string expected = "report";
+  Value report = Value::String(expected);
+  for (int i = 0; i < 100000; i++) {
+    bool is_short = i % 2;
+    std::string piece = is_short ? " line" : " long line";
+    report = Value::Concat(report, is_short ? Value::String(piece)
+                                            : Value(Intern(piece)));
+    expected += piece;
+  }
+  ObjString* rope = report.AsObjString();
+  EXPECT_TRUE(rope->IsRope());
+  EXPECT_EQ(report.StringSize(), expected.size());
+  EXPECT_EQ(heap.NumObjects(), 100000);
+  EXPECT_EQ(report, Value::String(expected));
+  EXPECT_FALSE(rope->IsRope());
+  EXPECT_EQ(rope->Hash(), DefaultHasher<std::string>().Hash(expected));
+  // Short strings on both sides are copied.
+  Value prefixed = Value::Concat(Value::String("> "), report);
+  EXPECT_EQ(prefixed.AsString(), "> " + expected);
+  EXPECT_EQ(Value::Concat(Value::String("a"), Value::String("b")).AsString(),
+            "ab");
+  EXPECT_EQ(Value::Concat(report, report).StringSize(), 2 * expected.size());
+}
+
+TEST(Numbers, TypeTest) {
+  // The doubles close to the encoding of the other values stay numbers.
+  const double kNumbers[] = {-0.0,
+                             1e308,
+                             -1e-308,
+                             std::numeric_limits<double>::denorm_min(),
+                             std::numeric_limits<double>::infinity(),
+                             -std::numeric_limits<double>::infinity()};
+  for (double n : kNumbers) {
+    Value val(n);
+    EXPECT_TRUE(val.IsFloat()) << n;
+    EXPECT_FALSE(val.IsObject() || val.IsNil() || val.IsBool()) << n;
+    EXPECT_EQ(val.AsFloat(), n);
+    EXPECT_EQ(std::signbit(val.AsFloat()), std::signbit(n));
+  }
+  for (double nan : {std::nan(""), -std::nan(""), 0.0 / 0.0}) {
+    Value val(nan);
+    EXPECT_EQ(val.Type(), ValueType::VAL_FLOAT);
+    EXPECT_TRUE(std::isnan(val.AsFloat()));
+    EXPECT_NE(val, val);
+  }
+}
+
+TEST(Format, TypeTest) {
+  // The shortest text reading back as the number.
+  EXPECT_EQ(Value(3.0).ToString(), "3");
+  EXPECT_EQ(Value(-9.0).ToString(), "-9");
+  EXPECT_EQ(Value(2.5).ToString(), "2.5");
+  EXPECT_EQ(Value(0.1).ToString(), "0.1");
+  EXPECT_EQ(Value(0.1 + 0.2).ToString(), "0.30000000000000004");
+  EXPECT_EQ(Value(1e21).ToString(), "1e+21");
+  EXPECT_EQ(Value(-0.0).ToString(), "-0");
+  EXPECT_EQ(Value(std::numeric_limits<double>::infinity()).ToString(), "inf");
+  const double kLongest = -std::numeric_limits<double>::min();
+  char buf[kMaxNumberChars];
+  std::string text(buf, FormatNumber(kLongest, buf));
+  EXPECT_EQ(text, "-2.2250738585072014e-308");
+  EXPECT_EQ(std::stod(text), kLongest);
+
+  // `print` writes the same text.
+  testing::internal::CaptureStdout();
+  Value(2.5).PrintLine(stdout);
+  Value::String("text").PrintLine(stdout);
+  Value(true).PrintLine(stdout);
+  fflush(stdout);
+  EXPECT_EQ(testing::internal::GetCapturedStdout(), "2.5\ntext\n1\n");
+}
+
+TEST(Layout, TypeTest) {
+#ifdef XYXY_NAN_BOXING
+  EXPECT_EQ(sizeof(Value), 8);
+#else
+  EXPECT_EQ(sizeof(Value), 16);
+#endif
+  Heap heap;
+  Heap::Scope scope(&heap);
+  ObjString* boxed = ObjString::New("boxed");
+  Value val(boxed);
+  EXPECT_EQ(val.Type(), ValueType::VAL_OBJ);
+  EXPECT_FALSE(val.IsFloat() || val.IsNil() || val.IsBool());
+  EXPECT_EQ(val.AsRawObject(), boxed);
+  EXPECT_EQ(val.ObjectType(), ObjType::OBJ_STRING);
+  // The header has no vtable, and the bytes of a string follow it.
+  EXPECT_FALSE(std::is_polymorphic<ObjString>::value);
+  EXPECT_EQ(sizeof(Object), 8);
+  EXPECT_EQ(boxed->str().data(), reinterpret_cast<const char*>(boxed + 1));
+  EXPECT_EQ(Value().Type(), ValueType::VAL_NIL);
+  EXPECT_FALSE(Value(false).IsNil() || Value(true).IsNil());
+  EXPECT_NE(Value(false), Value(true));
+}
+
 }  // namespace xyxy
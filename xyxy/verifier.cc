@@ -0,0 +1,202 @@
+#include "xyxy/verifier.h"
+
+#include "xyxy/superinst.h"
+#include "xyxy/vm.h"
+
+namespace xyxy {
+
+// Returns how many values the inst `opcode` reads from the top of the stack.
+static int StackOperands(uint8 opcode) {
+  switch (opcode) {
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_EQUAL:
+    case OP_GREATER:
+    case OP_LESS:
+      return 2;
+    case OP_NEGATE:
+    case OP_NOT:
+    case OP_PRINT:
+    case OP_POP:
+    case OP_DEFINE_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_SET_LOCAL:
+    case OP_JUMP_IF_FALSE:
+    case OP_JOIN:
+    case OP_TASK_END:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static Status VerifyError(int pc, const std::string& msg) {
+  return Status(INVALID_ARGUMENT, msg + " at " + std::to_string(pc) + ".");
+}
+
+// Returns the offset of the index of a constant among the operands of
+// `opcode`, 0 if it has none.
+static int ConstantOperand(uint8 opcode) {
+  switch (opcode) {
+    case OP_CONSTANT:
+    case OP_DEFINE_GLOBAL:
+    case OP_GET_GLOBAL:
+    case OP_SET_GLOBAL:
+      return 1;
+    case OP_PARALLEL_FOR:
+      return 4;
+    default:
+      return 0;
+  }
+}
+
+// Checks the encoding of the inst at `pc`, regardless of the stack.
+static Status VerifyInst(const Chunk& chunk, int pc) {
+  uint8 raw = chunk.GetByte(pc);
+  if (raw >= OP_COUNT) {
+    return VerifyError(pc, "Unknown opcode");
+  }
+  uint8 opcode = BaseOpcode(raw);
+  if (pc + InstLength(raw) > chunk.size()) {
+    return VerifyError(pc, "Truncated inst");
+  }
+  // Matching a superinst reads the constants of the insts it fuses, they
+  // are checked first.
+  const int end = pc + InstLength(raw);
+  for (int inst = pc; raw != opcode && inst < end;) {
+    uint8 fused = inst == pc ? opcode : chunk.GetByte(inst);
+    if (fused >= OP_COUNT) {
+      break;
+    }
+    fused = BaseOpcode(fused);
+    int operand = ConstantOperand(fused);
+    if (operand && inst + operand < chunk.size() &&
+        chunk.GetByte(inst + operand) >= chunk.NumConstants()) {
+      return VerifyError(pc, "Constant out of range");
+    }
+    inst += InstLength(fused);
+  }
+  if (raw != opcode && InstLength(raw) != InstLength(opcode) &&
+      !IsValidSuperInst(chunk, pc)) {
+    return VerifyError(pc, "Invalid superinst");
+  }
+  switch (opcode) {
+    case OP_CONSTANT:
+    case OP_DEFINE_GLOBAL:
+    case OP_GET_GLOBAL:
+    case OP_SET_GLOBAL: {
+      int index = chunk.GetByte(pc + 1);
+      if (index >= chunk.NumConstants()) {
+        return VerifyError(pc, "Constant out of range");
+      }
+      if (opcode != OP_CONSTANT && !chunk.GetConstant(index).IsObjString()) {
+        return VerifyError(pc, "Global name isn't a string");
+      }
+      break;
+    }
+    case OP_PARALLEL_FOR: {
+      int index = chunk.GetByte(pc + 4);
+      if (index >= chunk.NumConstants()) {
+        return VerifyError(pc, "Constant out of range");
+      }
+      Value step = chunk.GetConstant(index);
+      if (!step.IsFloat() || !(step.AsFloat() > 0)) {
+        return VerifyError(pc, "Step isn't a positive number");
+      }
+      break;
+    }
+    case OP_CONCAT: {
+      if (chunk.GetByte(pc + 1) < 2) {
+        return VerifyError(pc, "Concat of less than 2 values");
+      }
+      break;
+    }
+    default:
+      break;
+  }
+  return Status();
+}
+
+Status VerifyChunk(const Chunk& chunk, std::vector<int>* depths) {
+  const int size = chunk.size();
+  // The start of every inst, superinsts are walked as the insts they fuse.
+  std::vector<bool> is_inst(size + 1, false);
+  is_inst[size] = true;
+  for (int pc = 0; pc < size; pc += InstLength(BaseOpcode(chunk.GetByte(pc)))) {
+    Status status = VerifyInst(chunk, pc);
+    if (!status.ok()) {
+      return status;
+    }
+    is_inst[pc] = true;
+  }
+
+  std::vector<int>& depth = *depths;
+  depth.assign(size + 1, -1);
+  std::vector<int> worklist;
+  auto visit = [&](int from, int pc, int stack_depth) {
+    if (pc < 0 || pc > size || !is_inst[pc]) {
+      return VerifyError(from, "Jump into the middle of an inst");
+    }
+    if (depth[pc] == -1) {
+      depth[pc] = stack_depth;
+      worklist.push_back(pc);
+    }
+    else if (depth[pc] != stack_depth) {
+      return VerifyError(pc, "Inconsistent stack depth");
+    }
+    return Status();
+  };
+  Status status = visit(0, 0, 0);
+  while (status.ok() && !worklist.empty()) {
+    int pc = worklist.back();
+    worklist.pop_back();
+    if (pc == size) {
+      continue;
+    }
+    uint8 opcode = BaseOpcode(chunk.GetByte(pc));
+    if (depth[pc] < StackOperands(opcode) ||
+        (opcode == OP_CONCAT && depth[pc] < chunk.GetByte(pc + 1))) {
+      return VerifyError(pc, "Stack underflow");
+    }
+    if ((opcode == OP_GET_LOCAL || opcode == OP_SET_LOCAL) &&
+        chunk.GetByte(pc + 1) >= depth[pc]) {
+      return VerifyError(pc, "Local out of range");
+    }
+    int next_depth = depth[pc] + StackEffect(chunk, pc);
+    if (next_depth > STACK_SIZE) {
+      return VerifyError(pc, "Stack overflow");
+    }
+    if (opcode == OP_TASK_END) {
+      continue;
+    }
+    if (opcode == OP_SPAWN) {
+      // The body of the task starts with the copied locals only.
+      status.Update(visit(pc, pc + InstLength(opcode), chunk.GetByte(pc + 3)));
+      status.Update(visit(pc, JumpTarget(chunk, pc), next_depth));
+      continue;
+    }
+    if (opcode == OP_PARALLEL_FOR) {
+      // The loop variable, the end of the range and the accumulators.
+      int num_locals = chunk.GetByte(pc + 3) + 2 + chunk.GetByte(pc + 5);
+      if (num_locals > depth[pc]) {
+        return VerifyError(pc, "Local out of range");
+      }
+      status.Update(visit(pc, pc + InstLength(opcode), num_locals));
+      status.Update(visit(pc, JumpTarget(chunk, pc), next_depth));
+      continue;
+    }
+    if (opcode == OP_JUMP_IF_FALSE || opcode == OP_JUMP ||
+        opcode == OP_LOOP) {
+      status.Update(visit(pc, JumpTarget(chunk, pc), next_depth));
+      if (opcode != OP_JUMP_IF_FALSE) {
+        continue;
+      }
+    }
+    status.Update(visit(pc, pc + InstLength(opcode), next_depth));
+  }
+  return status;
+}
+
+}  // namespace xyxy
@@ -0,0 +1,26 @@
+#ifndef XYXY_VERIFIER_H_
+#define XYXY_VERIFIER_H_
+
+#include <vector>
+
+#include "xyxy/chunk.h"
+#include "xyxy/status.h"
+
+namespace xyxy {
+
+// Verifies `chunk` once before running it, so that the VM can run it without
+// checking the bytecode at every inst, see `XYXY_UNCHECKED` in vm.h:
+//   - every opcode is known and its operands fit in the chunk, superinsts
+//     are followed by the insts they fuse,
+//   - jumps land on the start of an inst or at the end of the chunk,
+//   - constants, globals and locals are in range, global names are
+//     strings,
+//   - the stack depth is the same on every path to an inst, never
+//     underflows and fits `STACK_SIZE`.
+// On success the stack depth before every inst is stored into `depths`, -1
+// for the bytes that aren't the start of a reachable inst.
+Status VerifyChunk(const Chunk& chunk, std::vector<int>* depths);
+
+}  // namespace xyxy
+
+#endif  // XYXY_VERIFIER_H_
@@ -0,0 +1,132 @@
+#include "xyxy/verifier.h"
+
+#include "gtest/gtest.h"
+#include "xyxy/compiler.h"
+#include "xyxy/vm.h"
+
+namespace xyxy {
+
+static std::string VerifyError(const Chunk& chunk) {
+  std::vector<int> depths;
+  Status status = VerifyChunk(chunk, &depths);
+  EXPECT_FALSE(status.ok());
+  return status.error_message();
+}
+
+TEST(Compiled, TestVerifier) {
+  Compiler compiler;
+  compiler.Compile(R"(
+    var a = 0;
+    for (var i = 0; i < 10; i = i + 1) {
+      var b = i;
+      if (a != 10 and b >= 4) {
+        a = a + b;
+      }
+    }
+    print a;
+  )");
+  Chunk* chunk = compiler.GetChunk();
+  std::vector<int> depths;
+  Status status = VerifyChunk(*chunk, &depths);
+  EXPECT_TRUE(status.ok()) << status.ToString();
+  EXPECT_EQ(depths[0], 0);
+  EXPECT_EQ(depths[chunk->size()], 0);
+}
+
+TEST(Opcode, TestVerifier) {
+  Chunk chunk;
+  chunk.Write(OP_NIL);
+  chunk.Write(OP_COUNT);
+  EXPECT_EQ(VerifyError(chunk), "Unknown opcode at 1.");
+
+  Chunk truncated;
+  truncated.Write(OP_JUMP);
+  truncated.Write(0);
+  EXPECT_EQ(VerifyError(truncated), "Truncated inst at 0.");
+}
+
+TEST(Jump, TestVerifier) {
+  Chunk chunk;
+  chunk.Write(OP_JUMP);
+  chunk.Write(0);
+  chunk.Write(1);
+  chunk.Write(OP_CONSTANT, chunk.AddConstant(Value(1.0)), Value(1.0));
+  EXPECT_EQ(VerifyError(chunk), "Jump into the middle of an inst at 0.");
+
+  // Both paths reach the end with a different depth.
+  Chunk inconsistent;
+  inconsistent.Write(OP_TRUE);
+  inconsistent.Write(OP_JUMP_IF_FALSE);
+  inconsistent.Write(0);
+  inconsistent.Write(1);
+  inconsistent.Write(OP_POP);
+  EXPECT_EQ(VerifyError(inconsistent), "Inconsistent stack depth at 5.");
+}
+
+TEST(Operands, TestVerifier) {
+  Chunk chunk;
+  chunk.Write(OP_CONSTANT);
+  chunk.Write(0);
+  EXPECT_EQ(VerifyError(chunk), "Constant out of range at 0.");
+
+  Chunk global;
+  global.Write(OP_GET_GLOBAL, 0, Value(1.0));
+  EXPECT_EQ(VerifyError(global), "Global name isn't a string at 0.");
+
+  Chunk local;
+  local.Write(OP_NIL);
+  local.Write(OP_GET_LOCAL);
+  local.Write(1);
+  EXPECT_EQ(VerifyError(local), "Local out of range at 1.");
+}
+
+TEST(Stack, TestVerifier) {
+  Chunk underflow;
+  underflow.Write(OP_NIL);
+  underflow.Write(OP_ADD);
+  EXPECT_EQ(VerifyError(underflow), "Stack underflow at 1.");
+
+  Chunk overflow;
+  for (int i = 0; i <= STACK_SIZE; i++) {
+    overflow.Write(OP_NIL);
+  }
+  EXPECT_EQ(VerifyError(overflow),
+            "Stack overflow at " + std::to_string(STACK_SIZE) + ".");
+}
+
+TEST(SuperInst, TestVerifier) {
+  // OP_NOT_EQUAL isn't followed by OP_NOT.
+  Chunk chunk;
+  chunk.Write(OP_NIL);
+  chunk.Write(OP_NIL);
+  chunk.Write(OP_NOT_EQUAL);
+  chunk.Write(OP_POP);
+  chunk.Write(OP_POP);
+  EXPECT_EQ(VerifyError(chunk), "Invalid superinst at 2.");
+
+  // The global of `OP_INC_GLOBAL` isn't a constant of the chunk.
+  Chunk global;
+  global.Write(OP_INC_GLOBAL);
+  global.Write(9);
+  global.Write(OP_CONSTANT, 0, Value(1.0));
+  global.Write(OP_ADD);
+  global.Write(OP_SET_GLOBAL);
+  global.Write(9);
+  global.Write(OP_POP);
+  global.Write(OP_RETURN);
+  EXPECT_EQ(VerifyError(global), "Constant out of range at 0.");
+}
+
+TEST(VM, TestVerifier) {
+  Chunk chunk;
+  chunk.Write(OP_POP);
+  VMOptions options;
+  options.verify = true;
+  VM vm(&chunk, options);
+  Status status = vm.Run();
+  EXPECT_FALSE(status.ok());
+  EXPECT_EQ(status.error_message(), "Stack underflow at 0.");
+  EXPECT_TRUE(vm.GetStack().Empty());
+}
+
+}  // namespace xyxy
@@ -1,12 +1,27 @@
 #include "xyxy/vm.h"
 
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#include "xyxy/jit.h"
 #include "xyxy/logging.h"
+#include "xyxy/superinst.h"
+#include "xyxy/task.h"
+#include "xyxy/trace.h"
+#include "xyxy/verifier.h"
 #include "xyxy/type.h"
 
 namespace xyxy {
 
 const int Inst::kDumpWidth = 20;
 
+// Number of tasks a parallel `for` is split into for every thread.
+static const int kTasksPerThread = 4;
+
+// Integers up to this magnitude are exact doubles, and so are their sums.
+static const double kMaxExactInteger = 9007199254740992.0;
+
 void Inst::DebugInfo() {
   std::string ret;
   char buf[64];
@@ -40,64 +55,368 @@ void Inst::DebugInfo() {
     }                                            \
   };
 
-DEFINE_INST(OP_RETURN, 1)
-DEFINE_INST(OP_CONSTANT, 2)
-DEFINE_INST(OP_NEGATE, 1)
-DEFINE_INST(OP_ADD, 1)
-DEFINE_INST(OP_SUB, 1)
-DEFINE_INST(OP_MUL, 1)
-DEFINE_INST(OP_DIV, 1)
-DEFINE_INST(OP_NIL, 1)
-DEFINE_INST(OP_TRUE, 1)
-DEFINE_INST(OP_FALSE, 1)
-DEFINE_INST(OP_NOT, 1)
-DEFINE_INST(OP_EQUAL, 1)
-DEFINE_INST(OP_GREATER, 1)
-DEFINE_INST(OP_LESS, 1)
-DEFINE_INST(OP_PRINT, 1)
-DEFINE_INST(OP_POP, 1)
-DEFINE_INST(OP_DEFINE_GLOBAL, 2)
-DEFINE_INST(OP_SET_GLOBAL, 2)
-DEFINE_INST(OP_GET_GLOBAL, 2)
-DEFINE_INST(OP_SET_LOCAL, 2)
-DEFINE_INST(OP_GET_LOCAL, 2)
-DEFINE_INST(OP_JUMP_IF_FALSE, 3)
-DEFINE_INST(OP_JUMP, 3)
-DEFINE_INST(OP_LOOP, 3)
-
-VM::VM(Chunk* chunk) : chunk_(chunk) { pc_ = 0; }
-
-#define CREATE_INST_INSTANCE(inst)          \
+XYXY_OPCODE_LIST(DEFINE_INST)
+
+VM::VM(Chunk* chunk) : VM(chunk, VMOptions()) {}
+
+VM::VM(Chunk* chunk, const VMOptions& options)
+    : chunk_(chunk), options_(options) {
+  pc_ = 0;
+  // Native code doesn't count the loop iterations.
+  if (options_.budget > 0) {
+    options_.jit = false;
+    options_.trace_jit = false;
+  }
+  if (options_.trace_jit && TraceCompiler::Supported()) {
+    traces_ = std::make_unique<TraceCache>(this);
+  }
+  check_loops_ = traces_ != nullptr || options_.budget > 0;
+}
+
+VM::~VM() = default;
+
+Status VM::Run() {
+  Heap::Scope heap_scope(&heap_);
+  Status status;
+  if (!kCheckedBytecode || options_.verify) {
+    status = Verify();
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  if (options_.jit && RunJit(&status)) {
+    return status;
+  }
+  if (traces_) {
+    traces_->CheckChunk();
+  }
+  budget_left_ = options_.budget;
+  budget_exhausted_ = false;
+  status = Interpret();
+  if (status.ok() && budget_exhausted_) {
+    return Status(RESOURCE_EXHAUSTED, "Budget exhausted at " +
+                                          std::to_string(pc_) + ".");
+  }
+  while (status.ok() && traces_ && pc_ < (uint32)chunk_->size()) {
+    // The interpreter stopped at the header of a hot loop.
+    status = traces_->Run();
+    if (status.ok()) {
+      status = Interpret();
+    }
+  }
+  return status;
+}
+
+inline bool VM::OnLoop(const uint8* header, const uint8* loop) {
+  if (traces_) {
+    return traces_->OnLoop(header - chunk_->code(), loop - chunk_->code());
+  }
+  if (--budget_left_ < 0) {
+    budget_exhausted_ = true;
+    return true;
+  }
+  return false;
+}
+
+TaskPool* VM::Pool() {
+  if (!pool_) {
+    // The tasks run the chunk at once on many threads, see `Dequicken`.
+    if (options_.quicken) {
+      Dequicken(chunk_);
+      options_.quicken = false;
+    }
+    int num_threads = options_.task_threads;
+    if (num_threads < 0) {
+      num_threads = std::max<int>(std::thread::hardware_concurrency(), 1) - 1;
+    }
+    own_pool_ = std::make_unique<TaskPool>(num_threads);
+    pool_ = own_pool_.get();
+  }
+  return pool_;
+}
+
+std::unique_ptr<VM> VM::NewTaskVM(const uint8* body, int num_locals) {
+  VMOptions options;
+  options.quicken = false;
+  options.verify = options_.verify;
+  auto vm = std::make_unique<VM>(chunk_, options);
+  vm->pool_ = Pool();
+  vm->pc_ = body - chunk_->code();
+  // A local declared by the inst spawning the task isn't on the stack yet,
+  // the body can't read it anyway.
+  for (int i = 0; i < num_locals; i++) {
+    Value val = i < stack_.Size() ? stack_.Get(i) : XYXY_NIL;
+    // The task runs on another thread.
+    val.FlattenString();
+    vm->stack_.Push(val);
+  }
+  return vm;
+}
+
+std::unique_ptr<VM> VM::Clone() {
+  std::unique_ptr<VM> vm = Clone(chunk_);
+  vm->pc_ = pc_;
+  for (int i = 0; i < stack_.Size(); i++) {
+    Value val = stack_.Get(i);
+    val.FlattenString();
+    vm->stack_.Push(val);
+  }
+  vm->final_print_ = final_print_;
+  vm->printed_ = printed_;
+  vm->verified_depths_ = verified_depths_;
+  vm->verified_size_ = verified_size_;
+  return vm;
+}
+
+std::unique_ptr<VM> VM::Clone(Chunk* chunk) {
+  auto vm = std::make_unique<VM>(chunk, options_);
+  if (global_.Share(&vm->global_, &heap_) && traces_) {
+    // The traces write to the old addresses of the globals, now frozen.
+    traces_ = std::make_unique<TraceCache>(this);
+  }
+  return vm;
+}
+
+void VM::Reset() {
+  // The tasks still running use the heap.
+  if (own_pool_) {
+    own_pool_.reset();
+    pool_ = nullptr;
+  }
+  pc_ = 0;
+  stack_.Clear();
+  global_.Clear();
+  heap_.Clear();
+  final_print_ = XYXY_NIL;
+  printed_ = false;
+  if (traces_) {
+    // The traces write to the addresses of the globals just freed.
+    traces_ = std::make_unique<TraceCache>(this);
+  }
+}
+
+ObjTask* VM::Spawn(const uint8* body, int num_locals) {
+  ObjTask* task = new ObjTask(NewTaskVM(body, num_locals));
+  // Owned by the heap, the handle may outlive the VM running the inst.
+  Heap::Current()->Track(task);
+  pool_->Push(task);
+  return task;
+}
+
+bool VM::Join(ObjTask* task) {
+  pool_->Wait(task);
+  if (!task->GetStatus().ok()) {
+    return false;
+  }
+  stack_.Push(task->Result());
+  return true;
+}
+
+// Operands: offset, offset, slot of the loop variable, step, number of
+// accumulators. The loop variable is followed on the stack by the end of
+// the range and by the accumulators.
+Status VM::ParallelFor(const uint8* ip) {
+  const int slot = ip[3];
+  const int num_accumulators = ip[5];
+  Value start = stack_.Get(slot);
+  Value end = stack_.Get(slot + 1);
+  Value step = chunk_->GetConstant(ip[4]);
+  if (!start.IsFloat() || !end.IsFloat()) {
+    return Status(RUNTIME_ERROR, "Loop bounds must be numbers.");
+  }
+  const double from = start.AsFloat();
+  const double to = end.AsFloat();
+  const double by = step.AsFloat();
+  // Every task runs the iterations of the sequential loop from the value
+  // its variable takes at the first one, up to the value it takes at the
+  // first iteration of the next task, so that the tasks neither repeat nor
+  // skip an iteration. These values are multiples of the step from an
+  // integer start, otherwise the additions of the loop are replayed, as
+  // they round.
+  const bool integers = from == std::trunc(from) && by == std::trunc(by) &&
+                        std::abs(from) < kMaxExactInteger;
+  double count = 0;
+  if (integers) {
+    count = std::ceil((to - from) / by);
+  }
+  else {
+    for (double i = from; i < to; i += by) {
+      if (i + by == i) {
+        return Status(RUNTIME_ERROR, "Loop step is too small.");
+      }
+      count++;
+    }
+  }
+  if (!(count > 0)) {
+    return Status();
+  }
+  // A few tasks per thread, so that the idle threads have some to steal
+  // when the iterations don't take the same time.
+  const int64 num_tasks = std::min<double>(
+      count, (Pool()->NumThreads() + 1) * kTasksPerThread);
+  std::vector<std::unique_ptr<ObjTask>> tasks;
+  // The value of the loop variable at the iteration `done`.
+  double value = from;
+  double done = 0;
+  for (int64 i = 0; i < num_tasks; i++) {
+    auto vm = NewTaskVM(ip + kInstLength[OP_PARALLEL_FOR],
+                        slot + 2 + num_accumulators);
+    vm->stack_.Set(slot, Value(value));
+    if (i + 1 < num_tasks) {
+      const double last = std::floor(count * (i + 1) / num_tasks);
+      if (integers) {
+        value = from + last * by;
+      }
+      else {
+        for (; done < last; done++) {
+          value += by;
+        }
+      }
+      done = last;
+      vm->stack_.Set(slot + 1, Value(value));
+    }
+    for (int j = 0; j < num_accumulators; j++) {
+      vm->stack_.Set(slot + 2 + j, Value(0));
+    }
+    tasks.push_back(std::make_unique<ObjTask>(std::move(vm)));
+    pool_->Push(tasks.back().get());
+  }
+  // All the tasks must be done before freeing them, even after an error.
+  for (auto& task : tasks) {
+    pool_->Wait(task.get());
+  }
+  for (auto& task : tasks) {
+    if (!task->GetStatus().ok()) {
+      return task->GetStatus();
+    }
+    ValueStack& partial = task->vm_->stack_;
+    for (int j = slot + 2; j < slot + 2 + num_accumulators; j++) {
+      Value sum = stack_.Get(j);
+      Value value = partial.Get(j);
+      if (!sum.IsFloat() || !value.IsFloat()) {
+        return Status(RUNTIME_ERROR, "Accumulator must be a number.");
+      }
+      stack_.Set(j, Value(sum.AsFloat() + value.AsFloat()));
+    }
+  }
+  return Status();
+}
+
+const char* VM::AddTop(int n) {
+  const int first = stack_.Size() - n;
+  size_t size = 0;
+  bool strings = true;
+  for (int i = first; i < stack_.Size() && strings; i++) {
+    Value val = stack_.Get(i);
+    strings = val.IsString();
+    size += strings ? val.StringSize() : 0;
+  }
+  Value sum;
+  const char* error = nullptr;
+  if (strings && size <= Value::kMaxShortString) {
+    std::string joined;
+    for (int i = first; i < stack_.Size(); i++) {
+      joined += stack_.Get(i).AsString();
+    }
+    sum = Value::String(joined);
+  }
+  else if (strings) {
+    // A single allocation. A heap string on the left, e.g. a rope growing in
+    // a loop, is kept as the left of a rope node holding the other strings,
+    // as `Value::Concat` does, rather than copied each time.
+    Value lhs = stack_.Get(first);
+    const ObjString* left = lhs.IsObjString() ? lhs.AsObjString() : nullptr;
+    const int rest = left ? first + 1 : first;
+    sum = Value(ObjString::New(left, size - (left ? left->size() : 0),
+                               [this, rest](char* bytes) {
+                                 for (int i = rest; i < stack_.Size(); i++) {
+                                   bytes += stack_.Get(i).CopyTo(bytes);
+                                 }
+                               }));
+  }
+  else {
+    sum = stack_.Get(first);
+    for (int i = first + 1; i < stack_.Size() && !error; i++) {
+      Value rhs = stack_.Get(i);
+      if (rhs.IsString()) {
+        if (!sum.IsString()) {
+          error = "Operand must be a string.";
+        }
+        else {
+          sum = Value::Concat(sum, rhs);
+        }
+      }
+      else if (!sum.IsFloat()) {
+        error = "Unsupported binary operation.";
+      }
+      else if (!rhs.IsFloat()) {
+        error = "Operand must be a number.";
+      }
+      else {
+        sum = Value::Result(sum.AsFloat() + rhs.AsFloat());
+      }
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    stack_.Pop();
+  }
+  if (!error) {
+    stack_.Push(sum);
+  }
+  return error;
+}
+
+const char* VM::GenericBinaryOp(uint8 opcode) {
+  if (opcode == OP_ADD) {
+    return AddTop(2);
+  }
+  // The other ops only take numbers, and an operand isn't one.
+  stack_.Pop();
+  Value lhs = stack_.Pop();
+  if (!lhs.IsFloat()) {
+    return "Unsupported binary operation.";
+  }
+  return "Operand must be a number.";
+}
+
+Status VM::Verify() {
+  if (verified_size_ != chunk_->size()) {
+    Status status = VerifyChunk(*chunk_, &verified_depths_);
+    if (!status.ok()) {
+      return status;
+    }
+    verified_size_ = chunk_->size();
+  }
+  if (verified_depths_[pc_] != stack_.Size()) {
+    return Status(INVALID_ARGUMENT,
+                  "Stack depth doesn't match the chunk at " +
+                      std::to_string(pc_) + ".");
+  }
+  return Status();
+}
+
+bool VM::RunJit(Status* status) {
+  // The chunk may have grown since it was compiled.
+  if (!jit_code_ || jit_code_->ChunkSize() != chunk_->size()) {
+    jit_code_ = JitCompiler::Compile(this);
+  }
+  if (!jit_code_ || !jit_code_->HasEntry(pc_)) {
+    return false;
+  }
+  const char* error = nullptr;
+  pc_ = jit_code_->Run(pc_, &error);
+  *status = error ? Status(RUNTIME_ERROR, error) : Status();
+  return true;
+}
+
+#define CREATE_INST_INSTANCE(inst, length)  \
   case inst: {                              \
     return std::make_unique<Inst_##inst>(); \
   }
 
 static std::unique_ptr<Inst> DispatchInst(uint8 opcode) {
   switch (opcode) {
-    CREATE_INST_INSTANCE(OP_RETURN)
-    CREATE_INST_INSTANCE(OP_CONSTANT)
-    CREATE_INST_INSTANCE(OP_NEGATE)
-    CREATE_INST_INSTANCE(OP_ADD)
-    CREATE_INST_INSTANCE(OP_SUB)
-    CREATE_INST_INSTANCE(OP_MUL)
-    CREATE_INST_INSTANCE(OP_DIV)
-    CREATE_INST_INSTANCE(OP_NIL)
-    CREATE_INST_INSTANCE(OP_TRUE)
-    CREATE_INST_INSTANCE(OP_FALSE)
-    CREATE_INST_INSTANCE(OP_NOT)
-    CREATE_INST_INSTANCE(OP_EQUAL)
-    CREATE_INST_INSTANCE(OP_GREATER)
-    CREATE_INST_INSTANCE(OP_LESS)
-    CREATE_INST_INSTANCE(OP_PRINT)
-    CREATE_INST_INSTANCE(OP_POP)
-    CREATE_INST_INSTANCE(OP_DEFINE_GLOBAL)
-    CREATE_INST_INSTANCE(OP_SET_GLOBAL)
-    CREATE_INST_INSTANCE(OP_GET_GLOBAL)
-    CREATE_INST_INSTANCE(OP_SET_LOCAL)
-    CREATE_INST_INSTANCE(OP_GET_LOCAL)
-    CREATE_INST_INSTANCE(OP_JUMP_IF_FALSE)
-    CREATE_INST_INSTANCE(OP_JUMP)
-    CREATE_INST_INSTANCE(OP_LOOP)
+    XYXY_OPCODE_LIST(CREATE_INST_INSTANCE)
     default: {
       CHECK(false);
       break;
@@ -107,18 +426,26 @@ static std::unique_ptr<Inst> DispatchInst(uint8 opcode) {
 }
 
 // TODO(): refact this function.
-std::unique_ptr<Inst> VM::CreateInst(uint8 offset) {
+std::unique_ptr<Inst> VM::CreateInst(int offset) {
   OpCode byte = (OpCode)chunk_->GetByte(offset);
   auto inst = DispatchInst(byte);
   inst->address_ = offset;
-  if (byte == OP_SET_LOCAL || byte == OP_GET_LOCAL) {
+  if (BaseOpcode(byte) != byte) {
+    // Superinsts keep the raw bytes of the insts they fuse.
+    for (int i = 1; i <= inst->Length() - 1; i++) {
+      inst->metadata_.push_back(chunk_->GetByte(offset + i));
+    }
+  }
+  else if (byte == OP_SET_LOCAL || byte == OP_GET_LOCAL) {
     CHECK(inst->metadata_.empty());
     inst->metadata_.push_back(chunk_->GetByte(offset + 1));
   }
-  else if (byte == OP_JUMP_IF_FALSE || byte == OP_JUMP || byte == OP_LOOP) {
+  else if (byte == OP_JUMP_IF_FALSE || byte == OP_JUMP || byte == OP_LOOP ||
+           byte == OP_SPAWN || byte == OP_PARALLEL_FOR) {
     CHECK(inst->metadata_.empty());
-    inst->metadata_.push_back(chunk_->GetByte(offset + 1));
-    inst->metadata_.push_back(chunk_->GetByte(offset + 2));
+    for (int i = 1; i <= inst->Length() - 1; i++) {
+      inst->metadata_.push_back(chunk_->GetByte(offset + i));
+    }
   }
   else {
     for (int i = 1; i <= inst->Length() - 1; i++) {
@@ -130,27 +457,6 @@ std::unique_ptr<Inst> VM::CreateInst(uint8 offset) {
   return inst;
 }
 
-#define BINARY_OP(op)                                                \
-  do {                                                               \
-    auto rhs = stack_.Pop();                                         \
-    auto lhs = stack_.Pop();                                         \
-    if (lhs.IsFloat()) {                                             \
-      if (!rhs.IsFloat()) {                                          \
-        return Status(RUNTIME_ERROR, "Operand must be a number.");   \
-      }                                                              \
-      double a = lhs.AsFloat();                                      \
-      double b = rhs.AsFloat();                                      \
-      Value res = Value(a op b);                                     \
-      LOGcc << "Binary op: " << lhs.ToString() << " " << #op << " "  \
-            << rhs.ToString() << " = " << res.ToString();            \
-      stack_.Push(res);                                              \
-      break;                                                         \
-    }                                                                \
-    else {                                                           \
-      return Status(RUNTIME_ERROR, "Unsupported binary operation."); \
-    }                                                                \
-  } while (false)
-
 void VM::DumpInsts() {
   LOGvv << "-------------RAW CODE-------------------";
   for (int pc = 0; pc < chunk_->size();) {
@@ -169,187 +475,209 @@ void VM::DumpStack() {
   LOGvv << "---------------------------------------";
 }
 
-Status VM::Run() {
-  DumpInsts();
-  for (; pc_ < chunk_->size();) {
-    auto inst = CreateInst(pc_);
-    inst->DebugInfo();
-    switch (inst->opcode_) {
-      case OP_RETURN: {
-        break;
-      }
-      case OP_CONSTANT: {
-        CHECK(!inst->operands_.empty());
-        LOGcc << "Define constant: " << inst->operands_[0].ToString();
-        stack_.Push(inst->operands_[0]);
-        break;
-      }
-      case OP_NEGATE: {
-        if (!stack_.Top().IsFloat()) {
-          return Status(RUNTIME_ERROR, "Operand must be a number.");
-        }
-        Value val = stack_.Pop();
-        stack_.Push(Value(-val.AsFloat()));
-        break;
-      }
-      case OP_ADD: {
-        // TODO(): support a += b.
-        if (stack_.Top().IsString()) {
-          auto lhs = stack_.Pop();
-          auto rhs = stack_.Pop();
-          LOGcc << "Binary add: " << lhs.ToString() << " " << rhs.ToString();
-          if (!rhs.IsString()) {
-            return Status(RUNTIME_ERROR, "Operand must be a string.");
-          }
-          string a = lhs.AsString();
-          string b = rhs.AsString();
-          // NOTE: the order here must be `b + a`.
-          b += a;
-          stack_.Push(Value(new ObjString(b)));
-        }
-        else {
-          BINARY_OP(+);
-        }
-        break;
-      }
-      case OP_SUB: {
-        BINARY_OP(-);
-        break;
-      }
-      case OP_MUL: {
-        BINARY_OP(*);
-        break;
-      }
-      case OP_DIV: {
-        BINARY_OP(/);
-        break;
-      }
-      case OP_NIL: {
-        stack_.Push(XYXY_NIL);
-        break;
-      }
-      case OP_TRUE: {
-        stack_.Push(Value(true));
-        break;
-      }
-      case OP_FALSE: {
-        stack_.Push(Value(false));
-        break;
-      }
-      case OP_NOT: {
-        stack_.Push(Value(stack_.Pop().IsFalsey()));
-        break;
-      }
-      case OP_EQUAL: {
-        BINARY_OP(==);
-        break;
-      }
-      case OP_GREATER: {
-        BINARY_OP(>);
-        break;
-      }
-      case OP_LESS: {
-        BINARY_OP(<);
-        break;
-      }
-      case OP_PRINT: {
-        final_print_ = stack_.Top().ToString();
-        printf("%s\n", stack_.Pop().ToString().c_str());
-        LOGcc << "Stack size after print: " << stack_.Size();
-        break;
-      }
-      case OP_POP: {
-        LOGcc << "Pop out: " << stack_.Top().ToString();
-        stack_.Pop();
-        break;
-      }
-      case OP_DEFINE_GLOBAL: {
-        // Pop one value out from stack and assign it as the global variable.
-        CHECK(!inst->operands_.empty());
-        std::string var_name = inst->operands_[0].ToString();
-        LOGcc << "Define global: " << var_name << " "
-              << stack_.Top().ToString();
-        global_.Insert(var_name, stack_.Pop());
-        break;
-      }
-      case OP_GET_GLOBAL: {
-        CHECK(!inst->operands_.empty());
-        string var_name = inst->operands_[0].ToString();
-        Value val;
-        if (!global_.Find(var_name, &val)) {
-          // TODO(): Error handling
-          CHECK(false);
-        }
-        LOGcc << "Get global: " << var_name << " " << val.ToString();
-        stack_.Push(val);
-        break;
-      }
-      case OP_SET_GLOBAL: {
-        CHECK(!inst->operands_.empty());
-        string var_name = inst->operands_[0].ToString();
-        if (!global_.Find(var_name)) {
-          // TODO(): Error handling
-          CHECK(false);
-        }
-        // Sets to a new value.
-        LOGcc << "Set global: " << var_name << " " << stack_.Top().ToString();
-        // NOTE: here we dont pop the value from stack.
-        global_.Insert(var_name, stack_.Top());
-        break;
-      }
-      case OP_GET_LOCAL: {
-        CHECK(!inst->metadata_.empty());
-        uint8 slot = inst->metadata_[0];
-        LOGcc << "Get local: " << stack_.Get(slot).ToString();
-        stack_.Push(stack_.Get(slot));
-        break;
-      }
-      case OP_SET_LOCAL: {
-        CHECK(!inst->metadata_.empty());
-        uint8 slot = inst->metadata_[0];
-        // NOTE: here we dont pop the value from stack.
-        LOGcc << "Set local: " << stack_.Top().ToString();
-        stack_.Set(slot, stack_.Top());
-        break;
-      }
-      case OP_JUMP_IF_FALSE: {
-        auto meta = inst->metadata_;
-        CHECK(meta.size() == 2);
-        uint16_t count = (uint16_t)((meta[0] << 8) | meta[1]);
-        // Also skip the inst itself.
-        count += inst->Length();
-        if (stack_.Top().IsFalsey()) {
-          pc_ += count;
-          LOGcc << "Jump over " << count << " to " << pc_;
-          continue;
-        }
-        break;
-      }
-      case OP_JUMP: {
-        auto meta = inst->metadata_;
-        CHECK(meta.size() == 2);
-        uint16_t count = (uint16_t)((meta[0] << 8) | meta[1]);
-        count += inst->Length();
-        pc_ += count;
-        LOGcc << "Jump over " << count << " to " << pc_;
-        continue;
-      }
-      case OP_LOOP: {
-        auto meta = inst->metadata_;
-        CHECK(meta.size() == 2);
-        uint16_t count = (uint16_t)((meta[0] << 8) | meta[1]);
-        pc_ -= count;
-        LOGcc << "Jump back " << count << " to " << pc_;
-        continue;
-      }
+const char* DispatchStrategy() {
+#if defined(XYXY_DISPATCH_SWITCH)
+  return "switch";
+#elif defined(XYXY_DISPATCH_GOTO)
+  return "goto";
+#else
+  return "tailcall";
+#endif
+}
+
+// Logs every inst before executing it, only in debug mode since it costs a
+// check per dispatch.
+#ifndef NDEBUG
+#define TRACE_INST()                                      \
+  if (VLOG_IS_ON(2)) {                                    \
+    vm->CreateInst(ip - vm->chunk_->code())->DebugInfo(); \
+  }
+#else
+#define TRACE_INST()
+#endif
+
+// Checks the bytecode in debug builds, unless it was verified before running,
+// see `kCheckedBytecode`.
+#define ASSERT_BYTECODE(cond) assert(!kCheckedBytecode || (cond))
+
+#ifdef XYXY_PROFILE_OPCODES
+#define PROFILE_INST()        \
+  if (vm->profile_) {         \
+    vm->profile_->Record(ip); \
+  }
+#else
+#define PROFILE_INST()
+#endif
+
+// NOTE: not wrapped with `do {} while (false)` since `DISPATCH()` is a
+// `continue` under the switch dispatch.
+#define NEXT(opcode)           \
+  {                            \
+    ip += kInstLength[opcode]; \
+    DISPATCH();                \
+  }
+
+#if defined(XYXY_DISPATCH_TAILCALL)
+
+#define HANDLER(opcode) \
+  void VM::Handle_##opcode(VM* vm, const uint8* ip, const uint8* end)
+
+#define DISPATCH()                                  \
+  do {                                              \
+    if (XY_PREDICT_FALSE(ip == end)) {              \
+      vm->pc_ = ip - vm->chunk_->code();            \
+      return;                                       \
+    }                                               \
+    TRACE_INST();                                   \
+    PROFILE_INST();                                 \
+    ASSERT_BYTECODE(*ip < OP_COUNT);                \
+    XY_MUSTTAIL return kHandlers[*ip](vm, ip, end); \
+  } while (false)
+
+#define THROW(msg)                              \
+  do {                                          \
+    vm->pc_ = ip - vm->chunk_->code();          \
+    vm->status_ = Status(RUNTIME_ERROR, (msg)); \
+    return;                                     \
+  } while (false)
+
+#define YIELD()                        \
+  do {                                 \
+    vm->pc_ = ip - vm->chunk_->code(); \
+    return;                            \
+  } while (false)
+
+#include "xyxy/vm_handlers.inc"
+
+#define XYXY_HANDLER_ENTRY(opcode, length) &VM::Handle_##opcode,
+const VM::Handler VM::kHandlers[OP_COUNT] = {
+    XYXY_OPCODE_LIST(XYXY_HANDLER_ENTRY)};
+#undef XYXY_HANDLER_ENTRY
+
+Status VM::Interpret() {
+  if (VLOG_IS_ON(2)) {
+    DumpInsts();
+  }
+  VM* vm = this;
+  const uint8* ip = chunk_->code() + pc_;
+  const uint8* end = chunk_->code() + chunk_->size();
+  status_ = Status();
+  if (ip != end) {
+    TRACE_INST();
+    PROFILE_INST();
+    kHandlers[*ip](vm, ip, end);
+  }
+  return status_;
+}
+
+#else  // XYXY_DISPATCH_SWITCH || XYXY_DISPATCH_GOTO
+
+#define THROW(msg)                       \
+  do {                                   \
+    vm->pc_ = ip - vm->chunk_->code();   \
+    return Status(RUNTIME_ERROR, (msg)); \
+  } while (false)
+
+#define YIELD()                        \
+  do {                                 \
+    vm->pc_ = ip - vm->chunk_->code(); \
+    return Status();                   \
+  } while (false)
+
+Status VM::Interpret() {
+  if (VLOG_IS_ON(2)) {
+    DumpInsts();
+  }
+  VM* vm = this;
+  const uint8* ip = chunk_->code() + pc_;
+  const uint8* end = chunk_->code() + chunk_->size();
+
+#if defined(XYXY_DISPATCH_SWITCH)
+
+#define HANDLER(opcode) case opcode:
+#define DISPATCH() continue
+
+  while (ip != end) {
+    TRACE_INST();
+    PROFILE_INST();
+    switch (*ip) {
+#include "xyxy/vm_handlers.inc"
       default: {
-        CHECK(false) << "Unkown inst to run with pc: " << pc_;
+        CHECK(false) << "Unkown inst to run with pc: " << ip - chunk_->code();
         break;
       }
     }
-    pc_ += inst->Length();
   }
+
+#else  // XYXY_DISPATCH_GOTO
+
+#define HANDLER(opcode) TARGET_##opcode:
+#define DISPATCH()                     \
+  do {                                 \
+    if (XY_PREDICT_FALSE(ip == end)) { \
+      goto done;                       \
+    }                                  \
+    TRACE_INST();                      \
+    PROFILE_INST();                    \
+    ASSERT_BYTECODE(*ip < OP_COUNT);   \
+    goto* kTargets[*ip];               \
+  } while (false)
+
+#define XYXY_TARGET_ENTRY(opcode, length) &&TARGET_##opcode,
+  static void* const kTargets[OP_COUNT] = {
+      XYXY_OPCODE_LIST(XYXY_TARGET_ENTRY)};
+#undef XYXY_TARGET_ENTRY
+
+  DISPATCH();
+#include "xyxy/vm_handlers.inc"
+done:
+
+#endif
+
+  pc_ = ip - chunk_->code();
+  return Status();
+}
+
+#endif
+
+#undef HANDLER
+#undef DISPATCH
+#undef THROW
+#undef YIELD
+
+// Every handler stops after its inst, without any check on the loops.
+#define HANDLER(opcode) case opcode:
+#define DISPATCH() goto stepped
+#define YIELD() goto stepped
+#define THROW(msg)                       \
+  do {                                   \
+    vm->pc_ = ip - vm->chunk_->code();   \
+    return Status(RUNTIME_ERROR, (msg)); \
+  } while (false)
+
+Status VM::Step() {
+  VM* vm = this;
+  const uint8* ip = chunk_->code() + pc_;
+  CHECK(pc_ < (uint32)chunk_->size());
+  switch (*ip) {
+#include "xyxy/vm_handlers.inc"
+    default: {
+      CHECK(false) << "Unkown inst to run with pc: " << pc_;
+      break;
+    }
+  }
+stepped:
+  pc_ = ip - chunk_->code();
   return Status();
 }
 
+#undef HANDLER
+#undef DISPATCH
+#undef YIELD
+#undef NEXT
+#undef THROW
+#undef TRACE_INST
+#undef PROFILE_INST
+#undef ASSERT_BYTECODE
+
 }  // namespace xyxy
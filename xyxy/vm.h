@@ -1,45 +1,279 @@
 #ifndef XYXY_VM_H_
 #define XYXY_VM_H_
 
+#include <cstdio>
 #include <memory>
+#include <vector>
 
 #include "xyxy/chunk.h"
-#include "xyxy/hash_table.h"
+#include "xyxy/globals.h"
 #include "xyxy/stack.h"
 #include "xyxy/status.h"
 
 namespace xyxy {
 
-typedef enum {
-  OP_RETURN,
-  OP_CONSTANT,
-  OP_NEGATE,
-  OP_ADD,
-  OP_SUB,
-  OP_MUL,
-  OP_DIV,
-  OP_NIL,
-  OP_TRUE,
-  OP_FALSE,
-  OP_NOT,
-  OP_EQUAL,
-  OP_GREATER,
-  OP_LESS,
-  OP_PRINT,
-  OP_POP,
-  OP_DEFINE_GLOBAL,
-  OP_SET_GLOBAL,
-  OP_GET_GLOBAL,
-  OP_GET_LOCAL,
-  OP_SET_LOCAL,
-  OP_JUMP_IF_FALSE,
-  OP_JUMP,
-  OP_LOOP,
-} OpCode;
+// All opcodes together with their length in bytes (opcode + operands).
+// Everything that needs to know about the opcode set is generated from
+// this single list.
+#define XYXY_OPCODE_LIST(V) \
+  XYXY_BASE_OPCODE_LIST(V)  \
+  XYXY_SUPERINST_LIST(V)    \
+  XYXY_QUICKENED_LIST(V)
+
+// Opcodes emitted by the compiler.
+#define XYXY_BASE_OPCODE_LIST(V) \
+  V(OP_RETURN, 1)                \
+  V(OP_CONSTANT, 2)              \
+  V(OP_NEGATE, 1)                \
+  V(OP_ADD, 1)                   \
+  V(OP_SUB, 1)                   \
+  V(OP_MUL, 1)                   \
+  V(OP_DIV, 1)                   \
+  V(OP_NIL, 1)                   \
+  V(OP_TRUE, 1)                  \
+  V(OP_FALSE, 1)                 \
+  V(OP_NOT, 1)                   \
+  V(OP_EQUAL, 1)                 \
+  V(OP_GREATER, 1)               \
+  V(OP_LESS, 1)                  \
+  V(OP_PRINT, 1)                 \
+  V(OP_POP, 1)                   \
+  V(OP_DEFINE_GLOBAL, 2)         \
+  V(OP_SET_GLOBAL, 2)            \
+  V(OP_GET_GLOBAL, 2)            \
+  V(OP_GET_LOCAL, 2)             \
+  V(OP_SET_LOCAL, 2)             \
+  V(OP_JUMP_IF_FALSE, 3)         \
+  V(OP_JUMP, 3)                  \
+  V(OP_LOOP, 3)                  \
+  V(OP_SPAWN, 4)                 \
+  V(OP_JOIN, 1)                  \
+  V(OP_TASK_END, 1)              \
+  V(OP_PARALLEL_FOR, 6)          \
+  V(OP_CONCAT, 2)
+
+// Superinstructions, see `FuseSuperInsts` in superinst.h. A superinst only
+// replaces the first opcode of the sequence it fuses and its length covers
+// the whole sequence, the other insts of the sequence are left untouched.
+#define XYXY_SUPERINST_LIST(V)                                            \
+  V(OP_NOT_EQUAL, 2)          /* OP_EQUAL OP_NOT                       */ \
+  V(OP_GREATER_EQUAL, 2)      /* OP_LESS OP_NOT                        */ \
+  V(OP_LESS_EQUAL, 2)         /* OP_GREATER OP_NOT                     */ \
+  V(OP_JUMP_IF_FALSE_POP, 4)  /* OP_JUMP_IF_FALSE OP_POP               */ \
+  V(OP_SET_LOCAL_POP, 3)      /* OP_SET_LOCAL OP_POP                   */ \
+  V(OP_SET_GLOBAL_POP, 3)     /* OP_SET_GLOBAL OP_POP                  */ \
+  V(OP_INC_LOCAL, 8)          /* OP_GET_LOCAL OP_CONSTANT OP_ADD          \
+                                 OP_SET_LOCAL OP_POP                   */ \
+  V(OP_INC_GLOBAL, 8)         /* OP_GET_GLOBAL OP_CONSTANT OP_ADD         \
+                                 OP_SET_GLOBAL OP_POP                  */ \
+  V(OP_TEST_LESS_CONST, 7)    /* OP_CONSTANT OP_LESS OP_JUMP_IF_FALSE     \
+                                 OP_POP                                */ \
+  V(OP_TEST_GREATER_CONST, 7) /* OP_CONSTANT OP_GREATER OP_JUMP_IF_FALSE  \
+                                 OP_POP                                */
+
+// Quickened opcodes, specialized on the types of their operands. The first
+// execution of a generic opcode rewrites itself in place into the quickened
+// one matching its operands, which in turn rewrites itself back into the
+// generic one when the operands have other types.
+#define XYXY_QUICKENED_LIST(V) \
+  V(OP_ADD_NUM_NUM, 1)         \
+  V(OP_ADD_STR_STR, 1)         \
+  V(OP_SUB_NUM_NUM, 1)         \
+  V(OP_MUL_NUM_NUM, 1)         \
+  V(OP_DIV_NUM_NUM, 1)         \
+  V(OP_EQUAL_NUM_NUM, 1)       \
+  V(OP_GREATER_NUM_NUM, 1)     \
+  V(OP_LESS_NUM_NUM, 1)
+
+#define XYXY_OPCODE_ENUM(opcode, length) opcode,
+
+typedef enum { XYXY_OPCODE_LIST(XYXY_OPCODE_ENUM) OP_COUNT } OpCode;
+
+#undef XYXY_OPCODE_ENUM
+
+#define XYXY_OPCODE_LENGTH(opcode, length) length,
+// Length in bytes of every inst, indexed by opcode.
+inline constexpr uint8 kInstLength[] = {XYXY_OPCODE_LIST(XYXY_OPCODE_LENGTH)};
+#undef XYXY_OPCODE_LENGTH
+
+// Returns the length in bytes of the inst starting with `opcode`.
+inline uint8 InstLength(uint8 opcode) {
+  assert(opcode < OP_COUNT);
+  return kInstLength[opcode];
+}
+
+// Returns the opcode emitted by the compiler at the place of `opcode`, i.e.
+// the first opcode of the sequence for a superinst, or the generic opcode
+// for a quickened one. Since a superinst leaves
+// the rest of its sequence untouched, skipping `InstLength(BaseOpcode(op))`
+// bytes walks through the original insts.
+inline uint8 BaseOpcode(uint8 opcode) {
+  switch (opcode) {
+    case OP_NOT_EQUAL:
+      return OP_EQUAL;
+    case OP_GREATER_EQUAL:
+      return OP_LESS;
+    case OP_LESS_EQUAL:
+      return OP_GREATER;
+    case OP_JUMP_IF_FALSE_POP:
+      return OP_JUMP_IF_FALSE;
+    case OP_SET_LOCAL_POP:
+      return OP_SET_LOCAL;
+    case OP_SET_GLOBAL_POP:
+      return OP_SET_GLOBAL;
+    case OP_INC_LOCAL:
+      return OP_GET_LOCAL;
+    case OP_INC_GLOBAL:
+      return OP_GET_GLOBAL;
+    case OP_TEST_LESS_CONST:
+    case OP_TEST_GREATER_CONST:
+      return OP_CONSTANT;
+    case OP_ADD_NUM_NUM:
+    case OP_ADD_STR_STR:
+      return OP_ADD;
+    case OP_SUB_NUM_NUM:
+      return OP_SUB;
+    case OP_MUL_NUM_NUM:
+      return OP_MUL;
+    case OP_DIV_NUM_NUM:
+      return OP_DIV;
+    case OP_EQUAL_NUM_NUM:
+      return OP_EQUAL;
+    case OP_GREATER_NUM_NUM:
+      return OP_GREATER;
+    case OP_LESS_NUM_NUM:
+      return OP_LESS;
+    default:
+      return opcode;
+  }
+}
+
+// Returns how many values the inst `opcode` emitted by the compiler pushes
+// onto (or pops out of when negative) the stack.
+inline int StackEffect(uint8 opcode) {
+  switch (opcode) {
+    case OP_CONSTANT:
+    case OP_NIL:
+    case OP_TRUE:
+    case OP_FALSE:
+    case OP_GET_GLOBAL:
+    case OP_GET_LOCAL:
+    case OP_SPAWN:
+      return 1;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_EQUAL:
+    case OP_GREATER:
+    case OP_LESS:
+    case OP_PRINT:
+    case OP_POP:
+    case OP_DEFINE_GLOBAL:
+    case OP_TASK_END:
+      return -1;
+    default:
+      return 0;
+  }
+}
+
+// Same as above for the inst at `pc` of `chunk`, including the insts whose
+// effect depends on their operands.
+inline int StackEffect(const Chunk& chunk, int pc) {
+  uint8 opcode = BaseOpcode(chunk.GetByte(pc));
+  if (opcode == OP_CONCAT) {
+    return 1 - chunk.GetByte(pc + 1);
+  }
+  return StackEffect(opcode);
+}
+
+// Returns the target of the jump inst at `pc`, for `OP_SPAWN` and
+// `OP_PARALLEL_FOR` the inst right after the body of the tasks.
+inline int JumpTarget(const Chunk& chunk, int pc) {
+  uint8 opcode = BaseOpcode(chunk.GetByte(pc));
+  int offset = (chunk.GetByte(pc + 1) << 8) | chunk.GetByte(pc + 2);
+  if (opcode == OP_LOOP) {
+    return pc - offset;
+  }
+  return pc + offset + InstLength(opcode);
+}
+
+// The dispatch strategy of `VM::Run` is selected at build time by defining
+// one of the following macros, e.g. `--copt=-DXYXY_DISPATCH_TAILCALL`:
+//   XYXY_DISPATCH_SWITCH:   a single `switch` inside a loop.
+//   XYXY_DISPATCH_GOTO:     direct threading with computed goto, needs the
+//                           GCC/Clang labels-as-values extension.
+//   XYXY_DISPATCH_TAILCALL: one function per opcode, every handler tail
+//                           calls the handler of the next inst. Only
+//                           supported with Clang's `musttail`. Other
+//                           compilers build it on a best effort basis:
+//                           the optimizer (-O2) may turn the calls into
+//                           jumps, and if a handler doesn't, each executed
+//                           inst takes a native stack frame and long
+//                           scripts crash. See the NOTE in
+//                           `vm_handlers.inc`.
+// All of them share the handlers defined in `vm_handlers.inc`.
+#if !defined(XYXY_DISPATCH_SWITCH) && !defined(XYXY_DISPATCH_GOTO) && \
+    !defined(XYXY_DISPATCH_TAILCALL)
+#if defined(__GNUC__)
+#define XYXY_DISPATCH_GOTO
+#else
+#define XYXY_DISPATCH_SWITCH
+#endif
+#endif
+
+// Returns the name of the dispatch strategy this library is built with.
+const char* DispatchStrategy();
 
 // Forward declaration.
 class VM;
+class JitCode;
+class ObjTask;
+class OpcodeProfile;
+class TaskPool;
+class TraceCache;
+
+struct VMOptions {
+  // Runs the chunk as native code, see jit.h. Falls back to the interpreter
+  // when the platform or the chunk isn't supported by the JIT.
+  bool jit = false;
+  // Records the hot loops run by the interpreter and runs them as native
+  // code, see trace.h. Only used by the interpreter, i.e. without `jit` or
+  // when the JIT can't compile the chunk.
+  bool trace_jit = false;
+  // Verifies the chunk before running it, see verifier.h. Always on when
+  // built with `XYXY_UNCHECKED`.
+  bool verify = false;
+  // Number of loop iterations a single `VM::Run` may execute, unlimited if
+  // 0. Only counted at the back edges, `OP_LOOP`. Once it runs out, `Run`
+  // returns a `RESOURCE_EXHAUSTED` status and stops at the header of the
+  // loop, the next `Run` resumes from there with a fresh budget. The JITs
+  // aren't used with a budget.
+  int64 budget = 0;
+  // Rewrites the generic insts into quickened ones while running, see
+  // `XYXY_QUICKENED_LIST`. Off for a chunk shared by VMs on many threads,
+  // the quickened insts already in the chunk then run their generic op when
+  // their operands don't match, see `Dequicken`.
+  bool quicken = true;
+  // Number of threads running the tasks spawned by the chunk, see task.h,
+  // besides the thread running the VM. `hardware_concurrency() - 1` if
+  // negative. The threads only start at the first `spawn`.
+  int task_threads = -1;
+};
+
+// Built with `XYXY_UNCHECKED`, the VM only runs verified chunks and the
+// checks of the bytecode and of the stack bounds are compiled out of the
+// execution loop.
+#ifdef XYXY_UNCHECKED
+static const bool kCheckedBytecode = false;
+#else
+static const bool kCheckedBytecode = true;
+#endif
+
+typedef Stack<Value, STACK_SIZE, kCheckedBytecode> ValueStack;
 
+// A decoded instruction, only used for disassembling and debugging, the
+// execution loop reads the bytecode directly.
 class Inst {
  public:
   Inst() {}
@@ -74,38 +308,169 @@ class Inst {
 class VM {
  public:
   explicit VM(Chunk* chunk);
+  VM(Chunk* chunk, const VMOptions& options);
 
-  virtual ~VM() = default;
+  virtual ~VM();
 
+  // Runs from the current pc to the end of the chunk.
   Status Run();
 
-  std::unique_ptr<Inst> CreateInst(uint8 offset);
+  // Returns a VM in the same state, i.e. running the same chunk from the
+  // same pc with a copy of the stack. The globals are copied on write, see
+  // `Globals`, so cloning takes the same time whatever their number. The
+  // objects are shared rather than copied, the VM must outlive its clones
+  // and must not be running. The clones share the chunk, they must not
+  // quicken it when running on other threads, see `VMOptions::quicken`.
+  std::unique_ptr<VM> Clone();
+
+  // Same as above but the clone runs `chunk`, not owned, from its start
+  // with an empty stack, e.g. the handler of a request run over the globals
+  // of an initialized VM.
+  std::unique_ptr<VM> Clone(Chunk* chunk);
+
+  // Starts over, the next `Run` runs the chunk from its start with an empty
+  // stack and without the globals written since the VM was created, or
+  // cloned for a clone. Frees the objects allocated while running, except
+  // the ones allocated before the last `Clone`, which the globals shared
+  // with the clones may point to. The other values read from the VM aren't
+  // valid after.
+  // Only takes the time to free what the runs allocated, except that the
+  // traces are recorded again after a reset.
+  void Reset();
+
+  // Decodes the inst at `offset` for disassembling.
+  std::unique_ptr<Inst> CreateInst(int offset);
 
   Chunk* GetChunk() { return chunk_; }
 
   void DumpInsts();
 
-  std::string FinalResult() { return final_print_; }
+  std::string FinalResult() { return printed_ ? final_print_.ToString() : ""; }
+
+  // The last value printed, nil if none.
+  Value FinalValue() { return final_print_; }
+
+  ValueStack& GetStack() { return stack_; }
 
-  Stack<Value, STACK_SIZE>& GetStack() { return stack_; }
+  Globals& GetGlobal() { return global_; }
 
-  hash_table<string, Value>& GetGlobal() { return global_; }
+  // The objects allocated while running, freed along with the VM.
+  Heap* GetHeap() { return &heap_; }
 
   void DumpStack();
 
   uint32 PC() { return pc_; }
 
+#ifdef XYXY_PROFILE_OPCODES
+  // Records every executed inst into `profile`, not owned.
+  void SetProfile(OpcodeProfile* profile) { profile_ = profile; }
+#endif
+
  private:
+  friend class JitCompiler;
+  friend class ObjTask;
+  friend class Snapshot;
+  friend class TraceCache;
+  friend class TraceCompiler;
+
+  // Pops the `n` values on top of the stack and pushes their sum, the same
+  // as `n - 1` `OP_ADD`s, see `OP_CONCAT`. Returns nullptr or the error of
+  // the first add failing.
+  const char* AddTop(int n);
+
+  // Runs the generic binary `opcode` on the two values on top of the stack
+  // whose types don't match its quickened form, see `DEQUICKEN`. Returns
+  // nullptr or the runtime error.
+  const char* GenericBinaryOp(uint8 opcode);
+
+  // Pops the value on top of the stack and prints it.
+  void PrintTop() {
+    final_print_ = stack_.Pop();
+    printed_ = true;
+    final_print_.PrintLine(stdout);
+  }
+
+  // Runs the chunk with the interpreter, until the end of the chunk or the
+  // header of a loop with a trace to run.
+  Status Interpret();
+
+  // Executes the inst at the current pc only.
+  Status Step();
+
+  // Verifies the chunk if it changed since the last run, and that the
+  // stack matches the current pc.
+  Status Verify();
+
+  // Runs the chunk as native code, returns false if the JIT can't run it.
+  bool RunJit(Status* status);
+
+  // Called at the back edge of a loop when `check_loops_` is set, returns
+  // true to stop the interpreter at the loop `header`.
+  bool OnLoop(const uint8* header, const uint8* loop);
+
+  // Starts a task running the body at `body` on a new VM, with a copy of the
+  // first `num_locals` slots of the stack.
+  ObjTask* Spawn(const uint8* body, int num_locals);
+
+  // Runs other tasks until `task` is done, then pushes its result. Returns
+  // false if the task failed.
+  bool Join(ObjTask* task);
+
+  // Runs the `OP_PARALLEL_FOR` at `ip` over all its iterations, split into
+  // tasks, and adds up their accumulators into the ones on the stack.
+  Status ParallelFor(const uint8* ip);
+
+  // Returns the pool running the tasks, started on the first call.
+  TaskPool* Pool();
+
+  // Creates the VM of a task running the body at `body`, with a copy of
+  // the first `num_locals` slots of the stack.
+  std::unique_ptr<VM> NewTaskVM(const uint8* body, int num_locals);
+
+#ifdef XYXY_DISPATCH_TAILCALL
+  // Signature shared by all the opcode handlers, `ip` points to the inst to
+  // execute and `end` to the end of the bytecode.
+  // A handler stores a runtime error into `status_` before returning.
+  typedef void (*Handler)(VM* vm, const uint8* ip, const uint8* end);
+  static const Handler kHandlers[OP_COUNT];
+  Status status_;
+
+#define XYXY_DECLARE_HANDLER(opcode, length) \
+  static void Handle_##opcode(VM* vm, const uint8* ip, const uint8* end);
+  XYXY_OPCODE_LIST(XYXY_DECLARE_HANDLER)
+#undef XYXY_DECLARE_HANDLER
+#endif
+
   // A simple way to remember the last print result for verifying,
   // TODO(): not only verfiy the final result, but also the intermediate
   // execution result.
-  std::string final_print_;
+  Value final_print_;
+  bool printed_ = false;
   Chunk* chunk_;  // Not owned.
   // Virtual machine stack.
-  Stack<Value, STACK_SIZE> stack_;
+  ValueStack stack_;
   // Store all global variabls.
-  hash_table<string, Value> global_;
+  Globals global_;
+  Heap heap_;
+  // The pool running the tasks of the VM and of its tasks, owned by the VM
+  // which isn't a task. Destroyed before `heap_`, which owns the tasks.
+  std::unique_ptr<TaskPool> own_pool_;
+  TaskPool* pool_ = nullptr;
   uint32 pc_;
+  VMOptions options_;
+  std::unique_ptr<JitCode> jit_code_;
+  std::unique_ptr<TraceCache> traces_;
+  // Set when `OP_LOOP` has more to do than jumping back, so that a VM
+  // without traces nor budget only pays for one predicted branch.
+  bool check_loops_ = false;
+  int64 budget_left_ = 0;
+  bool budget_exhausted_ = false;
+  // Stack depth before every inst of the verified chunk, see `VerifyChunk`.
+  std::vector<int> verified_depths_;
+  int verified_size_ = -1;
+#ifdef XYXY_PROFILE_OPCODES
+  OpcodeProfile* profile_ = nullptr;
+#endif
 };
 
 }  // namespace xyxy
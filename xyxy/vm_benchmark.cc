@@ -0,0 +1,239 @@
+// Benchmarks the execution loop of the VM on a few loop heavy scripts, with
+// the stack based and the register based bytecode, and with the JIT.
+//
+// Every dispatch strategy has its own target, e.g.
+//   bazel run -c opt //xyxy:vm_benchmark_goto
+//   bazel run -c opt //xyxy:vm_benchmark_tailcall
+// and `vm_benchmark_profile` also reports the most executed opcode pairs
+// and triples of the stack based bytecode. Then a benchmark scores many
+// records with one VM per record and with `BatchVM`, and a last one runs
+// requests over initialized globals, initializing a new VM per request or
+// cloning an initialized one.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "xyxy/batch.h"
+#include "xyxy/compiler.h"
+#include "xyxy/register_vm.h"
+#include "xyxy/superinst.h"
+#include "xyxy/vm.h"
+
+namespace xyxy {
+
+struct Benchmark {
+  const char* name;
+  const char* source;
+};
+
+static const Benchmark kBenchmarks[] = {
+    {"counting_loop", R"(
+      var a = 0;
+      for (var i = 0; i < 1000000; i = i + 1) {
+        a = a + i;
+      }
+      print a;
+    )"},
+    {"nested_loops", R"(
+      var a = 0;
+      for (var i = 0; i < 1000; i = i + 1) {
+        for (var j = 0; j < 1000; j = j + 1) {
+          a = a + 1;
+        }
+      }
+      print a;
+    )"},
+    {"branchy_loop", R"(
+      var a = 0;
+      var b = 0;
+      var i = 0;
+      while (i < 1000000) {
+        if (a > b) {
+          b = b + 2;
+        }
+        elif (a == b) {
+          a = a + 1;
+        }
+        else {
+          a = a + 3;
+        }
+        i = i + 1;
+      }
+      print a + b;
+    )"},
+    {"string_building", R"(
+      var s = "report:";
+      for (var i = 0; i < 100000; i = i + 1) {
+        s = s + " line";
+      }
+      print s;
+    )"},
+};
+
+static const int kRepeats = 5;
+
+#ifdef XYXY_PROFILE_OPCODES
+static OpcodeProfile profile;
+#endif
+
+// Execution tiers to compare.
+enum Tier {
+  TIER_STACK,
+  TIER_REGISTER,
+  TIER_JIT,
+  TIER_TRACE,
+};
+
+// Returns the median of `kRepeats` runs in milliseconds.
+static double RunBenchmark(const Benchmark& bench, Tier tier) {
+  std::vector<double> times;
+  for (int i = 0; i < kRepeats; i++) {
+    Compiler compiler;
+    compiler.Compile(bench.source);
+    RegChunk reg_chunk;
+    Status status = LowerToRegisters(*compiler.GetChunk(), &reg_chunk);
+    CHECK(status.ok()) << status;
+    VMOptions options;
+    options.jit = tier == TIER_JIT;
+    options.trace_jit = tier == TIER_TRACE;
+    VM vm(compiler.GetChunk(), options);
+    RegisterVM reg_vm(&reg_chunk);
+#ifdef XYXY_PROFILE_OPCODES
+    if (i == 0) {
+      vm.SetProfile(&profile);
+    }
+#endif
+    auto start = std::chrono::steady_clock::now();
+    status = tier == TIER_REGISTER ? reg_vm.Run() : vm.Run();
+    auto stop = std::chrono::steady_clock::now();
+    CHECK(status.ok()) << status;
+    times.push_back(
+        std::chrono::duration<double, std::milli>(stop - start).count());
+  }
+  std::sort(times.begin(), times.end());
+  return times[kRepeats / 2];
+}
+
+// Scores `kNumRecords` records of the input `x`.
+static const char* kScoreRecord = R"(
+  var score = 0;
+  if (x > 0.5) {
+    score = x * 2 - 1;
+  }
+  else {
+    score = 1 - x;
+  }
+  for (var i = 0; i < 8; i = i + 1) {
+    score = score * 0.5 + x;
+  }
+)";
+
+static const int kNumRecords = 100000;
+
+// Returns the median of `kRepeats` runs in milliseconds.
+static double RunScoreRecords(bool batch) {
+  std::vector<double> x(kNumRecords);
+  for (int i = 0; i < kNumRecords; i++) {
+    x[i] = (i % 1000) / 1000.0;
+  }
+  std::vector<double> times;
+  for (int i = 0; i < kRepeats; i++) {
+    Compiler compiler;
+    compiler.Compile(kScoreRecord);
+    auto start = std::chrono::steady_clock::now();
+    if (batch) {
+      BatchVM vm(compiler.GetChunk(), kNumRecords);
+      vm.SetGlobal("x", x);
+      Status status = vm.Run();
+      CHECK(status.ok()) << status;
+    }
+    else {
+      for (int record = 0; record < kNumRecords; record++) {
+        VM vm(compiler.GetChunk());
+        vm.GetGlobal().Insert("x", Value(x[record]));
+        Status status = vm.Run();
+        CHECK(status.ok()) << status;
+      }
+    }
+    auto stop = std::chrono::steady_clock::now();
+    times.push_back(
+        std::chrono::duration<double, std::milli>(stop - start).count());
+  }
+  std::sort(times.begin(), times.end());
+  return times[kRepeats / 2];
+}
+
+static const int kNumInitGlobals = 100;
+static const int kNumRequests = 10000;
+
+// Returns the median of `kRepeats` runs in milliseconds.
+static double RunRequests(bool clone) {
+  std::string init;
+  for (int i = 0; i < kNumInitGlobals; i++) {
+    init += "var g" + std::to_string(i) + " = " + std::to_string(i) + ";\n";
+  }
+  Compiler init_compiler;
+  init_compiler.Compile(init);
+  Compiler compiler;
+  compiler.Compile("g7 = g7 + g42; print g7;");
+  VM initialized(init_compiler.GetChunk());
+  CHECK(initialized.Run().ok());
+  std::vector<double> times;
+  for (int i = 0; i < kRepeats; i++) {
+    auto start = std::chrono::steady_clock::now();
+    for (int request = 0; request < kNumRequests; request++) {
+      if (clone) {
+        std::unique_ptr<VM> vm = initialized.Clone(compiler.GetChunk());
+        Status status = vm->Run();
+        CHECK(status.ok()) << status;
+      }
+      else {
+        VM init_vm(init_compiler.GetChunk());
+        Status status = init_vm.Run();
+        CHECK(status.ok()) << status;
+        VM vm(compiler.GetChunk());
+        init_vm.GetGlobal().ForEach([&vm](const std::string& name, Value val) {
+          vm.GetGlobal().Insert(name, val);
+        });
+        status = vm.Run();
+        CHECK(status.ok()) << status;
+      }
+    }
+    auto stop = std::chrono::steady_clock::now();
+    times.push_back(
+        std::chrono::duration<double, std::milli>(stop - start).count());
+  }
+  std::sort(times.begin(), times.end());
+  return times[kRepeats / 2];
+}
+
+}  // namespace xyxy
+
+int main(int argc, char** argv) {
+  // NOTE: the report goes to stderr to keep it apart from what the scripts
+  // print.
+  fprintf(stderr, "dispatch: %s\n", xyxy::DispatchStrategy());
+  fprintf(stderr, "%-20s %13s %13s %13s %13s\n", "", "stack", "register",
+          "jit", "trace");
+  for (const auto& bench : xyxy::kBenchmarks) {
+    fprintf(stderr, "%-20s %10.3f ms %10.3f ms %10.3f ms %10.3f ms\n",
+            bench.name, xyxy::RunBenchmark(bench, xyxy::TIER_STACK),
+            xyxy::RunBenchmark(bench, xyxy::TIER_REGISTER),
+            xyxy::RunBenchmark(bench, xyxy::TIER_JIT),
+            xyxy::RunBenchmark(bench, xyxy::TIER_TRACE));
+  }
+  fprintf(stderr, "\n%-20s %13s %13s\n", "", "vm/record", "batch");
+  fprintf(stderr, "%-20s %10.3f ms %10.3f ms\n", "score_records",
+          xyxy::RunScoreRecords(false), xyxy::RunScoreRecords(true));
+  fprintf(stderr, "\n%-20s %13s %13s\n", "", "init", "clone");
+  fprintf(stderr, "%-20s %10.3f ms %10.3f ms\n", "requests",
+          xyxy::RunRequests(false), xyxy::RunRequests(true));
+#ifdef XYXY_PROFILE_OPCODES
+  fprintf(stderr, "%s", xyxy::profile.Report(10).c_str());
+#endif
+  return 0;
+}
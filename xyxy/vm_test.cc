@@ -0,0 +1,378 @@
+#include "xyxy/vm.h"
+
+#include "gtest/gtest.h"
+#include "xyxy/compiler.h"
+
+namespace xyxy {
+
+TEST(InstLength, TestVM) {
+  EXPECT_EQ(InstLength(OP_RETURN), 1);
+  EXPECT_EQ(InstLength(OP_CONSTANT), 2);
+  EXPECT_EQ(InstLength(OP_GET_LOCAL), 2);
+  EXPECT_EQ(InstLength(OP_JUMP_IF_FALSE), 3);
+  EXPECT_EQ(InstLength(OP_LOOP), 3);
+}
+
+TEST(CreateInst, TestVM) {
+  Chunk chunk;
+  // Pad the chunk so that the insts we decode are located beyond 255.
+  for (int i = 0; i < 300; i++) {
+    chunk.Write(OP_NIL, 1);
+  }
+  chunk.Write(OP_GET_LOCAL, 1);
+  chunk.Write(7, 1);
+  chunk.Write(OP_JUMP, 1);
+  chunk.Write(1, 1);
+  chunk.Write(2, 1);
+
+  VM vm(&chunk);
+  auto inst = vm.CreateInst(300);
+  EXPECT_EQ(inst->Opcode(), OP_GET_LOCAL);
+  EXPECT_EQ(inst->Length(), 2);
+  inst = vm.CreateInst(302);
+  EXPECT_EQ(inst->Opcode(), OP_JUMP);
+  EXPECT_EQ(inst->Length(), 3);
+}
+
+TEST(RunLoop, TestVM) {
+  Compiler compiler;
+  compiler.Compile(R"(
+    var a = 0;
+    for (var i = 0; i < 1000; i = i + 1) {
+      a = a + i;
+    }
+    print a;
+  )");
+  VM vm(compiler.GetChunk());
+  EXPECT_TRUE(vm.Run().ok());
+  EXPECT_EQ(vm.FinalResult(), "499500");
+  EXPECT_EQ(vm.PC(), compiler.GetChunk()->size());
+  EXPECT_TRUE(vm.GetStack().Empty());
+}
+
+TEST(LongLoop, TestVM) {
+  // Each dispatch of the tail call build must be a jump, otherwise the
+  // native stack overflows long before the end of the loop.
+  Compiler compiler;
+  compiler.Compile(R"(
+    var a = 0;
+    for (var i = 0; i < 1000000; i = i + 1) {
+      a = a + i;
+      if (a < 0) {
+        print a;
+      }
+    }
+    print a;
+  )");
+  VM vm(compiler.GetChunk());
+  EXPECT_TRUE(vm.Run().ok());
+  EXPECT_EQ(vm.FinalResult(), "499999500000");
+}
+
+// Returns the opcode of the first inst of `chunk` with `BaseOpcode` `base`.
+static uint8 FindOpcode(Chunk* chunk, uint8 base) {
+  for (int pc = 0; pc < chunk->size(); pc += InstLength(chunk->GetByte(pc))) {
+    if (BaseOpcode(chunk->GetByte(pc)) == base) {
+      return chunk->GetByte(pc);
+    }
+  }
+  return OP_COUNT;
+}
+
+TEST(Quicken, TestVM) {
+  Compiler compiler;
+  compiler.Compile(R"(
+    var a = 1;
+    var b = 2;
+    for (var i = 0; i < 2; i = i + 1) {
+      print a + a;
+      a = "s";
+      print b * b;
+    }
+  )");
+  Chunk* chunk = compiler.GetChunk();
+  EXPECT_EQ(FindOpcode(chunk, OP_ADD), OP_ADD);
+  VM vm(chunk);
+  EXPECT_TRUE(vm.Run().ok());
+  EXPECT_EQ(vm.FinalResult(), "4");
+  // The addition ran on numbers then on strings.
+  EXPECT_EQ(FindOpcode(chunk, OP_ADD), OP_ADD_STR_STR);
+  EXPECT_EQ(FindOpcode(chunk, OP_MUL), OP_MUL_NUM_NUM);
+}
+
+TEST(QuickenError, TestVM) {
+  Compiler compiler;
+  compiler.Compile(R"(
+    var a = 1;
+    for (var i = 0; i < 2; i = i + 1) {
+      print a - 1;
+      a = nil;
+    }
+  )");
+  VM vm(compiler.GetChunk());
+  Status status = vm.Run();
+  EXPECT_FALSE(status.ok());
+  EXPECT_EQ(status.error_message(), "Unsupported binary operation.");
+  EXPECT_EQ(FindOpcode(compiler.GetChunk(), OP_SUB), OP_SUB);
+}
+
+TEST(QuickenOff, TestVM) {
+  Compiler compiler;
+  compiler.Compile(R"(
+    var a = 1;
+    for (var i = 0; i < 2; i = i + 1) {
+      print a + a;
+      a = "s";
+    }
+  )");
+  Chunk* chunk = compiler.GetChunk();
+  VM vm(chunk);
+  testing::internal::CaptureStdout();
+  EXPECT_TRUE(vm.Run().ok());
+  EXPECT_EQ(FindOpcode(chunk, OP_ADD), OP_ADD_STR_STR);
+  // The inst quickened by the first VM adds numbers too, and is left as is.
+  VMOptions options;
+  options.quicken = false;
+  VM shared(chunk, options);
+  Status status = shared.Run();
+  testing::internal::GetCapturedStdout();
+  EXPECT_TRUE(status.ok()) << status.ToString();
+  EXPECT_EQ(shared.FinalResult(), "ss");
+  EXPECT_EQ(FindOpcode(chunk, OP_ADD), OP_ADD_STR_STR);
+}
+
+TEST(Budget, TestVM) {
+  Compiler compiler;
+  compiler.Compile(R"(
+    var a = 0;
+    for (var i = 0; i < 1000; i = i + 1) {
+      a = a + i;
+    }
+    print a;
+  )");
+  VMOptions options;
+  options.budget = 100;
+  VM vm(compiler.GetChunk(), options);
+  // Every iteration jumps back twice, to the increment then to the
+  // condition.
+  int runs = 1;
+  Status status = vm.Run();
+  while (status.code() == RESOURCE_EXHAUSTED) {
+    status = vm.Run();
+    runs++;
+  }
+  EXPECT_TRUE(status.ok()) << status.ToString();
+  EXPECT_EQ(runs, 20);
+  EXPECT_EQ(vm.FinalResult(), "499500");
+  EXPECT_TRUE(vm.GetStack().Empty());
+}
+
+TEST(BudgetInfiniteLoop, TestVM) {
+  Compiler compiler;
+  compiler.Compile(R"(
+    var a = 0;
+    while (true) {
+      a = a + 1;
+    }
+  )");
+  VMOptions options;
+  options.budget = 1000;
+  options.jit = true;
+  VM vm(compiler.GetChunk(), options);
+  for (int i = 1; i <= 3; i++) {
+    Status status = vm.Run();
+    EXPECT_EQ(status.code(), RESOURCE_EXHAUSTED);
+    // The body runs once more before every one of the 1000 back edges.
+    EXPECT_EQ(vm.GetGlobal().FindValue("a")->AsFloat(), i * 1001);
+  }
+}
+
+TEST(ShortStrings, TestVM) {
+  Compiler compiler;
+  compiler.Compile(R"(
+    var key = "k";
+    var i = 0;
+    while (i < 4) {
+      key = key + "e";
+      i = i + 1;
+    }
+    print key + "y";
+  )");
+  VM vm(compiler.GetChunk());
+  testing::internal::CaptureStdout();
+  EXPECT_TRUE(vm.Run().ok());
+  testing::internal::GetCapturedStdout();
+  EXPECT_EQ(vm.FinalResult(), "keeeey");
+  // The strings are stored in the values, none is allocated.
+  EXPECT_EQ(vm.GetHeap()->NumObjects(), 0);
+}
+
+TEST(Concat, TestVM) {
+  Compiler compiler;
+  compiler.Compile(R"(
+    var name = "a long enough name";
+    print "<" + name + "|" + name + ">";
+  )");
+  VM vm(compiler.GetChunk());
+  testing::internal::CaptureStdout();
+  EXPECT_TRUE(vm.Run().ok());
+  testing::internal::GetCapturedStdout();
+  EXPECT_EQ(vm.FinalResult(), "<a long enough name|a long enough name>");
+  // The pieces are joined in one string, not in one per `+`.
+  EXPECT_EQ(vm.GetHeap()->NumObjects(), 1);
+
+  // A heap string on the left isn't copied, one rope node per chain holds
+  // the other pieces.
+  Compiler growing;
+  growing.Compile(R"(
+    var s = "a long enough start";
+    for (var i = 0; i < 3; i = i + 1) {
+      s = s + "|" + "piece";
+    }
+    print s;
+  )");
+  VM growing_vm(growing.GetChunk());
+  testing::internal::CaptureStdout();
+  EXPECT_TRUE(growing_vm.Run().ok());
+  testing::internal::GetCapturedStdout();
+  EXPECT_EQ(growing_vm.FinalResult(),
+            "a long enough start|piece|piece|piece");
+  EXPECT_EQ(growing_vm.GetHeap()->NumObjects(), 3);
+
+  // Adding a number to the chain fails as `OP_ADD` would.
+  Compiler mixed;
+  mixed.Compile("print 1 + \" and \" + \"2\";");
+  VM mixed_vm(mixed.GetChunk());
+  Status status = mixed_vm.Run();
+  EXPECT_EQ(status.code(), RUNTIME_ERROR);
+  EXPECT_EQ(status.error_message(), "Operand must be a string.");
+}
+
+TEST(Globals, TestVM) {
+  Globals globals;
+  EXPECT_TRUE(globals.Insert("a", Value(1)));
+  EXPECT_FALSE(globals.Insert("a", Value(2)));
+  Heap heap;
+  Globals clone;
+  EXPECT_TRUE(globals.Share(&clone, &heap));
+  // Nothing written since, the same layer is shared again.
+  Globals other;
+  EXPECT_FALSE(globals.Share(&other, &heap));
+  EXPECT_EQ(globals.NumLayers(), 1);
+
+  // Writes are only seen by the VM writing.
+  EXPECT_FALSE(clone.Insert("a", Value(3)));
+  EXPECT_TRUE(clone.Insert("b", Value(4)));
+  *other.FindValue("a") = Value(5);
+  Value val;
+  EXPECT_TRUE(globals.Find("a", &val));
+  EXPECT_EQ(val, Value(2));
+  EXPECT_FALSE(globals.Find("b"));
+  EXPECT_TRUE(clone.Find("a", &val));
+  EXPECT_EQ(val, Value(3));
+  EXPECT_TRUE(other.Find("a", &val));
+  EXPECT_EQ(val, Value(5));
+  EXPECT_EQ(other.FindValue("b"), nullptr);
+
+  int count = 0;
+  clone.ForEach([&count](const std::string& name, Value val) {
+    EXPECT_EQ(val, name == "a" ? Value(3) : Value(4));
+    count++;
+  });
+  EXPECT_EQ(count, 2);
+}
+
+TEST(Clone, TestVM) {
+  Compiler init;
+  init.Compile(R"(
+    var requests = 0;
+    var prefix = "request";
+  )");
+  VM vm(init.GetChunk());
+  ASSERT_TRUE(vm.Run().ok());
+
+  Compiler handler;
+  handler.Compile(R"(
+    requests = requests + 1;
+    var seen = prefix + " handled";
+    print requests;
+  )");
+  for (int i = 0; i < 3; i++) {
+    std::unique_ptr<VM> clone = vm.Clone(handler.GetChunk());
+    testing::internal::CaptureStdout();
+    Status status = clone->Run();
+    std::string printed = testing::internal::GetCapturedStdout();
+    EXPECT_TRUE(status.ok()) << status.ToString();
+    // Every clone starts over from the initialized globals.
+    EXPECT_EQ(clone->FinalResult(), Value(1).ToString());
+    EXPECT_NE(printed.find("1"), std::string::npos);
+    Value seen;
+    EXPECT_TRUE(clone->GetGlobal().Find("seen", &seen));
+    EXPECT_EQ(seen.AsString(), "request handled");
+  }
+  EXPECT_EQ(vm.GetGlobal().FindValue("requests")->AsFloat(), 0);
+  EXPECT_FALSE(vm.GetGlobal().Find("seen"));
+  EXPECT_EQ(vm.GetGlobal().NumLayers(), 1);
+
+  // A clone reset starts over from the globals it was cloned with.
+  std::unique_ptr<VM> clone = vm.Clone(handler.GetChunk());
+  for (int i = 0; i < 2; i++) {
+    clone->Reset();
+    testing::internal::CaptureStdout();
+    EXPECT_TRUE(clone->Run().ok());
+    testing::internal::GetCapturedStdout();
+    EXPECT_EQ(clone->FinalValue(), Value(1));
+  }
+}
+
+TEST(CloneReset, TestVM) {
+  Compiler init;
+  init.Compile(R"(
+    var a = "abcdefghijklmnop";
+    var s = a + a;
+  )");
+  VM vm(init.GetChunk());
+  ASSERT_TRUE(vm.Run().ok());
+  Compiler request;
+  request.Compile("print s;");
+  vm.Clone(request.GetChunk());
+  // The strings of the globals the clones share outlive the reset.
+  vm.Reset();
+  EXPECT_EQ(vm.GetHeap()->NumObjects(), 0);
+  std::unique_ptr<VM> clone = vm.Clone(request.GetChunk());
+  testing::internal::CaptureStdout();
+  EXPECT_TRUE(clone->Run().ok());
+  testing::internal::GetCapturedStdout();
+  EXPECT_EQ(clone->FinalResult(), "abcdefghijklmnopabcdefghijklmnop");
+}
+
+TEST(CloneRunning, TestVM) {
+  Compiler compiler;
+  compiler.Compile(R"(
+    var a = 0;
+    {
+      var step = 2;
+      for (var i = 0; i < 1000; i = i + 1) {
+        a = a + step;
+      }
+    }
+    print a;
+  )");
+  VMOptions options;
+  options.budget = 100;
+  options.verify = true;
+  VM vm(compiler.GetChunk(), options);
+  EXPECT_EQ(vm.Run().code(), RESOURCE_EXHAUSTED);
+  // The clone resumes from the same pc and stack, apart from the VM.
+  std::unique_ptr<VM> clone = vm.Clone();
+  for (VM* run : {clone.get(), &vm}) {
+    Status status = run->Run();
+    while (status.code() == RESOURCE_EXHAUSTED) {
+      status = run->Run();
+    }
+    EXPECT_TRUE(status.ok()) << status.ToString();
+    EXPECT_EQ(run->FinalResult(), Value(2000).ToString());
+  }
+}
+
+}  // namespace xyxy